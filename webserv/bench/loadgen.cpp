@@ -0,0 +1,415 @@
+// Closed-loop HTTP/1.1 load generator: every connection keeps `depth`
+// requests in flight (pipelined), sends the next batch once the previous
+// one is answered, and reconnects when the server closes. Prints JSON.
+//
+//   bench/loadgen [--host 127.0.0.1] [--port 8080] [--connections 64]
+//                 [--depth 1] [--duration 10] [--path /] [--cgi-path /cgi-bin/bench.py]
+//                 [--cgi-ratio 0.0] [--close] [--server-pid PID] [--name label]
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <csignal>
+
+#define READ_CHUNK 65536
+
+struct Options {
+	std::string host;
+	int port;
+	size_t connections;
+	size_t depth;
+	double duration;
+	std::string path;
+	std::string cgi_path;
+	double cgi_ratio;
+	bool keepalive;
+	long server_pid;
+	std::string name;
+
+	Options() : host("127.0.0.1"), port(8080), connections(64), depth(1), duration(10), path("/"),
+		cgi_path("/cgi-bin/bench.py"), cgi_ratio(0), keepalive(true), server_pid(0), name("load") {}
+};
+
+// One response being read off the wire
+struct ResponseReader {
+	enum State { HEAD, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_CRLF, TRAILER };
+	State state;
+	size_t remaining;
+	bool close_after;
+	int status;
+
+	ResponseReader() { reset(); }
+	void reset() {
+		state = HEAD;
+		remaining = 0;
+		close_after = false;
+		status = 0;
+	}
+};
+
+struct Connection {
+	int fd;
+	std::string out;      // requests not yet written
+	size_t out_offset;
+	std::string in;       // bytes not yet parsed
+	ResponseReader reader;
+	std::vector<long long> sent_at; // start time of each request in flight
+	size_t answered;      // of the batch in flight
+
+	Connection() : fd(-1), out_offset(0), answered(0) {}
+};
+
+static long long nowUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static bool headerValue(const std::string& head, const char* name, std::string& value) {
+	size_t name_len = std::strlen(name);
+	size_t pos = head.find("\r\n");
+	while (pos != std::string::npos && pos + 2 < head.size()) {
+		size_t line = pos + 2;
+		size_t end = head.find("\r\n", line);
+		if (end == std::string::npos)
+			end = head.size();
+		if (end - line > name_len && strncasecmp(head.c_str() + line, name, name_len) == 0 &&
+		    head[line + name_len] == ':') {
+			size_t first = head.find_first_not_of(" \t", line + name_len + 1);
+			value = first < end ? head.substr(first, end - first) : "";
+			return true;
+		}
+		pos = end;
+	}
+	return false;
+}
+
+// Consumes as much of `in` as belongs to the current response; true once it is complete
+static bool readResponse(Connection& conn) {
+	ResponseReader& r = conn.reader;
+	while (true) {
+		if (r.state == ResponseReader::HEAD) {
+			size_t end = conn.in.find("\r\n\r\n");
+			if (end == std::string::npos)
+				return false;
+			std::string head = conn.in.substr(0, end + 2);
+			conn.in.erase(0, end + 4);
+			r.status = std::atoi(head.c_str() + 9);
+			std::string value;
+			if (headerValue(head, "Connection", value) && strncasecmp(value.c_str(), "close", 5) == 0)
+				r.close_after = true;
+			if (headerValue(head, "Transfer-Encoding", value) && value.find("chunked") != std::string::npos) {
+				r.state = ResponseReader::CHUNK_SIZE;
+			} else {
+				r.remaining = headerValue(head, "Content-Length", value) ? std::strtoul(value.c_str(), NULL, 10) : 0;
+				r.state = ResponseReader::BODY;
+			}
+			if (r.status == 304 || r.status == 204)
+				r.remaining = 0;
+		} else if (r.state == ResponseReader::BODY || r.state == ResponseReader::CHUNK_DATA) {
+			size_t take = std::min(r.remaining, conn.in.size());
+			conn.in.erase(0, take);
+			r.remaining -= take;
+			if (r.remaining > 0)
+				return false;
+			if (r.state == ResponseReader::BODY)
+				return true;
+			r.state = ResponseReader::CHUNK_CRLF;
+		} else if (r.state == ResponseReader::CHUNK_CRLF) {
+			if (conn.in.size() < 2)
+				return false;
+			conn.in.erase(0, 2);
+			r.state = ResponseReader::CHUNK_SIZE;
+		} else {
+			size_t end = conn.in.find("\r\n");
+			if (end == std::string::npos)
+				return false;
+			std::string line = conn.in.substr(0, end);
+			conn.in.erase(0, end + 2);
+			if (r.state == ResponseReader::TRAILER) {
+				if (line.empty())
+					return true;
+				continue;
+			}
+			r.remaining = std::strtoul(line.c_str(), NULL, 16);
+			r.state = r.remaining == 0 ? ResponseReader::TRAILER : ResponseReader::CHUNK_DATA;
+		}
+	}
+}
+
+class LoadGenerator {
+private:
+	Options _opt;
+	struct sockaddr_in _addr;
+	std::vector<Connection> _conns;
+	std::vector<long long> _latencies; // microseconds
+	unsigned long long _requests;
+	unsigned long long _errors;
+	unsigned long long _non_2xx;
+	unsigned long long _connects;
+	unsigned long long _bytes;
+	unsigned int _seed;
+
+	bool _connect(Connection& conn) {
+		conn.fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (conn.fd < 0)
+			return false;
+		int on = 1;
+		setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		if (connect(conn.fd, reinterpret_cast<struct sockaddr*>(&_addr), sizeof(_addr)) != 0) {
+			close(conn.fd);
+			conn.fd = -1;
+			return false;
+		}
+		fcntl(conn.fd, F_SETFL, fcntl(conn.fd, F_GETFL) | O_NONBLOCK);
+		conn.in.clear();
+		conn.reader.reset();
+		_connects++;
+		return true;
+	}
+
+	void _disconnect(Connection& conn) {
+		if (conn.fd >= 0)
+			close(conn.fd);
+		conn.fd = -1;
+		conn.sent_at.clear();
+		conn.answered = 0;
+		conn.out.clear();
+		conn.out_offset = 0;
+	}
+
+	void _queueBatch(Connection& conn) {
+		conn.out.clear();
+		conn.out_offset = 0;
+		conn.sent_at.clear();
+		conn.answered = 0;
+		long long now = nowUs();
+		for (size_t i = 0; i < _opt.depth; ++i) {
+			_seed = _seed * 1103515245 + 12345;
+			bool cgi = _opt.cgi_ratio > 0 && ((_seed >> 8) % 10000) < _opt.cgi_ratio * 10000;
+			conn.out += "GET " + (cgi ? _opt.cgi_path : _opt.path) + " HTTP/1.1\r\nHost: " + _opt.host +
+			            "\r\nUser-Agent: webserv-loadgen\r\n";
+			if (!_opt.keepalive)
+				conn.out += "Connection: close\r\n";
+			conn.out += "\r\n";
+			conn.sent_at.push_back(now);
+			if (!_opt.keepalive)
+				break; // one request per connection
+		}
+	}
+
+	// False when the connection has to be replaced
+	bool _write(Connection& conn) {
+		while (conn.out_offset < conn.out.size()) {
+			ssize_t n = send(conn.fd, conn.out.data() + conn.out_offset, conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+			if (n < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			conn.out_offset += n;
+		}
+		return true;
+	}
+
+	bool _read(Connection& conn, bool recording) {
+		char buf[READ_CHUNK];
+		bool open = true;
+		while (true) {
+			ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+			if (n <= 0) {
+				// The responses read along with the close still count
+				open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+				break;
+			}
+			conn.in.append(buf, n);
+			_bytes += n;
+		}
+		while (conn.answered < conn.sent_at.size() && readResponse(conn)) {
+			if (recording) {
+				_latencies.push_back(nowUs() - conn.sent_at[conn.answered]);
+				_requests++;
+				if (conn.reader.status < 200 || conn.reader.status > 299)
+					_non_2xx++;
+			}
+			conn.answered++;
+			bool close_after = conn.reader.close_after;
+			conn.reader.reset();
+			if (close_after) {
+				// Anything else in flight is lost with the connection
+				_disconnect(conn);
+				return true;
+			}
+		}
+		if (!open)
+			return false;
+		if (conn.answered == conn.sent_at.size()) {
+			_queueBatch(conn);
+			return _write(conn);
+		}
+		return true;
+	}
+
+public:
+	explicit LoadGenerator(const Options& opt) : _opt(opt), _conns(opt.connections), _requests(0),
+		_errors(0), _non_2xx(0), _connects(0), _bytes(0), _seed(42) {
+		std::memset(&_addr, 0, sizeof(_addr));
+		_addr.sin_family = AF_INET;
+		_addr.sin_port = htons(opt.port);
+		inet_pton(AF_INET, opt.host.c_str(), &_addr.sin_addr);
+	}
+
+	// Warm-up second, then the measured run
+	void run() {
+		long long start = nowUs();
+		long long warm_until = start + 1000000;
+		long long end = warm_until + static_cast<long long>(_opt.duration * 1e6);
+		std::vector<struct pollfd> fds(_conns.size());
+
+		while (nowUs() < end) {
+			bool recording = nowUs() >= warm_until;
+			for (size_t i = 0; i < _conns.size(); ++i) {
+				Connection& conn = _conns[i];
+				if (conn.fd < 0) {
+					if (!_connect(conn)) {
+						_errors++;
+						continue;
+					}
+					_queueBatch(conn);
+					if (!_write(conn)) {
+						_errors++;
+						_disconnect(conn);
+					}
+				}
+				fds[i].fd = conn.fd;
+				fds[i].events = POLLIN | (conn.out_offset < conn.out.size() ? POLLOUT : 0);
+				fds[i].revents = 0;
+			}
+			int ready = poll(&fds[0], fds.size(), 100);
+			if (ready <= 0)
+				continue;
+			for (size_t i = 0; i < _conns.size(); ++i) {
+				Connection& conn = _conns[i];
+				if (conn.fd < 0 || fds[i].fd != conn.fd || !fds[i].revents)
+					continue;
+				bool ok = true;
+				if (fds[i].revents & POLLOUT)
+					ok = _write(conn);
+				if (ok && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+					ok = _read(conn, recording);
+				if (!ok) {
+					// A close after the batch was answered is a normal end
+					if (conn.answered < conn.sent_at.size())
+						_errors++;
+					_disconnect(conn);
+				}
+			}
+		}
+		for (size_t i = 0; i < _conns.size(); ++i)
+			_disconnect(_conns[i]);
+	}
+
+	void report() const {
+		std::vector<long long> sorted(_latencies);
+		std::sort(sorted.begin(), sorted.end());
+		printf("{\n  \"suite\": \"macro\",\n  \"name\": \"%s\",\n  \"timestamp\": %ld,\n",
+		       _opt.name.c_str(), static_cast<long>(time(NULL)));
+		printf("  \"config\": {\"connections\": %lu, \"depth\": %lu, \"duration\": %.1f, \"path\": \"%s\", "
+		       "\"cgi_ratio\": %.3f, \"keepalive\": %s},\n",
+		       static_cast<unsigned long>(_opt.connections), static_cast<unsigned long>(_opt.depth),
+		       _opt.duration, _opt.path.c_str(), _opt.cgi_ratio, _opt.keepalive ? "true" : "false");
+		printf("  \"requests\": %llu,\n  \"requests_per_sec\": %.1f,\n  \"errors\": %llu,\n"
+		       "  \"non_2xx\": %llu,\n  \"connects\": %llu,\n  \"mb_per_sec\": %.2f,\n",
+		       _requests, _requests / _opt.duration, _errors, _non_2xx, _connects,
+		       _bytes / _opt.duration / 1e6);
+		printf("  \"latency_us\": {\"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld},\n",
+		       _percentile(sorted, 0.5), _percentile(sorted, 0.99), _percentile(sorted, 0.999),
+		       sorted.empty() ? 0LL : sorted.back());
+		long rss = 0, hwm = 0;
+		_serverMemory(rss, hwm);
+		printf("  \"server_rss_kb\": %ld,\n  \"server_peak_rss_kb\": %ld\n}\n", rss, hwm);
+	}
+
+private:
+	static long long _percentile(const std::vector<long long>& sorted, double q) {
+		if (sorted.empty())
+			return 0;
+		return sorted[static_cast<size_t>(q * (sorted.size() - 1) + 0.5)];
+	}
+
+	void _serverMemory(long& rss, long& hwm) const {
+		if (_opt.server_pid <= 0)
+			return;
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%ld/status", _opt.server_pid);
+		std::ifstream status(path);
+		std::string line;
+		while (std::getline(status, line)) {
+			if (line.compare(0, 6, "VmRSS:") == 0)
+				rss = std::atol(line.c_str() + 6);
+			else if (line.compare(0, 6, "VmHWM:") == 0)
+				hwm = std::atol(line.c_str() + 6);
+		}
+	}
+};
+
+int main(int argc, char** argv) {
+	Options opt;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : "";
+		if (arg == "--close") {
+			opt.keepalive = false;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s: missing value\n", arg.c_str());
+			return 2;
+		}
+		++i;
+		if (arg == "--host")
+			opt.host = value;
+		else if (arg == "--port")
+			opt.port = std::atoi(value);
+		else if (arg == "--connections")
+			opt.connections = std::strtoul(value, NULL, 10);
+		else if (arg == "--depth")
+			opt.depth = std::strtoul(value, NULL, 10);
+		else if (arg == "--duration")
+			opt.duration = std::atof(value);
+		else if (arg == "--path")
+			opt.path = value;
+		else if (arg == "--cgi-path")
+			opt.cgi_path = value;
+		else if (arg == "--cgi-ratio")
+			opt.cgi_ratio = std::atof(value);
+		else if (arg == "--server-pid")
+			opt.server_pid = std::atol(value);
+		else if (arg == "--name")
+			opt.name = value;
+		else {
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return 2;
+		}
+	}
+	if (opt.connections == 0 || opt.depth == 0 || opt.duration <= 0) {
+		fprintf(stderr, "connections, depth and duration must be positive\n");
+		return 2;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	LoadGenerator generator(opt);
+	generator.run();
+	generator.report();
+	return 0;
+}
@@ -0,0 +1,391 @@
+// Microbenchmarks of the request path: parsing, response serialization,
+// location matching and multipart decoding. Results go to stdout as JSON.
+//
+//   bench/micro [--quick] [--only name]
+
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include "Config.hpp"
+#include "MimeTypes.hpp"
+#include "MultipartParser.hpp"
+#include "Scanner.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define SAMPLE_OPS_TARGET_NS 20000 // a sample times enough ops to span ~20us
+
+static double g_min_seconds = 1.0; // per benchmark, after warm-up
+static volatile size_t g_sink;     // keeps results alive past the optimizer
+
+static long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+struct Result {
+	std::string name;
+	unsigned long long ops;
+	double seconds;
+	double bytes_per_op; // 0 when throughput in bytes means nothing
+	std::vector<double> samples; // ns per op, one per sample
+};
+
+class Benchmark {
+public:
+	virtual ~Benchmark() {}
+	virtual const char* name() const = 0;
+	virtual size_t bytesPerOp() const { return 0; }
+	virtual void run() = 0; // one operation
+};
+
+static Result measure(Benchmark& bench) {
+	Result result;
+	result.name = bench.name();
+	result.ops = 0;
+	result.bytes_per_op = static_cast<double>(bench.bytesPerOp());
+
+	// Calibrate the batch so a sample is long enough for the clock
+	size_t batch = 1;
+	while (true) {
+		long long start = nowNs();
+		for (size_t i = 0; i < batch; ++i)
+			bench.run();
+		long long spent = nowNs() - start;
+		if (spent >= SAMPLE_OPS_TARGET_NS || batch >= (1u << 20))
+			break;
+		batch *= 2;
+	}
+
+	long long begin = nowNs();
+	long long deadline = begin + static_cast<long long>(g_min_seconds * 1e9);
+	long long now = begin;
+	while (now < deadline) {
+		long long start = now;
+		for (size_t i = 0; i < batch; ++i)
+			bench.run();
+		now = nowNs();
+		result.samples.push_back(static_cast<double>(now - start) / batch);
+		result.ops += batch;
+	}
+	result.seconds = (now - begin) / 1e9;
+	return result;
+}
+
+static double quantile(std::vector<double> sorted, double q) {
+	if (sorted.empty())
+		return 0;
+	size_t index = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static long maxRssKb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+//
+/* HttpRequest::parse */
+//
+
+class ParseBenchmark : public Benchmark {
+private:
+	const char* _name;
+	std::string _wire;
+	size_t _requests; // requests in _wire
+	HttpRequest _request;
+
+public:
+	ParseBenchmark(const char* name, const std::string& wire, size_t requests)
+		: _name(name), _wire(wire), _requests(requests) {}
+
+	const char* name() const { return _name; }
+	size_t bytesPerOp() const { return _wire.size(); }
+
+	void run() {
+		_request.reset();
+		_request.parse(_wire.data(), _wire.size());
+		size_t done = 0;
+		while (_request.isComplete()) {
+			++done;
+			_request.resetKeepingPipelined();
+			if (!_request.hasBufferedData())
+				break;
+			_request.parse("", 0);
+		}
+		g_sink += done;
+	}
+};
+
+static std::string smallGet() {
+	return "GET /index.html HTTP/1.1\r\n"
+	       "Host: localhost:8080\r\n"
+	       "User-Agent: bench/1.0\r\n"
+	       "Accept: */*\r\n"
+	       "\r\n";
+}
+
+static std::string manyHeaderGet(size_t headers) {
+	std::ostringstream out;
+	out << "GET /static/app.js?v=1234 HTTP/1.1\r\n"
+	    << "Host: bench.example.com\r\n"
+	    << "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+	    << "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	    << "Accept-Encoding: gzip, deflate, br\r\n"
+	    << "Accept-Language: en-US,en;q=0.5\r\n"
+	    << "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=en\r\n";
+	for (size_t i = 6; i < headers; ++i)
+		out << "X-Custom-Header-" << i << ": value-" << i << "-abcdefghijklmnopqrstuvwxyz\r\n";
+	out << "\r\n";
+	return out.str();
+}
+
+//
+/* HttpResponse::build */
+//
+
+class ResponseBenchmark : public Benchmark {
+private:
+	std::string _body;
+
+public:
+	ResponseBenchmark() : _body(4096, 'x') {}
+
+	const char* name() const { return "response_build_4k"; }
+
+	void run() {
+		HttpResponse response = HttpResponse::ok(_body, "text/html");
+		response.setHeader("Cache-Control", "no-cache");
+		g_sink += response.build().size();
+	}
+};
+
+class ErrorResponseBenchmark : public Benchmark {
+public:
+	const char* name() const { return "response_build_404"; }
+
+	void run() {
+		HttpResponse response = HttpResponse::notFound();
+		g_sink += response.build().size();
+	}
+};
+
+//
+/* Config::findLocation */
+//
+
+class LocationBenchmark : public Benchmark {
+private:
+	std::string _name;
+	Config* _config;
+	std::vector<std::string> _uris;
+	size_t _next;
+
+public:
+	explicit LocationBenchmark(size_t locations) : _config(NULL), _next(0) {
+		std::ostringstream name;
+		name << "find_location_" << locations;
+		_name = name.str();
+
+		// Config only reads files: write one with N nested locations
+		char path[] = "/tmp/webserv-bench-XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0)
+			return;
+		close(fd);
+		std::ofstream out(path);
+		out << "server {\n    listen 8080;\n    root www;\n";
+		for (size_t i = 0; i < locations; ++i) {
+			out << "    location /section" << i % 32 << "/page" << i << " {\n"
+			    << "        root www;\n        allowed_methods GET;\n    }\n";
+			if (i % 7 == 0) {
+				std::ostringstream uri;
+				uri << "/section" << i % 32 << "/page" << i << "/some/deep/file.html";
+				_uris.push_back(uri.str());
+			}
+		}
+		out << "    location / {\n        root www;\n    }\n}\n";
+		out.close();
+		_uris.push_back("/unmatched/path/goes/to/root.html");
+
+		_config = new Config(path);
+		if (!_config->parse()) {
+			delete _config;
+			_config = NULL;
+		}
+		unlink(path);
+	}
+	~LocationBenchmark() { delete _config; }
+
+	const char* name() const { return _name.c_str(); }
+	bool valid() const { return _config != NULL; }
+
+	void run() {
+		const std::string& uri = _uris[_next++ % _uris.size()];
+		g_sink += reinterpret_cast<size_t>(_config->findLocation(uri, _config->getServerConfig(0)));
+	}
+};
+
+//
+/* MimeTypes::lookup */
+//
+
+class MimeBenchmark : public Benchmark {
+private:
+	std::vector<std::string> _paths;
+	size_t _next;
+
+public:
+	MimeBenchmark() : _next(0) {
+		const char* paths[] = { "/index.html", "/css/Style.CSS", "/js/app.min.js", "/img/logo.png",
+		                        "/fonts/inter.woff2", "/downloads/archive.tar.gz", "/README", "/data.unknown" };
+		_paths.assign(paths, paths + sizeof(paths) / sizeof(paths[0]));
+	}
+
+	const char* name() const { return "mime_lookup"; }
+
+	void run() { g_sink += MimeTypes::lookup(_paths[_next++ % _paths.size()]).size(); }
+};
+
+//
+/* Multipart decoding */
+//
+
+class MultipartBenchmark : public Benchmark {
+private:
+	std::string _boundary;
+	std::string _body;
+	size_t _chunk; // bytes per write(), like socket reads
+
+public:
+	MultipartBenchmark(size_t body_size, size_t chunk) : _boundary("----WebservBench7MA4YWxkTrZu0gW"), _chunk(chunk) {
+		// One large form field (no filename: decoded and dropped, so no disk
+		// I/O is measured) holding bytes that look like boundary starts
+		std::string head = "--" + _boundary + "\r\nContent-Disposition: form-data; name=\"blob\"\r\n\r\n";
+		std::string tail = "\r\n--" + _boundary + "--\r\n";
+		_body.reserve(body_size + head.size() + tail.size());
+		_body += head;
+		unsigned int seed = 12345;
+		while (_body.size() < head.size() + body_size) {
+			seed = seed * 1103515245 + 12345;
+			char c = static_cast<char>(seed >> 16);
+			if ((seed & 0x3ff) == 0)
+				_body += "\r\n--";
+			else
+				_body += c;
+		}
+		_body += tail;
+	}
+
+	const char* name() const { return "multipart_64m"; }
+	size_t bytesPerOp() const { return _body.size(); }
+
+	void run() {
+		MultipartParser parser("/tmp", _boundary);
+		for (size_t offset = 0; offset < _body.size(); offset += _chunk) {
+			size_t len = std::min(_chunk, _body.size() - offset);
+			if (!parser.write(_body.data() + offset, len))
+				break;
+		}
+		g_sink += parser.finish();
+	}
+};
+
+//
+/* Scanner */
+//
+
+class CrlfBenchmark : public Benchmark {
+private:
+	std::string _data;
+
+public:
+	CrlfBenchmark() : _data(1 << 20, 'a') {
+		_data[_data.size() - 2] = '\r';
+		_data[_data.size() - 1] = '\n';
+	}
+
+	const char* name() const { return "find_crlf_1m"; }
+	size_t bytesPerOp() const { return _data.size(); }
+
+	void run() { g_sink += Scanner::findCrlf(_data.data(), _data.size()); }
+};
+
+//
+/* Driver */
+//
+
+static void printResult(const Result& r, bool last) {
+	std::vector<double> sorted(r.samples);
+	std::sort(sorted.begin(), sorted.end());
+	double ops_per_sec = r.seconds > 0 ? r.ops / r.seconds : 0;
+	printf("    {\"name\": \"%s\", \"ops\": %llu, \"seconds\": %.3f, \"ops_per_sec\": %.1f, "
+	       "\"ns_per_op\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f}",
+	       r.name.c_str(), r.ops, r.seconds, ops_per_sec,
+	       quantile(sorted, 0.5), quantile(sorted, 0.99), quantile(sorted, 0.999));
+	if (r.bytes_per_op > 0)
+		printf(", \"mb_per_sec\": %.1f", ops_per_sec * r.bytes_per_op / 1e6);
+	printf("}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+	std::string only;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--quick") == 0)
+			g_min_seconds = 0.2;
+		else if (std::strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+			only = argv[++i];
+	}
+
+	std::string pipelined;
+	for (int i = 0; i < 16; ++i)
+		pipelined += smallGet();
+
+	std::vector<Benchmark*> benches;
+	benches.push_back(new ParseBenchmark("parse_small_get", smallGet(), 1));
+	benches.push_back(new ParseBenchmark("parse_40_headers", manyHeaderGet(40), 1));
+	benches.push_back(new ParseBenchmark("parse_pipelined_16", pipelined, 16));
+	benches.push_back(new ResponseBenchmark());
+	benches.push_back(new ErrorResponseBenchmark());
+	size_t location_counts[] = { 8, 64, 512 };
+	for (size_t i = 0; i < sizeof(location_counts) / sizeof(location_counts[0]); ++i) {
+		LocationBenchmark* bench = new LocationBenchmark(location_counts[i]);
+		if (bench->valid())
+			benches.push_back(bench);
+		else
+			delete bench;
+	}
+	benches.push_back(new MimeBenchmark());
+	benches.push_back(new MultipartBenchmark(64 << 20, 65536));
+	benches.push_back(new CrlfBenchmark());
+
+	std::vector<Result> results;
+	for (size_t i = 0; i < benches.size(); ++i) {
+		if (only.empty() || only == benches[i]->name()) {
+			fprintf(stderr, "%-24s", benches[i]->name());
+			results.push_back(measure(*benches[i]));
+			fprintf(stderr, " %12.1f ops/s\n", results.back().ops / results.back().seconds);
+		}
+		delete benches[i];
+	}
+
+	printf("{\n  \"suite\": \"micro\",\n  \"timestamp\": %ld,\n  \"scanner\": \"%s\",\n  \"max_rss_kb\": %ld,\n",
+	       static_cast<long>(time(NULL)), Scanner::backend(), maxRssKb());
+	printf("  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); ++i)
+		printResult(results[i], i + 1 == results.size());
+	printf("  ]\n}\n");
+	return g_sink == 0xdeadbeef ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Macro benchmarks: starts ./webserv on bench/bench.conf and drives it with
+# bench/loadgen, one JSON file per scenario in bench/results/.
+#
+#   bench/run.sh [duration-seconds]    (BENCH_DURATION also works, default 10)
+
+set -e
+cd "$(dirname "$0")/.."
+
+DURATION=${1:-${BENCH_DURATION:-10}}
+PORT=18080
+RESULTS=bench/results
+mkdir -p "$RESULTS"
+
+./webserv bench/bench.conf > "$RESULTS/server.log" 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null || true' EXIT INT TERM
+
+# Wait for the listener
+tries=0
+until python3 -c "import socket; socket.create_connection(('127.0.0.1', $PORT), 1)" 2>/dev/null; do
+    tries=$((tries + 1))
+    if [ $tries -gt 50 ] || ! kill -0 $SERVER 2>/dev/null; then
+        echo "webserv did not start, see $RESULTS/server.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+scenario() {
+    name=$1
+    shift
+    echo "  $name"
+    bench/loadgen --port $PORT --duration "$DURATION" --server-pid $SERVER --name "$name" "$@" \
+        > "$RESULTS/$name.json"
+}
+
+scenario keepalive_index   --connections 64  --depth 1  --path /index.html
+scenario keepalive_asset   --connections 64  --depth 1  --path /asset.css
+scenario pipelined_16      --connections 16  --depth 16 --path /index.html
+scenario many_connections  --connections 512 --depth 1  --path /index.html
+scenario connection_close  --connections 32  --close    --path /index.html
+scenario cgi_mix_10        --connections 32  --depth 1  --path /index.html \
+                           --cgi-path /cgi-bin/bench.py --cgi-ratio 0.1
+
+echo "Results in $RESULTS/"
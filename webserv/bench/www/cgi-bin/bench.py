@@ -0,0 +1,5 @@
+#!/usr/bin/env python3
+# Minimal CGI response for the load generator's CGI mix
+import sys
+body = "ok\n"
+sys.stdout.write("Content-Type: text/plain\r\nContent-Length: %d\r\n\r\n%s" % (len(body), body))
@@ -12,7 +12,7 @@ fi
 # Compile source files
 echo "Compiling source files..."
 
-SOURCES="srcs/HttpRequest.cpp srcs/HttpResponse.cpp srcs/StaticFileHandler.cpp srcs/UploadHandler.cpp tests/test_http.cpp"
+SOURCES="srcs/HttpRequest.cpp srcs/Arena.cpp srcs/HttpResponse.cpp srcs/HttpDate.cpp srcs/ErrorPages.cpp srcs/SharedFile.cpp srcs/SharedBuffer.cpp srcs/OutputQueue.cpp srcs/ChunkedEncoder.cpp srcs/StaticFileHandler.cpp srcs/StaticFileCache.cpp srcs/MimeTypes.cpp srcs/Scanner.cpp srcs/MultipartParser.cpp srcs/FileSink.cpp srcs/UploadHandler.cpp tests/test_http.cpp"
 CXXFLAGS="-Wall -Wextra -Werror -std=c++98 -Iincludes"
 
 # Create objs directory
@@ -22,7 +22,7 @@ mkdir -p objs
 rm -f test_http objs/*.o
 
 # Compile
-g++ $CXXFLAGS -o test_http $SOURCES
+g++ $CXXFLAGS -o test_http $SOURCES -lz
 
 if [ $? -eq 0 ]; then
     echo ""
@@ -0,0 +1,45 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <vector>
+
+#define ARENA_INLINE_SIZE 1024 // served from the object itself, no heap at all
+#define ARENA_BLOCK_SIZE 8192  // heap blocks after that (bigger requests get their own)
+
+// Bump allocator for request-scoped data. Nothing is freed individually:
+// reset() drops everything at once and keeps the first heap block, so a
+// connection that has warmed up allocates nothing for later requests.
+class Arena {
+private:
+	union {
+		char bytes[ARENA_INLINE_SIZE];
+		double align_double;
+		void* align_pointer;
+		long align_long;
+	} _inline;
+	std::vector<char*> _blocks;
+	std::vector<size_t> _sizes;
+	size_t _used;   // heap blocks handed out since the last reset()
+	char* _cursor;
+	size_t _left;
+
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	void _grow(size_t size);
+
+public:
+	Arena();
+	~Arena();
+
+	// Pointer-aligned, valid until reset()
+	void* allocate(size_t size);
+	char* copy(const char* data, size_t len);
+	void reset();
+
+	// Heap bytes currently owned
+	size_t heapBytes() const;
+};
+
+#endif // ARENA_HPP
@@ -0,0 +1,19 @@
+#ifndef BODYSINK_HPP
+#define BODYSINK_HPP
+
+#include <cstddef>
+
+// Destination for decoded request body bytes, fed while the body arrives.
+// Without a sink the request keeps the body in memory (HttpRequest::getBody).
+class BodySink {
+public:
+    virtual ~BodySink() {}
+
+    // Returns false to abort the request with errorCode()
+    virtual bool write(const char* data, size_t len) = 0;
+    // Called once, after the last body byte has been written
+    virtual bool finish() { return true; }
+    virtual int errorCode() const { return 500; }
+};
+
+#endif
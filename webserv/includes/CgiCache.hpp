@@ -0,0 +1,102 @@
+#ifndef CGICACHE_HPP
+#define CGICACHE_HPP
+
+#include "SharedBuffer.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <utility>
+#include <ctime>
+
+#define CGI_CACHE_DEFAULT_SIZE 8388608       // 8MB
+#define CGI_CACHE_DEFAULT_MAX_ENTRY 1048576  // 1MB
+
+class HttpResponse;
+
+// A stored script response. Pass entries remember that the last response
+// for the key could not be stored (no-store, Set-Cookie, too large...):
+// until they expire, requests go straight to the script, uncoalesced.
+struct CgiCacheEntry {
+	std::string key;
+	int status;
+	std::vector<std::pair<std::string, std::string> > headers; // end-to-end only
+	SharedBuffer body;
+	time_t stored;
+	time_t expires;
+	bool pass;
+	size_t size; // bytes charged against the cache
+	std::list<CgiCacheEntry*>::iterator lru;
+};
+
+// Response being produced by the one script run for a key; clients that
+// miss on the same key meanwhile wait in `waiters` for it
+struct CgiCacheFill {
+	std::string key;
+	time_t default_ttl; // cgi_cache_valid, when the script sets no freshness
+	int status;
+	std::vector<std::pair<std::string, std::string> > headers;
+	std::string body;
+	time_t ttl;         // 0 once the response turned out not storable
+	bool has_headers;
+	std::vector<int> waiters; // client fds
+};
+
+// Micro-cache of CGI / FastCGI GET responses (cgi_cache_valid), bounded
+// LRU by bytes, with one script run per key at a time (request coalescing).
+// Freshness: s-maxage / max-age, then Expires, then the location's TTL;
+// no-store, no-cache, private, Set-Cookie and Vary responses are not kept,
+// and requests with Authorization or Cookie bypass the cache.
+class CgiCache {
+private:
+	std::map<std::string, CgiCacheEntry*> _entries;
+	std::list<CgiCacheEntry*> _lru; // front = most recently used
+	std::map<std::string, CgiCacheFill*> _fills;
+	size_t _max_bytes;
+	size_t _max_entry;
+	size_t _bytes;
+
+	void _evict(CgiCacheEntry* entry);
+	void _store(CgiCacheEntry* entry);
+	void _storePass(const std::string& key, time_t ttl, time_t now);
+
+	CgiCache(const CgiCache&);
+	CgiCache& operator=(const CgiCache&);
+
+public:
+	CgiCache(size_t max_bytes = CGI_CACHE_DEFAULT_SIZE, size_t max_entry = CGI_CACHE_DEFAULT_MAX_ENTRY);
+	~CgiCache();
+
+	// New limits (reload): stored entries are dropped, fills in progress
+	// carry on
+	void configure(size_t max_bytes, size_t max_entry);
+
+	// Server block, URI and query; HEAD requests are answered from GET entries
+	static std::string makeKey(size_t server, const std::string& uri, const std::string& query);
+
+	// Fresh entry (possibly a pass marker), NULL on a miss
+	const CgiCacheEntry* lookup(const std::string& key, time_t now);
+	// Response built from a stored entry, with its Age
+	static HttpResponse respond(const CgiCacheEntry& entry, time_t now);
+
+	CgiCacheFill* findFill(const std::string& key);
+	CgiCacheFill* startFill(const std::string& key, time_t default_ttl);
+	// Script headers are in: decides whether the response will be kept
+	void fillHeaders(CgiCacheFill* fill, const HttpResponse& response, time_t now);
+	// False once the response is known not to be stored (stop feeding it)
+	bool fillBody(CgiCacheFill* fill, const char* data, size_t len);
+	// Whole response seen (or the script failed): stores it, or a pass
+	// entry when it cannot be. Either way the fill leaves the cache and is
+	// the caller's to free once its waiters are resumed.
+	void finishFill(CgiCacheFill* fill, time_t now);
+	// Producer gone before the end: nothing is stored, waiters retry
+	void abortFill(CgiCacheFill* fill);
+
+	// Seconds the response may be reused, 0 = not storable
+	static time_t freshness(const HttpResponse& response, time_t default_ttl, time_t now);
+
+	size_t count() const { return _entries.size(); }
+	size_t bytes() const { return _bytes; }
+};
+
+#endif // CGICACHE_HPP
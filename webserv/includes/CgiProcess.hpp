@@ -0,0 +1,56 @@
+#ifndef CGIPROCESS_HPP
+#define CGIPROCESS_HPP
+
+#include "CgiStream.hpp"
+#include "SharedBuffer.hpp"
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// One CGI child per request. The server registers its pipes in the event
+// loop and calls the I/O steps below when they are ready, so a slow script
+// never blocks other connections.
+class CgiProcess : public CgiStream {
+private:
+	pid_t _pid;
+	int _stdin_fd;  // -1 once the whole request body is written
+	int _stdout_fd; // -1 after EOF
+	SharedBuffer _input;
+	size_t _input_offset;
+	bool _exited;
+	int _status;
+
+	CgiProcess(const CgiProcess&);
+	CgiProcess& operator=(const CgiProcess&);
+
+public:
+	CgiProcess(int client_fd, time_t deadline);
+	~CgiProcess(); // closes the pipes, the child must be reaped separately
+
+	// Forks and execs `interpreter script_path` in the script's directory
+	bool start(const std::string& script_path, const std::string& interpreter,
+	           const std::vector<std::string>& env, const SharedBuffer& body);
+
+	// Writes as much of the body as the pipe accepts; false on a hard error
+	bool writeInput();
+	bool inputDone() const;
+	// read() on stdout: >0 bytes, 0 on EOF, -1 with errno (EAGAIN: try later)
+	ssize_t readOutput(char* buf, size_t len);
+
+	void closeInput();
+	void closeOutput();
+	// SIGKILL, the pipes are closed by the caller
+	void kill();
+	int outputFd() const { return _stdout_fd; }
+	void setExited(int status) { _exited = true; _status = status; }
+
+	pid_t pid() const { return _pid; }
+	int stdinFd() const { return _stdin_fd; }
+	int stdoutFd() const { return _stdout_fd; }
+	bool exited() const { return _exited; }
+	int status() const { return _status; }
+	// Nothing left to do but free it
+	bool finished() const { return _exited && _stdin_fd == -1 && _stdout_fd == -1 && _client_fd == -1; }
+};
+
+#endif // CGIPROCESS_HPP
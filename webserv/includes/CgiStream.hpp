@@ -0,0 +1,51 @@
+#ifndef CGISTREAM_HPP
+#define CGISTREAM_HPP
+
+#include <string>
+#include <ctime>
+
+class HttpResponse;
+
+// Response side shared by CGI children and FastCGI requests: the script's
+// output is parsed up to the end of its header block, the rest is streamed
+// to the client as it arrives.
+class CgiStream {
+protected:
+	int _client_fd; // -1 once the client is gone
+	std::string _header_buf; // output until the CGI header block is complete
+	bool _headers_done;
+	time_t _deadline;
+	// Response framing, decided once the CGI headers are in
+	bool _chunked;
+	bool _head_only;
+	bool _keep_alive;
+
+public:
+	CgiStream(int client_fd, time_t deadline);
+	virtual ~CgiStream() {}
+
+	// Feeds output until the header block ends: 1 complete (response filled,
+	// body bytes after the headers in `body`), 0 need more, -1 malformed
+	virtual int parseHeaders(const char* data, size_t len, HttpResponse& response, std::string& body);
+
+	// Client gone or deadline hit: stop producing output
+	virtual void kill() = 0;
+	// fd whose readability feeds this stream (paused while the client lags)
+	virtual int outputFd() const = 0;
+
+	void detach() { _client_fd = -1; }
+	void setFraming(bool chunked, bool head_only, bool keep_alive) {
+		_chunked = chunked;
+		_head_only = head_only;
+		_keep_alive = keep_alive;
+	}
+
+	int clientFd() const { return _client_fd; }
+	time_t deadline() const { return _deadline; }
+	bool headersDone() const { return _headers_done; }
+	bool chunked() const { return _chunked; }
+	bool headOnly() const { return _head_only; }
+	bool keepAlive() const { return _keep_alive; }
+};
+
+#endif // CGISTREAM_HPP
@@ -0,0 +1,25 @@
+#ifndef CHUNKEDENCODER_HPP
+#define CHUNKEDENCODER_HPP
+
+#include "OutputQueue.hpp"
+#include <string>
+
+// Transfer-Encoding: chunked framing for bodies whose length is not known
+// when the headers go out. Data buffers are queued as-is, only the framing
+// is allocated.
+class ChunkedEncoder {
+public:
+    // "<hex size>\r\n"
+    static std::string chunkHeader(size_t length);
+
+    static void appendChunk(OutputQueue& queue, const SharedBuffer& data);
+    static void appendChunk(OutputQueue& queue, const OutputSegment& segment);
+    static void appendChunk(OutputQueue& queue, const char* data, size_t length);
+    // Zero-size chunk and the empty trailer section
+    static void appendLastChunk(OutputQueue& queue);
+
+    // Whole chunk as one string (tests, callers that build responses inline)
+    static std::string encode(const char* data, size_t length);
+};
+
+#endif
@@ -2,30 +2,140 @@
 #define CLIENT_HPP
 
 #include "HttpRequest.hpp"
+#include "OutputQueue.hpp"
+#include "CgiStream.hpp"
+#include "TimerWheel.hpp"
+#include "RequestTrace.hpp"
 #include <string>
 #include <ctime>
 
+#define READ_WINDOW_MIN 8192         // bytes asked of recv() per call at rest...
+#define READ_WINDOW_MAX (256 * 1024) // ...growing up to this while a body streams in
+
+struct ServerConfig;
+class Config;
+struct CgiCacheFill;
+
+// Request side of the connection state machine; output progress is tracked
+// by the connection's output queue.
+enum ConnectionState {
+	CONN_IDLE,    // between requests (keep-alive), nothing buffered
+	CONN_READING, // part of a request has arrived
+	CONN_CLOSING  // final response queued: stop reading, close once flushed
+};
+
 class Client {
 private:
 	int _fd;
 	HttpRequest _request;
-	time_t _last_activity;
+	OutputQueue _output; // responses waiting for the socket
+	TimerNode _timer; // deadline of the current phase (header, body, send, idle)
+	ConnectionState _state;
+	size_t _requests_served;
+	BodySink* _body_sink; // owned, lives for the current request
+	CgiStream* _cgi;      // script producing the current response (owned by the server)
+	CgiCacheFill* _cache_fill; // micro-cache entry that script's response is filling
+	CgiCacheFill* _cache_wait; // another client's script run this request waits for
+	size_t _listener;             // listening socket it came in on
+	const ServerConfig* _server;  // virtual host of the current request
+	const Config* _config;        // configuration _server belongs to, kept alive across reloads
+	size_t _read_window;  // recv() size, adapts to the transfer
+	bool _read_pending;   // read budget ran out with data left in the socket
+	bool _output_blocked; // too much unsent output: not reading until it drains
+	// Access log bookkeeping for the current request
+	unsigned int _peer_addr; // IPv4, network order
+	long long _request_start; // microseconds, 0 until the first byte arrives
+	long long _request_parsed; // microseconds, 0 until the request is complete
+	long long _flush_start;   // oldest response still being written, 0 = none
+	int _response_status;
+	size_t _response_bytes;
+	RequestTrace _trace;          // phases of the current request
+	RequestTrace _flushing_trace; // last queued response until it is written (slow log)
+	std::string _flushing_request; // its request line and status
+
+	Client(const Client&);
+	Client& operator=(const Client&);
 
 public:
 	Client();
-	Client(int fd);
 	~Client();
 
+	// Pooled lifecycle: bound to an accepted socket, then recycled for the
+	// next one with its buffers (and their capacity) kept
+	void attach(int fd);
+	void recycle();
+
 	// Getters
 	int getFd() const;
 	HttpRequest& getRequest();
 	const HttpRequest& getRequest() const;
-	time_t getLastActivity() const;
+	OutputQueue& getOutput() { return _output; }
+	const OutputQueue& getOutput() const { return _output; }
+	ConnectionState getState() const { return _state; }
+	size_t getRequestsServed() const { return _requests_served; }
+
+	TimerNode& timer() { return _timer; }
+	void setState(ConnectionState state) { _state = state; }
+
+	// Takes ownership; the request streams its body into it
+	void setBodySink(BodySink* sink);
+	BodySink* getBodySink() const { return _body_sink; }
+
+	// While set, later pipelined requests wait for the script's response
+	void setCgi(CgiStream* cgi) { _cgi = cgi; }
+	CgiStream* getCgi() const { return _cgi; }
+	void setCacheFill(CgiCacheFill* fill) { _cache_fill = fill; }
+	CgiCacheFill* getCacheFill() const { return _cache_fill; }
+	void setCacheWait(CgiCacheFill* fill) { _cache_wait = fill; }
+	CgiCacheFill* getCacheWait() const { return _cache_wait; }
+	// The current response is still to come: from a script, or from the
+	// cache once another client's script run ends
+	bool responsePending() const { return _cgi != NULL || _cache_wait != NULL; }
+
+	void setListener(size_t listener) { _listener = listener; }
+	size_t getListener() const { return _listener; }
+	void setServer(const ServerConfig* server) { _server = server; }
+	const ServerConfig* getServer() const { return _server; }
+	void setConfig(const Config* config) { _config = config; }
+	const Config* getConfig() const { return _config; }
+
+	// Doubles while reads fill the window during a body, back to the
+	// minimum once the connection goes quiet
+	size_t getReadWindow() const { return _read_window; }
+	void growReadWindow();
+	void shrinkReadWindow() { _read_window = READ_WINDOW_MIN; }
+	void setReadPending(bool pending) { _read_pending = pending; }
+	bool isReadPending() const { return _read_pending; }
+	void setOutputBlocked(bool blocked) { _output_blocked = blocked; }
+	bool isOutputBlocked() const { return _output_blocked; }
+
+	void setPeerAddr(unsigned int addr) { _peer_addr = addr; }
+	unsigned int getPeerAddr() const { return _peer_addr; }
+	void setRequestStart(long long us) {
+		_request_start = us;
+		_trace.mark(TRACE_START, us);
+	}
+	long long getRequestStart() const { return _request_start; }
+	void setRequestParsed(long long us) {
+		_request_parsed = us;
+		_trace.mark(TRACE_PARSED, us);
+	}
+	long long getRequestParsed() const { return _request_parsed; }
+	void setFlushStart(long long us) { _flush_start = us; }
+	long long getFlushStart() const { return _flush_start; }
+	void setResponseStatus(int status) { _response_status = status; }
+	int getResponseStatus() const { return _response_status; }
+	void addResponseBytes(size_t bytes) { _response_bytes += bytes; }
+	size_t getResponseBytes() const { return _response_bytes; }
 
-	// Activity tracking
-	void updateActivity();
+	RequestTrace& trace() { return _trace; }
+	// Handed the current trace when its response is queued; pending while
+	// it has a start time
+	RequestTrace& flushingTrace() { return _flushing_trace; }
+	std::string& flushingRequest() { return _flushing_request; }
 
-	// Request management
+	// Request management: starts the next request, keeping any pipelined
+	// bytes that arrived after the one just served
 	void resetRequest();
 };
 
@@ -0,0 +1,40 @@
+#ifndef CLIENTPOOL_HPP
+#define CLIENTPOOL_HPP
+
+#include <vector>
+#include <cstddef>
+
+class Client;
+
+// Every Client is allocated up front (max_connections); accepting and
+// closing connections only moves slots between the free list and the
+// fd table, so connection churn does no heap traffic.
+class ClientPool {
+private:
+	std::vector<Client*> _slots;
+	std::vector<Client*> _free;
+	std::vector<Client*> _by_fd; // fd -> active client, NULL otherwise
+	size_t _active;
+
+	ClientPool(const ClientPool&);
+	ClientPool& operator=(const ClientPool&);
+
+public:
+	explicit ClientPool(size_t capacity);
+	~ClientPool();
+
+	// NULL when every slot is in use
+	Client* acquire(int fd);
+	void release(Client* client);
+
+	Client* find(int fd) const {
+		return fd >= 0 && static_cast<size_t>(fd) < _by_fd.size() ? _by_fd[fd] : NULL;
+	}
+	bool full() const { return _free.empty(); }
+	size_t active() const { return _active; }
+	size_t capacity() const { return _slots.size(); }
+	// Slot i, active or not (check getFd() != -1)
+	Client* slot(size_t i) const { return _slots[i]; }
+};
+
+#endif // CLIENTPOOL_HPP
@@ -4,6 +4,22 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <ctime>
+#include "LocationTrie.hpp"
+
+#define MAX_BODY_SIZE_LIMIT (static_cast<size_t>(64) << 30) // 64GB: client_max_body_size ceiling
+
+// Script handlers by file extension, compiled from fastcgi_pass and cgi
+enum HandlerKind {
+	HANDLER_FASTCGI,
+	HANDLER_CGI
+};
+
+struct ExtensionHandler {
+	std::string extension; // ".php"
+	HandlerKind kind;
+	std::string target;    // backend address or interpreter
+};
 
 struct LocationConfig {
 	std::string path;
@@ -14,19 +30,104 @@ struct LocationConfig {
 	std::string redirect;
 	std::string upload_path;
 	std::map<std::string, std::string> cgi_extensions; // .php -> /usr/bin/php-cgi
+	std::map<std::string, std::string> fastcgi_pass;   // .php -> unix:/run/php-fpm.sock, host:port or spawn:/path/app
+	size_t fastcgi_connections;                        // pooled connections (or spawned workers) per backend
+	std::string stub_status;                           // "" (off), "text" or "prometheus": serve the metrics here
+	bool gzip_static;       // prefer precompressed file.br / file.gz siblings
+	bool gzip;              // compress cacheable text files on the fly (once, kept in the cache)
+	size_t gzip_min_length; // smaller files are sent as is
+	int gzip_comp_level;    // 1 (fast) .. 9 (small)
+	time_t cgi_cache_valid; // seconds script GET responses are reused when they set no freshness, 0 = off
+	// Reverse proxy: every request of the location goes to these upstream servers
+	std::vector<std::string> proxy_pass; // host:port, balanced between
+	std::string proxy_uri;      // replaces the location prefix ("" = the URI is passed as is)
+	bool proxy_least_conn;      // fewest requests in flight first, else round-robin
+	size_t proxy_keepalive;     // idle connections kept per upstream server
+	size_t proxy_max_fails;     // failures within proxy_fail_timeout taking a server out (0 = never)
+	time_t proxy_fail_timeout;  // seconds, also how long it stays out
+	time_t proxy_timeout;       // whole exchange with the upstream
+
+	// Compiled once the server block is parsed
+	unsigned int method_mask;               // bit (1 << HttpMethod) per allowed method
+	std::vector<ExtensionHandler> handlers; // FastCGI entries first: they take precedence
+
+	LocationConfig() : autoindex(false), fastcgi_connections(4), gzip_static(false), gzip(false),
+		gzip_min_length(1024), gzip_comp_level(6), cgi_cache_valid(0), proxy_least_conn(false),
+		proxy_keepalive(16), proxy_max_fails(1), proxy_fail_timeout(10), proxy_timeout(60), method_mask(0) {}
+
+	bool allowsMethod(int method) const { return (method_mask >> method) & 1; }
+	// Handler for the extension of the URI's last segment, NULL if none
+	const ExtensionHandler* findHandler(const std::string& uri) const;
+};
+
+#define LISTEN_BACKLOG 511 // default accept queue length
+
+// Socket options of a listen directive
+struct ListenOptions {
+	int backlog;
+	bool tcp_nodelay;
+	int defer_accept; // seconds a connection may wait for its first bytes before accept (0 = off)
+	int rcvbuf;       // socket buffer sizes, 0 = system default
+	int sndbuf;
+	int fastopen;     // TCP Fast Open queue length, 0 = off
 
-	LocationConfig() : autoindex(false) {}
+	ListenOptions() : backlog(LISTEN_BACKLOG), tcp_nodelay(true), defer_accept(0),
+		rcvbuf(0), sndbuf(0), fastopen(0) {}
 };
 
 struct ServerConfig {
+	size_t index; // position in the configuration file
 	int port;
 	std::string host;
-	std::string server_name;
+	std::string server_name;               // the first name
+	std::vector<std::string> server_names; // every name, lowercase, matched against Host
+	bool default_server;                   // `listen ... default_server`: answers unknown hosts
+	ListenOptions listen_options;
+	bool has_listen_options;               // set on its listen directive (else the defaults)
 	size_t max_body_size;
+	size_t static_cache_size;     // total bytes of small files kept in memory (0 = off)
+	size_t static_cache_max_file; // larger files are always streamed with sendfile()
+	size_t cgi_cache_size;        // total bytes of cached script responses (cgi_cache_valid)
+	size_t cgi_cache_max_entry;   // larger responses are not kept
+	time_t keepalive_timeout;     // idle seconds allowed between requests
+	size_t keepalive_requests;    // requests served per connection before closing
+	size_t max_connections;       // preallocated client slots; connections beyond them get a 503
+	size_t limit_conn_per_ip;     // open connections per client address (0 = unlimited)
+	double limit_req_rate;        // requests per second per client address (0 = unlimited)...
+	size_t limit_req_burst;       // ...with up to this many sent ahead of the rate
+	size_t worker_processes;      // event loops sharing the port via SO_REUSEPORT (0 = one per CPU)
+	// Deadlines in seconds, each restarted whenever the connection makes progress
+	time_t client_header_timeout; // request line and headers
+	time_t client_body_timeout;   // between two reads of the body
+	time_t send_timeout;          // between two writes of the response
+	time_t cgi_timeout;           // whole run of a CGI script or FastCGI request
+	// Logging: `off`, `stdout`, `stderr` or a file
+	std::string access_log;
+	std::string access_log_format; // combined | json
+	size_t access_log_sample;      // log 1 in N successful requests (errors always)
+	std::string error_log;
+	std::string error_log_level;   // error | warn | info | debug
+	// Tracing: per-phase timings in a Server-Timing header (per server), and
+	// requests slower than the threshold written to the error log (process-wide)
+	bool server_timing;
+	long slow_request_threshold;   // milliseconds, 0 = off
 	std::map<int, std::string> error_pages;
+	// types { type ext...; }: extension -> Content-Type on top of the
+	// built-in table, process-wide (every block's entries, later ones win)
+	std::vector<std::pair<std::string, std::string> > types;
 	std::vector<LocationConfig> locations;
+	LocationTrie routes; // location paths -> index into locations
 
-	ServerConfig() : port(8080), host("0.0.0.0"), max_body_size(1048576) {} // 1MB default
+	ServerConfig() : index(0), port(8080), host("0.0.0.0"), default_server(false), has_listen_options(false),
+		max_body_size(1048576), // 1MB default
+		static_cache_size(16777216), static_cache_max_file(1048576),
+		cgi_cache_size(8388608), cgi_cache_max_entry(1048576),
+		keepalive_timeout(15), keepalive_requests(100), max_connections(1024),
+		limit_conn_per_ip(0), limit_req_rate(0), limit_req_burst(0),
+		worker_processes(1),
+		client_header_timeout(60), client_body_timeout(60), send_timeout(60), cgi_timeout(10),
+		access_log("off"), access_log_format("combined"), access_log_sample(1),
+		error_log("stderr"), error_log_level("info"), server_timing(false), slow_request_threshold(0) {}
 };
 
 class Config {
@@ -39,8 +140,9 @@ public:
 	Config(const std::string& config_file);
 	~Config();
 
-	// Parsing
-	bool parse();
+	// Parsing; without `fallback` a file that fails to parse is an error
+	// instead of the built-in default configuration (reloads)
+	bool parse(bool fallback = true);
 
 	// Getters
 	const std::vector<ServerConfig>& getServers() const;
@@ -53,9 +155,19 @@ private:
 	void _parseServerBlock(const std::string& block, ServerConfig& config);
 	void _parseLocationBlock(const std::string& block, LocationConfig& location);
 	void _parseConfigFile(const std::string& path);
+	void _compile(ServerConfig& config);
+	// Body of the `{ }` block opened on `line`, which is looked for from
+	// `search_pos`; moves search_pos past the block
+	bool _nestedBlock(const std::string& block, const std::string& line, size_t& search_pos,
+	                  std::string& body) const;
 	size_t _findClosingBrace(const std::string& str, size_t start) const;
 	std::string _trim(const std::string& str) const;
 	std::vector<std::string> _split(const std::string& str, char delimiter) const;
+	// "64k", "1m" or a plain number; 0 when malformed
+	static int _parseSize(const std::string& value);
+	// Byte count with an optional k/m/g suffix; throws when malformed or
+	// above `limit`
+	static size_t _parseByteCount(const std::string& directive, const std::string& value, size_t limit);
 };
 
 #endif // CONFIG_HPP
@@ -0,0 +1,42 @@
+#ifndef ERRORPAGES_HPP
+#define ERRORPAGES_HPP
+
+#include "SharedBuffer.hpp"
+#include <string>
+#include <map>
+#include <vector>
+
+#define ERROR_PAGES_DIR "www/errors" // bundled <code>.html pages
+
+struct ErrorPage {
+	SharedBuffer header_block; // Content-Type, Content-Length + blank line
+	SharedBuffer body;
+};
+
+// Error bodies rendered once and shared by every error response, so a
+// stream of 404s neither reads files nor builds strings. Pages come from
+// error_page directives, then the bundled ERROR_PAGES_DIR, then a
+// generated one-liner. Each server block has its own set of error_page
+// overrides; the selected set applies to the responses being built.
+class ErrorPages {
+private:
+	static std::map<int, ErrorPage> _pages;
+	static std::vector<std::map<int, ErrorPage> > _overrides; // by server index
+	static size_t _selected;
+
+	static ErrorPage _render(const std::string& html);
+	static ErrorPage _builtin(int code);
+	static void _loadBundled();
+
+public:
+	// Back to the bundled pages for every standard error status, no overrides
+	static void reset();
+	// Serves `html` for `code` in server `set` (an error_page file)
+	static void set(size_t set, int code, const std::string& html);
+	// Overrides used by get() from now on
+	static void select(size_t set) { _selected = set; }
+	// Pre-rendered page; codes without one are rendered on first use
+	static const ErrorPage& get(int code);
+};
+
+#endif // ERRORPAGES_HPP
@@ -0,0 +1,118 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include <vector>
+#include <cstddef>
+#include <sys/poll.h>
+
+#if defined(__linux__)
+# include <sys/epoll.h>
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+# define WEBSERV_HAVE_KQUEUE
+# include <sys/types.h>
+# include <sys/event.h>
+#endif
+
+// Interest / readiness flags shared by every backend
+enum EventFlags {
+	EVENT_READ  = 0x01,
+	EVENT_WRITE = 0x02,
+	EVENT_ERROR = 0x04, // error or hang-up (reported only, never registered)
+	EVENT_EDGE  = 0x08  // edge-triggered registration (EPOLLET / EV_CLEAR)
+};
+
+struct IoEvent {
+	int fd;
+	unsigned int events;
+};
+
+// Readiness notification interface. Interest is tracked per fd so updates are
+// O(1) and callers can toggle write interest without knowing the backend.
+class EventLoop {
+protected:
+	std::vector<unsigned int> _interest; // fd -> registered flags (0 = not registered)
+
+	void _setInterest(int fd, unsigned int events);
+	void _clearInterest(int fd);
+
+public:
+	virtual ~EventLoop() {}
+
+	virtual bool add(int fd, unsigned int events) = 0;
+	virtual bool modify(int fd, unsigned int events) = 0;
+	virtual void remove(int fd) = 0;
+	// Fills `events` with ready fds, returns the count (-1 on error, errno set)
+	virtual int wait(std::vector<IoEvent>& events, int timeout_ms) = 0;
+	virtual const char* name() const = 0;
+
+	unsigned int interest(int fd) const;
+	bool isRegistered(int fd) const;
+	void setWriteInterest(int fd, bool enabled);
+	void setReadInterest(int fd, bool enabled);
+
+	// Best backend for this platform: epoll on Linux, kqueue on BSD/macOS,
+	// poll everywhere else (or when built with -DWEBSERV_EVENT_POLL)
+	static EventLoop* create();
+};
+
+class PollEventLoop : public EventLoop {
+private:
+	std::vector<struct pollfd> _fds;
+	std::vector<int> _index; // fd -> position in _fds (-1 = absent)
+
+	static short _toPoll(unsigned int events);
+
+public:
+	PollEventLoop();
+
+	bool add(int fd, unsigned int events);
+	bool modify(int fd, unsigned int events);
+	void remove(int fd);
+	int wait(std::vector<IoEvent>& events, int timeout_ms);
+	const char* name() const { return "poll"; }
+};
+
+#if defined(__linux__)
+class EpollEventLoop : public EventLoop {
+private:
+	int _epfd;
+	std::vector<struct epoll_event> _buffer;
+
+	static unsigned int _toEpoll(unsigned int events);
+
+public:
+	EpollEventLoop();
+	~EpollEventLoop();
+
+	bool isOpen() const { return _epfd != -1; }
+	bool add(int fd, unsigned int events);
+	bool modify(int fd, unsigned int events);
+	void remove(int fd);
+	int wait(std::vector<IoEvent>& events, int timeout_ms);
+	const char* name() const { return "epoll"; }
+};
+#endif
+
+#if defined(WEBSERV_HAVE_KQUEUE)
+class KqueueEventLoop : public EventLoop {
+private:
+	int _kq;
+	std::vector<struct kevent> _buffer;
+
+	bool _apply(int fd, unsigned int old_events, unsigned int new_events);
+
+public:
+	KqueueEventLoop();
+	~KqueueEventLoop();
+
+	bool isOpen() const { return _kq != -1; }
+	bool add(int fd, unsigned int events);
+	bool modify(int fd, unsigned int events);
+	void remove(int fd);
+	int wait(std::vector<IoEvent>& events, int timeout_ms);
+	const char* name() const { return "kqueue"; }
+};
+#endif
+
+#endif // EVENTLOOP_HPP
@@ -0,0 +1,161 @@
+#ifndef FASTCGI_HPP
+#define FASTCGI_HPP
+
+#include "CgiStream.hpp"
+#include "EventLoop.hpp"
+#include "OutputQueue.hpp"
+#include "SharedBuffer.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define FCGI_MAX_MULTIPLEX 16 // requests per connection when the backend multiplexes
+#define FCGI_RESPAWN_DELAY 1  // seconds between respawns of crashed workers
+
+// FastCGI 1.0 record types
+enum FcgiRecordType {
+	FCGI_BEGIN_REQUEST     = 1,
+	FCGI_ABORT_REQUEST     = 2,
+	FCGI_END_REQUEST       = 3,
+	FCGI_PARAMS            = 4,
+	FCGI_STDIN             = 5,
+	FCGI_STDOUT            = 6,
+	FCGI_STDERR            = 7,
+	FCGI_GET_VALUES        = 9,
+	FCGI_GET_VALUES_RESULT = 10
+};
+
+struct FastCgiBackend;
+struct FastCgiConnection;
+
+// One request handed to a FastCGI application. Its records go out on a
+// pooled connection; STDOUT comes back as events from the pool.
+class FastCgiRequest : public CgiStream {
+	friend class FastCgiPool;
+
+private:
+	FastCgiBackend* _backend;
+	FastCgiConnection* _conn; // NULL while waiting for a free connection
+	unsigned short _id;
+	SharedBuffer _params; // encoded name-value pairs
+	SharedBuffer _body;
+	bool _got_output; // only a request without output may be retried
+	bool _retried;
+	bool _ended;
+
+	FastCgiRequest(const FastCgiRequest&);
+	FastCgiRequest& operator=(const FastCgiRequest&);
+
+public:
+	FastCgiRequest(FastCgiBackend* backend, int client_fd, time_t deadline,
+	               const std::vector<std::string>& env, const SharedBuffer& body);
+
+	// The pool aborts the request when it is released
+	void kill() {}
+	int outputFd() const;
+	const std::string& address() const;
+};
+
+enum FastCgiEventType {
+	FCGI_EVENT_OUTPUT, // STDOUT bytes for the request
+	FCGI_EVENT_END,    // END_REQUEST received
+	FCGI_EVENT_ERROR   // connection lost before the request ended
+};
+
+struct FastCgiEvent {
+	FastCgiRequest* request;
+	FastCgiEventType type;
+	SharedBuffer data;
+};
+
+// A socket to a backend and the requests in flight on it (id -> request,
+// NULL for aborted ids still waiting for their END_REQUEST)
+struct FastCgiConnection {
+	int fd;
+	FastCgiBackend* backend;
+	bool connected;
+	OutputQueue output;
+	std::string input; // bytes of an incomplete record
+	std::map<unsigned short, FastCgiRequest*> requests;
+	unsigned short next_id;
+	size_t served; // completed requests, a reused connection may have been closed idle
+
+	FastCgiConnection() : fd(-1), backend(NULL), connected(false), next_id(1), served(0) {}
+};
+
+// An application reached over a unix or TCP socket, or spawned by the
+// server as a set of workers accepting on a shared listen socket
+struct FastCgiBackend {
+	std::string address; // as configured
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	size_t max_connections;
+	std::vector<FastCgiConnection*> connections;
+	std::deque<FastCgiRequest*> waiting;
+	bool probed;      // GET_VALUES sent
+	bool multiplexed; // FCGI_MPXS_CONNS reported by the application
+	size_t max_requests;
+	// Spawned workers
+	std::string program;
+	std::string socket_path;
+	int listen_fd;
+	std::vector<pid_t> workers;
+	time_t next_spawn;
+
+	FastCgiBackend() : addr_len(0), max_connections(1), probed(false), multiplexed(false),
+		max_requests(0), listen_fd(-1), next_spawn(0) {}
+};
+
+// Persistent connections to every configured backend, driven by the
+// server's event loop
+class FastCgiPool {
+private:
+	EventLoop* _loop;
+	std::map<std::string, FastCgiBackend*> _backends; // address -> backend
+	std::map<int, FastCgiConnection*> _connections;   // socket fd -> connection
+	std::vector<FastCgiRequest*> _released; // freed once the current events are handled
+	std::vector<FastCgiEvent> _deferred;    // produced outside handleEvent()
+
+	FastCgiPool(const FastCgiPool&);
+	FastCgiPool& operator=(const FastCgiPool&);
+
+	bool _spawnWorkers(FastCgiBackend* backend);
+	FastCgiConnection* _connect(FastCgiBackend* backend);
+	size_t _capacity(const FastCgiBackend* backend) const;
+	void _assign(FastCgiBackend* backend, std::vector<FastCgiEvent>& events);
+	void _begin(FastCgiConnection* conn, FastCgiRequest* request);
+	void _queueRecord(FastCgiConnection* conn, int type, unsigned short id,
+	                  const SharedBuffer& content, size_t offset, size_t length);
+	bool _readRecords(FastCgiConnection* conn, std::vector<FastCgiEvent>& events);
+	void _handleRecord(FastCgiConnection* conn, int type, unsigned short id,
+	                   const char* content, size_t length, std::vector<FastCgiEvent>& events);
+	void _closeConnection(FastCgiConnection* conn, std::vector<FastCgiEvent>& events);
+	void _purge();
+
+public:
+	FastCgiPool(EventLoop* loop);
+	~FastCgiPool(); // stops spawned workers
+
+	// Registers `unix:/path`, `host:port` or `spawn:/path/to/app`
+	bool addBackend(const std::string& address, size_t connections);
+	// NULL when the backend is unknown or cannot be reached at all
+	FastCgiRequest* submit(const std::string& address, int client_fd, time_t deadline,
+	                       const std::vector<std::string>& env, const SharedBuffer& body);
+	// Stops a request, ended or not; it is freed later
+	void release(FastCgiRequest* request);
+
+	bool owns(int fd) const { return _connections.find(fd) != _connections.end(); }
+	void handleEvent(int fd, unsigned int events, std::vector<FastCgiEvent>& out);
+	// Events raised while releasing a request (e.g. a backend gone for good)
+	void takeEvents(std::vector<FastCgiEvent>& out);
+	// A spawned worker exited: true if it was one of ours
+	bool workerExited(pid_t pid);
+	// Respawns workers and collects requests past their deadline
+	void tick(time_t now, std::vector<FastCgiRequest*>& expired);
+};
+
+#endif // FASTCGI_HPP
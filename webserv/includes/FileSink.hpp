@@ -0,0 +1,55 @@
+#ifndef FILESINK_HPP
+#define FILESINK_HPP
+
+#include "BodySink.hpp"
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#define FILE_SINK_CHUNK 262144 // write() size, file offsets stay multiples of it
+#define FILE_SINK_MAX_RESERVE 67108864 // 64MB: most disk one declared length pins up front
+
+// Raw request body (PUT, non-multipart POST) streamed to a temp file in the
+// target's directory and moved into place by finish(), so readers see the
+// old file or the whole new one, never a partial upload. Small reads are
+// gathered into FILE_SINK_CHUNK writes; whole chunks go straight from the
+// receive buffer to the file.
+class FileSink : public BodySink {
+private:
+    std::string target;
+    std::string temp_path;
+    bool replace;          // rename() over the target, else link() and fail if it exists
+    bool existed;          // the target was there when the body started
+    int fd;
+    std::vector<char> buffer;
+    size_t buffered;
+    off_t written;
+    off_t reserved;        // bytes preallocated from Content-Length
+    int error_code;
+
+    bool flush(const char* data, size_t len);
+    bool fail(int code);
+
+    FileSink(const FileSink&);
+    FileSink& operator=(const FileSink&);
+
+public:
+    FileSink(const std::string& target_path, bool replace_existing);
+    ~FileSink(); // unlinks an unfinished temp file
+
+    // Creates the temp file; `expected` (0 = unknown), already checked
+    // against the body size limit, is reserved on disk up front, at most
+    // FILE_SINK_MAX_RESERVE of it. False with errorCode() when the target
+    // cannot be written.
+    bool open(size_t expected);
+
+    bool write(const char* data, size_t len);
+    bool finish();
+    int errorCode() const { return error_code; }
+
+    const std::string& path() const { return target; }
+    bool replaced() const { return existed; }
+    off_t size() const { return written; }
+};
+
+#endif
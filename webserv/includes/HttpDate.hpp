@@ -0,0 +1,19 @@
+#ifndef HTTPDATE_HPP
+#define HTTPDATE_HPP
+
+#include <string>
+#include <ctime>
+
+// RFC 7231 IMF-fixdate helpers ("Sun, 06 Nov 1994 08:49:37 GMT")
+class HttpDate {
+public:
+	static std::string format(time_t t);
+	// Value for the Date header, formatted at most once per second: the
+	// event loop calls tick() as time passes
+	static const std::string& now();
+	static void tick(time_t t);
+	// Accepts IMF-fixdate, plus the obsolete RFC 850 and asctime forms
+	static bool parse(const std::string& value, time_t& out);
+};
+
+#endif // HTTPDATE_HPP
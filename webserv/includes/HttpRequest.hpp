@@ -1,8 +1,9 @@
 #ifndef HTTPREQUEST_HPP
 #define HTTPREQUEST_HPP
 
+#include "BodySink.hpp"
+#include "Arena.hpp"
 #include <string>
-#include <map>
 #include <vector>
 
 enum HttpMethod {
@@ -22,26 +23,93 @@ enum ParseState {
     ERROR
 };
 
+// Position inside a chunked body (RFC 7230 4.1)
+enum ChunkState {
+    CHUNK_SIZE,      // chunk-size [; ext] CRLF
+    CHUNK_DATA,
+    CHUNK_DATA_CRLF, // CRLF closing the chunk data
+    CHUNK_TRAILER    // trailer fields up to the empty line
+};
+
+// Byte range of a field inside the receive buffer
+struct Slice {
+    size_t offset;
+    size_t length;
+
+    Slice() : offset(0), length(0) {}
+    Slice(size_t off, size_t len) : offset(off), length(len) {}
+};
+
+// Headers the server acts on, classified into fixed fields while parsing
+enum KnownHeader {
+    HDR_HOST,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_CONNECTION,
+    HDR_RANGE,
+    HDR_IF_NONE_MATCH,
+    HDR_COUNT
+};
+
+struct HeaderField {
+    Slice name;
+    Slice value;
+};
+
+#define INLINE_HEADER_FIELDS 16 // other headers kept without allocating
+
 class HttpRequest {
 private:
     HttpMethod method;
-    std::string uri;
+    std::string uri;           // capacity is reused across keep-alive requests
     std::string query_string;
     std::string http_version;
-    std::map<std::string, std::string> headers;
+    // Header values point into raw_data, which keeps the header block
+    // until reset(); an empty slice means the header is absent
+    Slice known_headers[HDR_COUNT];
+    HeaderField fields[INLINE_HEADER_FIELDS];
+    HeaderField* extra_fields; // beyond the inline ones, in the arena
+    size_t extra_capacity;
+    size_t field_count;
+    Arena arena; // request-scoped storage, rewound by reset()
+    size_t header_end; // offset of the first body byte in raw_data
     std::string body;
     ParseState state;
     std::string raw_data;
     size_t bytes_parsed;
+    size_t scan_pos; // where the search for the next CRLF resumes
     size_t content_length;
     std::string boundary; // For multipart/form-data
     int error_code;
+    
+    // Body decoding: bytes are handed to the sink (or `body`) as they arrive
+    bool chunked;
+    ChunkState chunk_state;
+    size_t chunk_remaining;
+    size_t body_received;  // decoded body bytes so far
+    size_t max_body_size;  // 0 = unlimited, survives reset()
+    BodySink* body_sink;   // not owned, NULL keeps the body in memory
+    bool pause_after_headers; // survives reset()
+    bool body_started;
 
-    void parseRequestLine(const std::string& line);
-    void parseHeader(const std::string& line);
-    HttpMethod stringToMethod(const std::string& method_str);
-    void parseQueryString();
+    void parseRequestLine(size_t start, size_t end);
+    void parseHeader(size_t start, size_t end);
+    const HeaderField& field(size_t index) const;
+    bool findHeader(const char* name, Slice& value) const;
     bool isChunked() const;
+    void clearFields();
+    size_t findLineEnd();
+    void addField(const HeaderField& f);
+
+    HttpRequest(const HttpRequest&);
+    HttpRequest& operator=(const HttpRequest&);
+    void finishHeaders();
+    void parseIdentityBody();
+    void parseChunkedBody();
+    bool deliverBody(const char* data, size_t len);
+    void finishBody();
+    void fail(int code);
 
 public:
     HttpRequest();
@@ -49,26 +117,57 @@ public:
     // Main parsing method - returns true if request is complete
     bool parse(const char* data, size_t len);
     
+    // Decoded body bytes beyond this limit fail the request with 413
+    void setMaxBodySize(size_t size) { max_body_size = size; }
+    // Stream the body into `sink` instead of getBody(); valid until reset()
+    void setBodySink(BodySink* sink) { body_sink = sink; }
+    // Stop before the first body byte so the caller can pick a sink from the
+    // headers; awaitingBody() is then true until startBody() resumes parsing
+    void setPauseAfterHeaders(bool pause) { pause_after_headers = pause; }
+    bool awaitingBody() const { return state == BODY && !body_started; }
+    bool startBody();
+    
     // Getters
     HttpMethod getMethod() const { return method; }
     std::string getMethodString() const;
+    static HttpMethod methodFromToken(const char* token, size_t len); // UNKNOWN if unsupported
     const std::string& getUri() const { return uri; }
     const std::string& getQueryString() const { return query_string; }
     const std::string& getHttpVersion() const { return http_version; }
-    const std::map<std::string, std::string>& getHeaders() const { return headers; }
-    std::string getHeader(const std::string& key) const;
+    // Case-insensitive lookup, "" when absent (the last of repeated headers wins)
+    std::string getHeader(const char* key) const;
+    bool hasHeader(const char* key) const;
+    // Same lookup without a copy: points into the request buffer, NULL when absent
+    const char* headerData(const char* key, size_t& length) const;
+    // Comma-separated list element match, case-insensitive ("Connection: close")
+    bool headerHasToken(const char* key, const char* token) const;
+    // Fields other than the known headers, in arrival order (into the request buffer)
+    size_t getFieldCount() const { return field_count; }
+    const char* fieldName(size_t index, size_t& length) const;
+    const char* fieldValue(size_t index, size_t& length) const;
     const std::string& getBody() const { return body; }
     ParseState getState() const { return state; }
     int getErrorCode() const { return error_code; }
+    // Declared length (0 when chunked) until complete, then the decoded size
     size_t getContentLength() const { return content_length; }
+    size_t getBodyReceived() const { return body_received; }
+    // Scratch memory that lives exactly as long as the current request
+    Arena& getArena() { return arena; }
     const std::string& getBoundary() const { return boundary; }
     
     // Validation
     bool isValid() const { return state != ERROR; }
     bool isComplete() const { return state == COMPLETE; }
     
+    // Bytes received after the end of a complete request (pipelined requests)
+    std::string getPipelinedData() const;
+    bool hasBufferedData() const { return !raw_data.empty(); }
+    
     // Reset for reuse
     void reset();
+    // Same, but bytes of the next pipelined request stay buffered (call
+    // parse() with no data to process them)
+    void resetKeepingPipelined();
 };
 
 #endif
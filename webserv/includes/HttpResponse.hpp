@@ -1,19 +1,31 @@
 #ifndef HTTPRESPONSE_HPP
 #define HTTPRESPONSE_HPP
 
+#include "OutputQueue.hpp"
 #include <string>
-#include <map>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
 
 class HttpResponse {
 private:
+    typedef std::pair<std::string, std::string> Header;
+    
     int status_code;
-    std::string status_message;
-    std::map<std::string, std::string> headers;
-    std::string body;
+    std::vector<Header> headers; // sent in the order they were first set
+    SharedBuffer header_block; // pre-serialized entity headers ending in the blank line
+    SharedBuffer body;
+    std::vector<OutputSegment> body_segments; // streamed body: file ranges (sendfile) and framing
+    size_t segments_length;
+    bool chunked;      // Transfer-Encoding: chunked instead of Content-Length
+    bool body_dropped; // HEAD: headers only
     bool headers_sent;
     
-    std::string getStatusMessage(int code) const;
-    static std::string loadErrorPage(const std::string& error_code);
+    void clearBody();
+    void updateContentLength(size_t length);
+    void removeHeader(const std::string& key);
+    // Status line, Date and headers, without the blank line
+    void serializeHead(std::string& out) const;
     
 public:
     HttpResponse();
@@ -22,27 +34,63 @@ public:
     // Setters
     void setStatusCode(int code);
     void setHeader(const std::string& key, const std::string& value);
+    // Another field even when one by that name is set (Set-Cookie)
+    void addHeader(const std::string& key, const std::string& value);
+    bool hasHeader(const std::string& key) const;
     void setBody(const std::string& content);
+    void setBody(const SharedBuffer& content); // shares the buffer, no copy
     void setContentType(const std::string& mime_type);
+    void setFileBody(const SharedFile& file, off_t offset, size_t length);
+    void appendBodyFile(const SharedFile& file, off_t offset, size_t length);
+    void appendBodyBuffer(const SharedBuffer& buffer);
+    // HEAD: keep every header (Content-Length included) but send no body
+    void dropBody();
+    // Body plus its already-serialized entity headers (e.g. from the file cache)
+    void setPrebuilt(const SharedBuffer& header_block, const SharedBuffer& content);
+    // Frame the body with chunked transfer-coding (HTTP/1.1 peers only)
+    void setChunked();
     
     // Getters
     int getStatusCode() const { return status_code; }
-    const std::string& getBody() const { return body; }
+    const std::string& getBody() const { return body.str(); }
+    bool hasStreamedBody() const { return !body_segments.empty(); }
+    size_t getBodyLength() const { return body_segments.empty() ? body.size() : segments_length; }
+    bool isChunked() const { return chunked; }
+    // In the order they will be sent, as set (script headers keep their case)
+    const std::vector<std::pair<std::string, std::string> >& getHeaders() const { return headers; }
+    
+    // Status line and headers only, terminated by the empty line
+    std::string buildHeaders() const;
+    // Same, appended to `out` (e.g. a connection's reusable head buffer)
+    void appendHeaders(std::string& out) const;
     
-    // Build the complete HTTP response
+    // Build the complete HTTP response (file bodies are read inline)
     std::string build();
     
+    // Queue headers and body as segments, without concatenating them
+    void appendTo(OutputQueue& queue) const;
+    // Status line and headers only; a streaming producer queues the chunks
+    void appendHeadersTo(OutputQueue& queue) const;
+    
+    static std::string getStatusMessage(int code);
+    
     // Common response builders
     static HttpResponse ok(const std::string& content, const std::string& content_type = "text/html");
     static HttpResponse created(const std::string& location = "");
     static HttpResponse noContent();
     static HttpResponse redirect(const std::string& location, int code = 302);
-    static HttpResponse badRequest(const std::string& message = "Bad Request");
-    static HttpResponse notFound(const std::string& message = "Not Found");
-    static HttpResponse methodNotAllowed(const std::string& message = "Method Not Allowed");
-    static HttpResponse internalServerError(const std::string& message = "Internal Server Error");
-    static HttpResponse notImplemented(const std::string& message = "Not Implemented");
-    static HttpResponse payloadTooLarge(const std::string& message = "Payload Too Large");
+    // Errors carry the shared pre-rendered page for their status (ErrorPages)
+    static HttpResponse error(int code);
+    static HttpResponse badRequest();
+    static HttpResponse notFound();
+    static HttpResponse methodNotAllowed();
+    static HttpResponse internalServerError();
+    static HttpResponse notImplemented();
+    static HttpResponse payloadTooLarge();
+    static HttpResponse badGateway();
+    static HttpResponse gatewayTimeout();
+    // Overload: asks the client to come back in `retry_after` seconds
+    static HttpResponse serviceUnavailable(unsigned long retry_after);
 };
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef LOCATIONTRIE_HPP
+#define LOCATIONTRIE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Location prefixes compiled into a trie over path segments: `/upload`
+// matches `/upload` and `/upload/x`, never `/uploadfoo`. Matching is one
+// walk down the URI and allocates nothing. Nodes refer to each other by
+// index, so a copied trie (with its ServerConfig) stays valid.
+class LocationTrie {
+private:
+	struct Node {
+		std::string segment;
+		std::vector<size_t> children; // sorted by segment
+		int location;                 // index into ServerConfig::locations, -1 if none
+
+		Node() : location(-1) {}
+	};
+
+	std::vector<Node> _nodes; // _nodes[0] is "/"
+
+	int _findChild(size_t node, const char* segment, size_t length) const;
+
+public:
+	LocationTrie();
+
+	// The first location registered for a path wins
+	void insert(const std::string& path, int location);
+	void clear();
+	// Longest matching location, -1 if none
+	int match(const std::string& uri) const;
+};
+
+#endif // LOCATIONTRIE_HPP
@@ -0,0 +1,114 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <string>
+#include <sstream>
+#include <cstddef>
+#include <ctime>
+#include <pthread.h>
+
+// Severity, most severe first
+enum LogLevel {
+	LEVEL_ERROR,
+	LEVEL_WARN,
+	LEVEL_INFO,
+	LEVEL_DEBUG
+};
+
+// Messages above this level are compiled out (build with -DWEBSERV_LOG_LEVEL=3 for debug)
+#ifndef WEBSERV_LOG_LEVEL
+# define WEBSERV_LOG_LEVEL 2
+#endif
+
+#define WS_LOG(level, expr) \
+	do { \
+		if ((level) <= WEBSERV_LOG_LEVEL && Logger::enabled(level)) { \
+			std::ostringstream log_stream_; \
+			log_stream_ << expr; \
+			Logger::message(level, log_stream_.str()); \
+		} \
+	} while (0)
+
+#define WS_ERROR(expr) WS_LOG(LEVEL_ERROR, expr)
+#define WS_WARN(expr) WS_LOG(LEVEL_WARN, expr)
+#define WS_INFO(expr) WS_LOG(LEVEL_INFO, expr)
+#define WS_DEBUG(expr) WS_LOG(LEVEL_DEBUG, expr)
+
+#define LOG_RING_SIZE 1024 // records; a full ring drops (and counts) new ones
+#define LOG_TEXT_MAX 512   // request target or message, truncated
+#define LOG_FIELD_MAX 128  // Referer / User-Agent, truncated
+
+enum AccessLogFormat {
+	ACCESS_LOG_COMBINED,
+	ACCESS_LOG_JSON
+};
+
+// One completed request, filled on the event loop, formatted by the writer
+struct AccessRecord {
+	time_t time;
+	unsigned int addr; // IPv4, network order
+	int status;
+	size_t bytes;      // body bytes
+	long latency_us;   // first request byte to response queued
+	char method[8];
+	char version[9];
+	char target[LOG_TEXT_MAX]; // path and query
+	char referer[LOG_FIELD_MAX];
+	char agent[LOG_FIELD_MAX];
+};
+
+// Access and error log. Records go into a single-producer ring read by a
+// background thread that formats and writes them, so the event loop never
+// blocks on a slow stdout, pipe or disk. Only the event loop logs.
+class Logger {
+private:
+	struct Slot {
+		bool access; // else an error-log message
+		LogLevel level;
+		AccessRecord record; // target holds the message text
+	};
+
+	static Slot _ring[LOG_RING_SIZE];
+	static size_t _head; // next slot to fill (producer)
+	static size_t _tail; // next slot to drain (writer)
+	static size_t _dropped;
+	static bool _running;
+	static bool _stop;
+	static pthread_t _thread;
+	static int _access_fd; // -1 = access log off
+	static int _error_fd;
+	static AccessLogFormat _format;
+	static LogLevel _level;
+	static size_t _sample;
+	static size_t _sample_count;
+
+	static Slot* _reserve();
+	static void _commit();
+	static void* _writer(void*);
+	static void _drain(std::string& access, std::string& errors);
+	static void _formatAccess(const AccessRecord& record, std::string& out);
+	static void _formatMessage(const Slot& slot, std::string& out);
+	static int _openTarget(const std::string& target);
+
+public:
+	// `off`, `stdout`, `stderr` or a file path for each log; errors always
+	// have a destination (stderr when nothing else is configured)
+	static bool open(const std::string& access_log, AccessLogFormat format, size_t sample,
+	                 const std::string& error_log, LogLevel level);
+	// Writes what is still queued and stops the writer
+	static void close();
+
+	static bool enabled(LogLevel level) { return level <= _level; }
+	static void message(LogLevel level, const std::string& text);
+	static bool accessEnabled() { return _access_fd != -1; }
+	// Errors (status >= 400) are always logged, others 1 in `sample`
+	static void access(const AccessRecord& record);
+
+	static bool parseLevel(const std::string& name, LogLevel& level);
+	// Monotonic microseconds, for latencies (immune to clock steps)
+	static long long clockUs();
+	// Bounded copy into a record field
+	static void copyField(char* dest, size_t size, const char* src, size_t len);
+};
+
+#endif // LOGGER_HPP
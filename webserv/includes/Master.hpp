@@ -0,0 +1,48 @@
+#ifndef MASTER_HPP
+#define MASTER_HPP
+
+#include <string>
+#include <map>
+#include <ctime>
+#include <csignal>
+#include <sys/types.h>
+
+#define WORKER_STARTUP_GRACE 2 // seconds: a worker failing sooner is a startup error
+#define WORKER_STOP_TIMEOUT 10 // seconds between SIGTERM and SIGKILL on shutdown
+
+// Supervises worker processes, each running its own Server (event loop,
+// client pool, caches) on a SO_REUSEPORT listener so the kernel spreads
+// connections over them. Crashed workers are replaced; SIGINT/SIGTERM and
+// SIGQUIT are passed on to every worker, SIGHUP too once the file parses:
+// each worker reloads in place with its listening sockets open, and a
+// changed worker_processes starts workers or drains the surplus.
+class Master {
+private:
+	std::string _config_file;
+	size_t _count;
+	std::map<pid_t, time_t> _workers; // pid -> start time
+	std::map<pid_t, time_t> _draining; // surplus after a reload, finishing their connections
+
+	Master(const Master&);
+	Master& operator=(const Master&);
+
+	bool _spawn();
+	// Reaps exited workers; false when one failed right after starting
+	bool _reap(time_t now);
+	// SIGTERM, or SIGQUIT to let them finish their connections; SIGKILL
+	// for those still running after `timeout` seconds
+	void _stopWorkers(int signal = SIGTERM, time_t timeout = WORKER_STOP_TIMEOUT);
+	void _reload();
+
+public:
+	Master(const std::string& config_file, size_t workers);
+	~Master();
+
+	// Runs until shutdown is requested, returns the exit status
+	int run();
+
+	// Worker count for `worker_processes` (0 = one per online CPU)
+	static size_t resolveCount(size_t configured);
+};
+
+#endif // MASTER_HPP
@@ -0,0 +1,97 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <cstddef>
+#include <ctime>
+
+#define METRICS_SUB_BITS 3                       // 8 buckets per power of two
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BIT 35                       // ~9.5 hours, larger values share the last bucket
+#define METRICS_BUCKETS (METRICS_SUB_BUCKETS * (METRICS_MAX_BIT - METRICS_SUB_BITS + 2))
+
+// Log-linear latency histogram in microseconds (HDR-style): values below 8
+// are exact, above that every bucket is within 12.5% of the value
+class LatencyHistogram {
+private:
+	unsigned long long _counts[METRICS_BUCKETS];
+	unsigned long long _total;
+	unsigned long long _sum_us;
+	unsigned long long _max_us;
+
+public:
+	LatencyHistogram();
+
+	void record(long long us);
+	unsigned long long count() const { return _total; }
+	unsigned long long sum() const { return _sum_us; }
+	unsigned long long max() const { return _max_us; }
+	// Upper bound of the bucket holding the q-th fraction of the values
+	unsigned long long quantile(double q) const;
+	// Values below `limit_us`; exact when the limit is a power of two
+	unsigned long long countBelow(unsigned long long limit_us) const;
+
+	static size_t bucketOf(unsigned long long us);
+	static unsigned long long bucketLow(size_t index);
+};
+
+// Request phases: first byte to parsed, parsed to response queued,
+// queued to the last byte written
+enum MetricsPhase {
+	PHASE_PARSE,
+	PHASE_HANDLER,
+	PHASE_FLUSH,
+	PHASE_COUNT
+};
+
+enum MetricsCounter {
+	COUNTER_ACCEPTED,
+	COUNTER_HANDLED,       // accepted and given a client slot
+	COUNTER_REQUESTS,
+	COUNTER_PARSE_ERRORS,
+	COUNTER_RESPONSE_BYTES,
+	COUNTER_CGI_SPAWNED,
+	COUNTER_FASTCGI_REQUESTS,
+	COUNTER_PROXY_REQUESTS,  // handed to proxy_pass upstreams
+	COUNTER_CLIENT_TIMEOUTS,
+	COUNTER_CGI_TIMEOUTS,  // CGI, FastCGI and upstreams
+	COUNTER_REJECTED,      // connections and requests turned away with a 503
+	COUNTER_CGI_CACHE_HITS,      // script responses served from the micro-cache
+	COUNTER_CGI_CACHE_COALESCED, // requests that waited on another client's script run
+	COUNTER_COUNT
+};
+
+// Connection states sampled from the client pool when the status is rendered
+struct ConnectionGauge {
+	size_t active;
+	size_t reading;
+	size_t writing;
+	size_t waiting;
+
+	ConnectionGauge() : active(0), reading(0), writing(0), waiting(0) {}
+};
+
+// Counters and histograms of the event loop. Only the loop thread updates
+// them, so they are plain integers: no atomics on the request path.
+class Metrics {
+private:
+	static unsigned long long _counters[COUNTER_COUNT];
+	static unsigned long long _responses[6]; // by status class, [0] = anything out of range
+	static LatencyHistogram _phases[PHASE_COUNT];
+	static time_t _started;
+
+public:
+	static void reset(time_t now);
+
+	static void add(MetricsCounter counter, unsigned long long amount = 1) { _counters[counter] += amount; }
+	static void response(int status, size_t bytes);
+	static void latency(MetricsPhase phase, long long us) { _phases[phase].record(us); }
+	static unsigned long long counter(MetricsCounter counter) { return _counters[counter]; }
+	static const LatencyHistogram& histogram(MetricsPhase phase) { return _phases[phase]; }
+
+	// stub_status-style summary and Prometheus text exposition
+	static void renderText(const ConnectionGauge& gauge, time_t now, std::string& out);
+	static void renderPrometheus(const ConnectionGauge& gauge, time_t now, std::string& out);
+};
+
+#endif // METRICS_HPP
@@ -0,0 +1,39 @@
+#ifndef MIMETYPES_HPP
+#define MIMETYPES_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+
+struct MimeType {
+	std::string extension; // lowercase, without the dot
+	std::string type;
+
+	bool operator<(const MimeType& other) const { return extension < other.extension; }
+};
+
+// Extension -> Content-Type, process-wide: the built-in table (a sorted
+// array compiled into the binary) plus the `types {}` blocks of the
+// configuration. Lookups are a binary search over the lowercase
+// extensions, comparing in place, and hand back a reference into the
+// table: nothing is allocated per request.
+class MimeTypes {
+private:
+	static std::vector<MimeType> _types; // sorted by extension
+	static std::string _default;
+
+public:
+	// Back to the built-in table only
+	static void reset();
+	// Adds or replaces the type for `extension` (case-insensitive, dot optional)
+	static void add(const std::string& extension, const std::string& type);
+
+	// Type for the extension of the path's last segment, MIME_DEFAULT_TYPE
+	// when it has none or an unknown one
+	static const std::string& lookup(const std::string& path);
+	static const std::string& forExtension(const char* extension, size_t length);
+};
+
+#endif // MIMETYPES_HPP
@@ -0,0 +1,64 @@
+#ifndef MULTIPARTPARSER_HPP
+#define MULTIPARTPARSER_HPP
+
+#include "BodySink.hpp"
+#include "Scanner.hpp"
+#include <string>
+#include <vector>
+
+struct UploadedFile {
+    std::string filename;     // sanitized name inside the upload directory
+    std::string content_type;
+    size_t size;
+};
+
+// Incremental multipart/form-data decoder. File parts are written to a temp
+// file in the upload directory as they arrive and renamed once the part's
+// closing boundary is seen, so memory stays at a couple of recv buffers.
+class MultipartParser : public BodySink {
+private:
+    enum State {
+        PREAMBLE,     // before the first boundary
+        BOUNDARY_END, // after a delimiter: CRLF (next part) or "--" (last)
+        PART_HEADERS,
+        PART_DATA,
+        EPILOGUE,     // after the close delimiter, ignored
+        FAILED
+    };
+    
+    std::string directory;
+    DelimiterSearch delimiter;   // CRLF "--" boundary
+    DelimiterSearch headers_end; // CRLF CRLF after a part's header fields
+    std::string pending;   // undecided bytes, never more than one input block plus a delimiter
+    State state;
+    int error_code;
+    
+    int fd;                // current file part, -1 for form fields
+    std::string temp_path;
+    UploadedFile current;
+    std::vector<UploadedFile> saved;
+    
+    bool parsePartHeaders(const std::string& block);
+    bool openTemp();
+    bool writePart(const char* data, size_t len);
+    bool closePart();
+    void discardPart();
+    bool fail(int code);
+    
+    MultipartParser(const MultipartParser&);
+    MultipartParser& operator=(const MultipartParser&);
+    
+public:
+    MultipartParser(const std::string& upload_dir, const std::string& boundary);
+    ~MultipartParser(); // unlinks an unfinished temp file
+    
+    bool write(const char* data, size_t len);
+    bool finish();
+    int errorCode() const { return error_code; }
+    
+    const std::vector<UploadedFile>& files() const { return saved; }
+    
+    static std::string sanitizeFilename(const std::string& filename);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef OUTPUTQUEUE_HPP
+#define OUTPUTQUEUE_HPP
+
+#include "SharedBuffer.hpp"
+#include "SharedFile.hpp"
+#include <deque>
+#include <string>
+#include <sys/types.h>
+
+// A slice of pending output: either bytes from a shared buffer or a range of
+// a file. `offset` advances as bytes are written, nothing is ever shifted.
+struct OutputSegment {
+	SharedBuffer buffer;
+	SharedFile file;
+	off_t offset;
+	size_t length; // bytes still to send
+
+	OutputSegment() : offset(0), length(0) {}
+
+	bool isFile() const { return file.valid(); }
+};
+
+enum FlushResult {
+	FLUSH_DONE,  // queue drained
+	FLUSH_AGAIN, // socket is full, wait for writability
+	FLUSH_ERROR  // peer gone or write failed
+};
+
+#define HEAD_BUFFER_LIMIT 65536 // a head buffer still in use past this is replaced
+
+// Per-connection output queue flushed with writev() / sendfile()
+class OutputQueue {
+private:
+	std::deque<OutputSegment> _segments;
+	size_t _pending;
+	SharedBuffer _head; // reusable storage that response heads are serialized into
+
+	void _consume(size_t bytes);
+
+public:
+	OutputQueue();
+
+	void push(const SharedBuffer& buffer);
+	void push(const SharedBuffer& buffer, size_t offset, size_t length);
+	void push(const std::string& data);
+	void pushFile(const SharedFile& file, off_t offset, size_t length);
+	void push(const OutputSegment& segment);
+
+	// Response heads: append to headBuffer(), then queue what was appended
+	// since `start` with pushHead(start). The storage is rewound once
+	// nothing queued refers to it, so steady-state heads allocate nothing.
+	std::string& headBuffer();
+	void pushHead(size_t start);
+
+	bool empty() const { return _segments.empty(); }
+	size_t pendingBytes() const { return _pending; }
+	void clear();
+	void swap(OutputQueue& other);
+
+	// Writes until the queue is empty or the socket stops accepting data
+	FlushResult flush(int fd);
+};
+
+#endif // OUTPUTQUEUE_HPP
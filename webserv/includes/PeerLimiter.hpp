@@ -0,0 +1,47 @@
+#ifndef PEERLIMITER_HPP
+#define PEERLIMITER_HPP
+
+#include <map>
+#include <cstddef>
+
+// Per client address: open connections and a token bucket refilled at
+// `rate` requests per second, holding at most `burst` tokens
+struct PeerState {
+	size_t connections;
+	double tokens;
+	long long updated_us;
+};
+
+// Per-IP connection caps and request rate limits (limit_conn_per_ip,
+// limit_req). Peers are only tracked while a limit is configured; idle
+// ones with a full bucket are forgotten by sweep().
+class PeerLimiter {
+private:
+	std::map<unsigned int, PeerState> _peers; // IPv4, network order
+	size_t _max_connections; // 0 = unlimited
+	double _rate;            // requests per second, 0 = unlimited
+	double _burst;
+
+	PeerLimiter(const PeerLimiter&);
+	PeerLimiter& operator=(const PeerLimiter&);
+
+	PeerState& _peer(unsigned int addr, long long now_us);
+	void _refill(PeerState& peer, long long now_us) const;
+
+public:
+	PeerLimiter();
+
+	void configure(size_t max_connections, double rate, size_t burst);
+	bool enabled() const { return _max_connections > 0 || _rate > 0; }
+
+	// False when the address already holds max_connections; nothing is counted then
+	bool connect(unsigned int addr, long long now_us);
+	void disconnect(unsigned int addr);
+	// Takes a token, false when the bucket is empty
+	bool allowRequest(unsigned int addr, long long now_us);
+
+	void sweep(long long now_us);
+	size_t tracked() const { return _peers.size(); }
+};
+
+#endif // PEERLIMITER_HPP
@@ -0,0 +1,232 @@
+#ifndef PROXY_HPP
+#define PROXY_HPP
+
+#include "CgiStream.hpp"
+#include "EventLoop.hpp"
+#include "HttpRequest.hpp"
+#include "OutputQueue.hpp"
+#include "SharedBuffer.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define PROXY_MAX_HEADERS 16384 // bytes of an upstream response head
+#define PROXY_IDLE_TIMEOUT 60   // seconds a pooled connection may stay unused
+#define PROXY_BODY_HIGH_WATER 262144 // streamed request body bytes queued before the client is paused
+
+struct LocationConfig;
+struct ProxyServer;
+struct ProxyUpstream;
+struct ProxyConnection;
+class ProxyBodySink;
+class ProxyPool;
+
+// One request forwarded to an upstream group. The pool parses the response
+// head itself and decodes the body framing, so the stream only ever sees
+// the head (once) and then plain body bytes.
+class ProxyRequest : public CgiStream {
+	friend class ProxyPool;
+	friend class ProxyBodySink;
+
+private:
+	ProxyUpstream* _upstream;
+	ProxyServer* _server;  // server of the current attempt
+	ProxyConnection* _conn;
+	SharedBuffer _head;    // request line and headers, as sent upstream
+	SharedBuffer _body;
+	bool _head_only;       // HEAD: the response has no body whatever it says
+	bool _idempotent;      // may be sent again after it reached a server
+	std::vector<ProxyServer*> _tried; // servers already attempted
+	bool _got_output;      // response head seen: not retried any more
+	bool _ended;
+	int _status;
+	std::vector<std::pair<std::string, std::string> > _headers;
+	// Streamed body: it follows the head through sendBody() and is only held
+	// until the upstream takes it, so it is never sent to a second server
+	// once a connection got some of it
+	bool _streaming;
+	bool _body_chunked;    // no Content-Length: framed as chunks on the way
+	bool _body_done;
+	bool _body_blocked;    // over PROXY_BODY_HIGH_WATER: the client is paused
+	time_t _timeout;       // the deadline moves on while the body makes progress
+	OutputQueue _unsent;   // queued on a connection that never connected, for the next one
+	ProxyBodySink* _sink;
+
+	ProxyRequest(const ProxyRequest&);
+	ProxyRequest& operator=(const ProxyRequest&);
+
+public:
+	ProxyRequest(ProxyUpstream* upstream, int client_fd, time_t deadline, const std::string& head,
+	             const SharedBuffer& body, bool head_only, bool idempotent);
+	~ProxyRequest();
+
+	// The head was parsed by the pool: hands it over with the first bytes
+	int parseHeaders(const char* data, size_t len, HttpResponse& response, std::string& body);
+	// The pool drops the connection when the request is released
+	void kill() {}
+	int outputFd() const;
+	const std::string& address() const;
+	bool bodyBlocked() const { return _body_blocked; }
+};
+
+// Request body sink of a proxied request whose body is streamed: what the
+// parser decodes goes to the upstream connection as it arrives. Detached
+// when the proxied request goes away, the rest of the body is then dropped.
+class ProxyBodySink : public BodySink {
+private:
+	ProxyPool* _pool;
+	ProxyRequest* _request;
+
+	ProxyBodySink(const ProxyBodySink&);
+	ProxyBodySink& operator=(const ProxyBodySink&);
+
+public:
+	ProxyBodySink(ProxyPool* pool, ProxyRequest* request);
+	~ProxyBodySink();
+
+	bool write(const char* data, size_t len);
+	bool finish();
+	// The upstream lags: stop reading the client until PROXY_EVENT_DRAINED
+	bool blocked() const { return _request && _request->bodyBlocked(); }
+	void detach() { _request = NULL; }
+};
+
+enum ProxyEventType {
+	PROXY_EVENT_OUTPUT, // body bytes (the first one right after the head, possibly empty)
+	PROXY_EVENT_END,    // whole response received
+	PROXY_EVENT_ERROR,  // every attempt failed, or the connection broke mid-response
+	PROXY_EVENT_DRAINED // a streamed body is below the mark again: read the client
+};
+
+struct ProxyEvent {
+	ProxyRequest* request;
+	ProxyEventType type;
+	SharedBuffer data;
+};
+
+// Where the response body ends
+enum ProxyBodyState {
+	PROXY_HEAD,          // waiting for the status line and headers
+	PROXY_BODY_LENGTH,   // Content-Length bytes
+	PROXY_BODY_CHUNKED,  // chunked transfer-coding, see chunk_state
+	PROXY_BODY_CLOSE,    // up to the end of the connection
+	PROXY_DONE
+};
+
+// A socket to an upstream server, carrying one request at a time; between
+// requests it waits in the server's idle list
+struct ProxyConnection {
+	int fd;
+	ProxyServer* server;
+	bool connected;
+	OutputQueue output;
+	std::string input;   // bytes of an incomplete head or chunk line
+	ProxyRequest* request;
+	size_t served;       // completed requests, a reused connection may have been closed idle
+	time_t idle_since;
+	// Response framing
+	ProxyBodyState state;
+	ChunkState chunk_state;
+	size_t remaining;    // of the Content-Length body or of the current chunk
+	bool reusable;       // HTTP/1.1 response without Connection: close
+
+	ProxyConnection() : fd(-1), server(NULL), connected(false), request(NULL), served(0), idle_since(0),
+		state(PROXY_HEAD), chunk_state(CHUNK_SIZE), remaining(0), reusable(false) {}
+};
+
+// host:port of an upstream, shared by every group naming it, with its
+// pooled connections and passive health state
+struct ProxyServer {
+	std::string address; // as configured
+	std::string authority; // Host header value: host, and the port unless 80
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	std::vector<ProxyConnection*> idle; // most recently used last
+	size_t active;     // connections with a request on them
+	size_t keepalive;  // idle connections kept
+	size_t fails;      // failures within the current fail_timeout window
+	time_t fail_start;
+	time_t down_until; // skipped by the balancer until then
+
+	ProxyServer() : addr_len(0), active(0), keepalive(0), fails(0), fail_start(0), down_until(0) {}
+};
+
+// The servers of one proxy_pass directive
+struct ProxyUpstream {
+	std::string name; // proxy_pass servers, space separated
+	std::vector<ProxyServer*> servers;
+	bool least_conn;  // else round-robin
+	size_t next;      // round-robin position
+	size_t max_fails; // failures within fail_timeout marking a server down (0 = never)
+	time_t fail_timeout;
+
+	ProxyUpstream() : least_conn(false), next(0), max_fails(1), fail_timeout(10) {}
+};
+
+// Upstream groups of every proxy_pass location, driven by the server's
+// event loop like the FastCGI pool
+class ProxyPool {
+private:
+	EventLoop* _loop;
+	time_t _now;
+	std::map<std::string, ProxyServer*> _servers;     // address -> server
+	std::map<std::string, ProxyUpstream*> _upstreams; // name -> group
+	std::map<int, ProxyConnection*> _connections;     // socket fd -> connection
+	std::vector<ProxyRequest*> _released; // freed once the current events are handled
+	std::vector<ProxyEvent> _deferred;    // produced outside handleEvent()
+
+	ProxyPool(const ProxyPool&);
+	ProxyPool& operator=(const ProxyPool&);
+
+	ProxyServer* _pick(ProxyUpstream* upstream, const ProxyRequest* request);
+	bool _dispatch(ProxyRequest* request);
+	ProxyConnection* _connect(ProxyServer* server);
+	void _begin(ProxyConnection* conn, ProxyRequest* request);
+	void _readResponse(ProxyConnection* conn, std::vector<ProxyEvent>& events);
+	size_t _parseResponse(ProxyConnection* conn, const char* data, size_t size, std::vector<ProxyEvent>& events);
+	bool _parseHead(ProxyConnection* conn, const char* data, size_t length);
+	void _deliver(ProxyConnection* conn, const char* data, size_t len, std::vector<ProxyEvent>& events);
+	void _finish(ProxyConnection* conn, bool reusable, std::vector<ProxyEvent>& events);
+	void _fail(ProxyConnection* conn, bool server_fault, std::vector<ProxyEvent>& events);
+	void _markFailed(ProxyUpstream* upstream, ProxyServer* server);
+	void _closeConnection(ProxyConnection* conn);
+	void _purge();
+
+public:
+	ProxyPool(EventLoop* loop);
+	~ProxyPool();
+
+	// Registers the location's proxy_pass group under upstreamName();
+	// false when one of its servers does not resolve
+	bool addUpstream(const LocationConfig& location);
+	static std::string upstreamName(const LocationConfig& location);
+	// Host for requests that came without one: the group's first server
+	const std::string& authority(const std::string& upstream) const;
+	// NULL when the group is unknown or none of its servers is usable
+	ProxyRequest* submit(const std::string& upstream, int client_fd, time_t deadline, const std::string& head,
+	                     const SharedBuffer& body, bool head_only, bool idempotent);
+	// Same with the body still to come: `chunked` when its length is unknown
+	// (the head then says Transfer-Encoding: chunked). It always gets a new
+	// connection, a pooled one may have been closed with the body half sent.
+	ProxyRequest* submitStreamed(const std::string& upstream, int client_fd, time_t deadline,
+	                             const std::string& head, bool chunked, bool head_only, bool idempotent);
+	// Body bytes as the client's request decodes them, then its end; dropped
+	// once the exchange is over
+	void sendBody(ProxyRequest* request, const char* data, size_t len);
+	void endBody(ProxyRequest* request);
+	// Stops a request, ended or not; it is freed later
+	void release(ProxyRequest* request);
+
+	bool owns(int fd) const { return _connections.find(fd) != _connections.end(); }
+	void handleEvent(int fd, unsigned int events, std::vector<ProxyEvent>& out);
+	// Events raised outside handleEvent() (a retry failing right away)
+	void takeEvents(std::vector<ProxyEvent>& out);
+	// Drops stale idle connections and collects requests past their deadline
+	void tick(time_t now, std::vector<ProxyRequest*>& expired);
+};
+
+#endif // PROXY_HPP
@@ -0,0 +1,90 @@
+#ifndef REQUESTTRACE_HPP
+#define REQUESTTRACE_HPP
+
+#include "Logger.hpp"
+#include <string>
+
+// Phase tracing is compiled out with -DWEBSERV_TRACE=0; compiled in, it
+// costs one branch per hook until server_timing or slow_request_threshold
+// turns it on
+#ifndef WEBSERV_TRACE
+# define WEBSERV_TRACE 1
+#endif
+
+#if WEBSERV_TRACE
+# define WS_TRACE_MARK(trace, point) \
+	do { \
+		if (RequestTrace::active()) \
+			(trace).mark(point, Logger::clockUs()); \
+	} while (0)
+# define WS_TRACE_HANDLER(trace, name) \
+	do { \
+		if (RequestTrace::active()) \
+			(trace).setHandler(name); \
+	} while (0)
+// Times `statement` (a parse() call) into the trace's parse total
+# define WS_TRACE_PARSE(trace, statement) \
+	do { \
+		if (RequestTrace::active()) { \
+			long long trace_start_ = Logger::clockUs(); \
+			statement; \
+			(trace).addParse(Logger::clockUs() - trace_start_); \
+		} else { \
+			statement; \
+		} \
+	} while (0)
+#else
+# define WS_TRACE_MARK(trace, point) do {} while (0)
+# define WS_TRACE_HANDLER(trace, name) do {} while (0)
+# define WS_TRACE_PARSE(trace, statement) do { statement; } while (0)
+#endif
+
+// Phase boundaries of one request, in the order they are reached
+enum TracePoint {
+	TRACE_START,       // first byte of the request read
+	TRACE_HEADERS,     // request line and header fields parsed
+	TRACE_PARSED,      // body received: the request is complete
+	TRACE_HANDLER,     // handler returned (file served, upload stored, script started)
+	TRACE_APP_HEADERS, // CGI / FastCGI response headers arrived
+	TRACE_QUEUED,      // whole response queued
+	TRACE_FLUSHED,     // last byte of it handed to the socket
+	TRACE_POINTS
+};
+
+// Monotonic timestamps (microseconds, 0 = not reached) of a request's
+// phases, rendered as a Server-Timing header and in the slow-request log
+class RequestTrace {
+private:
+	static bool _active;
+
+	long long _points[TRACE_POINTS];
+	long long _parse_us;   // inside HttpRequest::parse(), over all reads
+	const char* _handler;  // static, upload, cgi, ... (NULL = none ran)
+
+	long long _span(TracePoint from, TracePoint to) const;
+
+public:
+	RequestTrace();
+
+	static bool active() { return _active; }
+	static void setActive(bool active) { _active = active; }
+
+	void clear();
+	// The first one wins: a point keeps the time it was first reached
+	void mark(TracePoint point, long long us) {
+		if (!_points[point])
+			_points[point] = us;
+	}
+	void addParse(long long us) { _parse_us += us; }
+	void setHandler(const char* name) { _handler = name; }
+	long long at(TracePoint point) const { return _points[point]; }
+
+	// Start to flushed, or to `now` while the response is not out yet
+	long long total(long long now) const;
+	// Server-Timing header value: wait, parse, body, handler, app, total (ms)
+	void appendServerTiming(long long now, std::string& out) const;
+	// `wait=0.12 parse=0.01 ... flush=3.40` (ms, `-` for phases not reached)
+	void appendSummary(std::string& out) const;
+};
+
+#endif // REQUESTTRACE_HPP
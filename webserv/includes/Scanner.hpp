@@ -0,0 +1,43 @@
+#ifndef SCANNER_HPP
+#define SCANNER_HPP
+
+#include <string>
+#include <cstddef>
+
+// Byte scanning shared by the request parser and the multipart decoder.
+// x86 uses SSE2 (AVX2 when the CPU has it, picked at run time), ARM uses
+// NEON; WEBSERV_NO_SIMD or any other target gets the scalar versions.
+class Scanner {
+public:
+	// Offset of the first "\r\n" in data, or std::string::npos
+	static size_t findCrlf(const char* data, size_t len);
+	// Which implementation the vector paths use: avx2, sse2, neon or scalar
+	static const char* backend();
+};
+
+// Repeated search for one pattern (a multipart delimiter). Candidates are
+// the positions where both the first and the last pattern byte match,
+// found 16 or 32 at a time and confirmed with memcmp; ends of blocks too
+// short for a vector fall back to Boyer-Moore-Horspool. The tables are
+// built once, when the pattern is set.
+class DelimiterSearch {
+private:
+	std::string _pattern;
+	size_t _skip[256]; // Horspool shift by the byte under the pattern's last position
+
+public:
+	DelimiterSearch();
+	explicit DelimiterSearch(const std::string& pattern);
+
+	void assign(const std::string& pattern);
+	const std::string& pattern() const { return _pattern; }
+	size_t size() const { return _pattern.size(); }
+
+	// Offset of the first match in data, or std::string::npos
+	size_t find(const char* data, size_t len) const;
+	// Longest tail of data that starts the pattern: when a block has no
+	// match, only these bytes need to wait for the next one
+	size_t partialSuffix(const char* data, size_t len) const;
+};
+
+#endif // SCANNER_HPP
@@ -4,64 +4,212 @@
 #include <string>
 #include <vector>
 #include <map>
-#include <sys/poll.h>
+#include <utility>
+#include "EventLoop.hpp"
+#include "OutputQueue.hpp"
+#include "FastCgi.hpp"
+#include "Proxy.hpp"
+#include "TimerWheel.hpp"
+#include "Config.hpp"
+#include "PeerLimiter.hpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 
-#define LISTEN_CONN 128
+#define ACCEPT_BATCH 64 // connections taken per listener wakeup
 #define BUFFER_SIZE 8192
+#define READ_BUDGET (1024 * 1024) // bytes read from one client per wakeup before the others get a turn
+#define CGI_OUTPUT_HIGH_WATER (256 * 1024) // stop reading the script while this much is unsent
+#define OUTPUT_HIGH_WATER (1024 * 1024) // stop reading a client while this much of its output is unsent
+#define OVERLOAD_RETRY_AFTER 1 // seconds, Retry-After of the 503 sent when shedding load
+#define DRAIN_TIMEOUT 30 // seconds open connections get to finish on a graceful stop (SIGQUIT)
 
 class Client;
+class ClientPool;
+class CgiStream;
+class CgiProcess;
 class Config;
+class StaticFileCache;
+class CgiCache;
+struct CgiCacheFill;
 class HttpRequest;
 class HttpResponse;
 struct LocationConfig;
+struct ServerConfig;
+
+// A listening socket and the server blocks sharing its host:port
+struct Listener {
+	int fd;
+	std::string host;
+	int port;
+	const ServerConfig* default_server; // `default_server`, else the first block
+	std::map<std::string, const ServerConfig*> names; // lowercase server_name -> block
+	size_t servers;
+	ListenOptions options;
+	bool has_options;
+	std::string busy_response; // pre-rendered 503 for connections turned away
+	time_t busy_rendered;      // its Date, re-rendered once a second
+
+	Listener() : fd(-1), port(0), default_server(NULL), servers(0), has_options(false), busy_rendered(0) {}
+};
 
 class Server {
 private:
+	std::string _config_file;
 	Config* _config;
-	int _server_fd;
-	std::vector<struct pollfd> _poll_fds;
-	std::map<int, Client*> _clients; // fd -> Client*
-	std::map<int, std::string> _output_buffers; // Output buffers per client fd
+	// Configurations replaced by a reload, with the connections still on
+	// them; each is freed once its last connection moves on
+	std::vector<std::pair<const Config*, size_t> > _retired;
+	bool _reuse_port;     // listeners are shared with other worker processes
+	bool _draining;       // graceful stop: not accepting, closing connections as they go idle
+	time_t _drain_deadline;
+	std::vector<Listener> _listeners; // one per distinct host:port
+	std::vector<int> _listener_of;    // fd -> index into _listeners, -1 otherwise
+	EventLoop* _loop;
+	StaticFileCache* _static_cache;
+	CgiCache* _cgi_cache; // micro-cache of script responses (cgi_cache_valid)
+	std::vector<CgiCacheFill*> _cache_done; // ended fills, their waiters resumed at the end of the iteration
+	std::vector<IoEvent> _events;
+	std::vector<char> _read_buffer;  // shared by every client, the loop reads one at a time
+	std::vector<int> _read_pending;  // clients cut off by the read budget, resumed next iteration
+	ClientPool* _clients; // preallocated connections, looked up by fd
+	TimerWheel _timers;   // client deadlines
+	PeerLimiter _peers;   // per-address connection and request rate limits
+	time_t _now;          // read once per loop iteration
+	time_t _last_tick;    // last second the CGI deadlines were checked
+	bool _accept_starved; // accept hit the descriptor limit, listeners paused
+	long long _slow_request_us; // slow-request log threshold, 0 = off
+	int _sigchld_pipe[2]; // self-pipe written by the SIGCHLD handler
+	std::map<int, CgiProcess*> _cgi_pipes; // stdin/stdout pipe fd -> process
+	std::map<pid_t, CgiProcess*> _cgi_children; // every unreaped child, attached or not
+	FastCgiPool* _fastcgi; // persistent FastCGI backends (fastcgi_pass)
+	std::vector<FastCgiEvent> _fastcgi_events;
+	ProxyPool* _proxy; // upstream groups of proxy_pass locations
+	std::vector<ProxyEvent> _proxy_events;
 
 public:
-	Server(const std::string& config_file);
+	// `worker`: one of several processes sharing the listening ports
+	Server(const std::string& config_file, bool worker = false);
 	~Server();
 
-	void run(); // Main event loop
+	// Main event loop; SIGHUP reloads the configuration, SIGQUIT stops
+	// once the open connections are done
+	void run();
 
 private:
-	// Socket setup
-	void _setupSocket();
-	void _acceptNewClient();
+	// Socket setup; listeners already open keep their slot and socket
+	void _setupListeners(const Config& config, std::vector<Listener>& listeners);
+	void _indexListeners();
+	void _openListener(Listener& listener, bool reuse_port);
+	void _setListenOptions(const Listener& listener);
+	void _closeListeners();
+	void _pauseAccepting(bool paused);
+	int _listenerIndex(int fd) const;
+	void _acceptClients(size_t listener);
+	bool _acceptNewClient(size_t listener);
+	void _rejectConnection(size_t listener, int client_fd);
 	void _handleClientData(int client_fd);
+	bool _readPaused(const Client* client) const;
+	void _queueRead(Client* client);
+	void _resumePendingReads();
 	void _setNonBlocking(int fd);
 
 	// Request processing
 	void _processClientRequest(int client_fd);
 	void _handleRequest(int client_fd, HttpRequest& request);
-	HttpResponse _buildResponse(const HttpRequest& request);
+	// 0, or the status refusing the body before it is read; `to_upstream`
+	// when it is proxied (then streamed from the start)
+	int _prepareRequestBody(Client* client, bool& to_upstream);
+	bool _admitRequest(int client_fd);
+	// Virtual host for the request's Host header on the client's listener
+	const ServerConfig& _resolveServer(Client* client);
+	bool _wantsKeepAlive(const HttpRequest& request, const Client* client) const;
+	bool _setConnectionHeaders(const HttpRequest& request, const Client* client,
+	                           HttpResponse& response, bool can_persist);
+	HttpResponse _buildResponse(const HttpRequest& request, Client* client);
+
+	// CGI handling: the script runs alongside other connections and its
+	// output is streamed to the client as it arrives
+	void _setupSigchld();
+	std::vector<std::string> _buildCgiEnv(const ServerConfig& server, const HttpRequest& request,
+	                                      const std::string& script_path) const;
+	HttpResponse _startCgi(Client* client, const std::string& script_path,
+	                       const std::string& interpreter, const HttpRequest& request);
+	void _handleCgiEvent(CgiProcess* cgi, int fd);
+	void _handleCgiOutput(CgiProcess* cgi);
+	void _closeCgiPipe(CgiProcess* cgi, int fd);
+	void _reapCgiChildren();
+	void _checkCgiDeadlines(time_t now);
+
+	// FastCGI: same response path, records multiplexed over pooled connections
+	void _setupFastCgi(const Config& config);
+	HttpResponse _startFastCgi(Client* client, const std::string& script_path,
+	                           const std::string& address, const HttpRequest& request);
+	void _handleFastCgiEvent(int fd, unsigned int events);
+	void _dispatchFastCgiEvents();
 
-	// CGI handling
-	void _handleCgiRequest(int client_fd, const HttpRequest& request);
-	HttpResponse _executeCgi(const std::string& script_path, const std::string& interpreter,
-	                         const HttpRequest& request, const LocationConfig& location);
+	// Reverse proxy: same response path, upstream connections pooled per server
+	void _setupProxy(const Config& config);
+	HttpResponse _startProxy(Client* client, const LocationConfig& location, const HttpRequest& request);
+	void _handleProxyEvent(int fd, unsigned int events);
+	void _dispatchProxyEvents();
+
+	// Shared by CGI, FastCGI and proxied responses
+	void _onCgiOutput(CgiStream* cgi, const char* data, size_t len);
+	void _onCgiEnd(CgiStream* cgi);
+	void _sendCgiHead(CgiStream* cgi, HttpResponse& response);
+	void _forwardCgiBody(CgiStream* cgi, const char* data, size_t len);
+	void _failCgi(CgiStream* cgi, int status);
+	void _completeCgi(CgiStream* cgi);
+	void _releaseCgi(CgiStream* cgi);
+	void _endCacheFill(Client* client, bool store);
+	void _resumeCacheWaiters();
 
 	// Output handling
 	void _sendToClient(int client_fd, const std::string& data);
+	void _sendResponse(int client_fd, HttpResponse& response);
 	void _flushClientBuffer(int client_fd);
 
 	// Client management
+	void _closeAfterFlush(int client_fd);
+	void _lingeringClose(int client_fd);
 	void _removeClient(int client_fd);
-	void _cleanupTimedOutClients();
+	void _closeIdleClients();
+
+	// Reload: the new configuration serves new requests, connections keep
+	// the one their current request started on
+	void _reload();
+	void _applyConfig();
+	void _useConfig(Client* client);
+	void _releaseConfig(const Config* config);
+	void _startDrain();
+
+	void _loadErrorPages();
+	// types {} blocks on top of the built-in table
+	void _loadMimeTypes();
+
+	// Logging and metrics, taken once a response is fully queued
+	bool _openLogs(const ServerConfig& config);
+	void _requestDone(Client* client);
+	void _logAccess(const Client* client, long long now);
+	// Phase tracing: Server-Timing on the way out, slow requests once written
+	void _setupTracing();
+	void _setServerTiming(Client* client, HttpResponse& response);
+	void _traceQueued(Client* client, long long now);
+	void _traceFlushed(Client* client, long long now);
+	void _logSlowRequest(Client* client, long long now);
+	HttpResponse _statusResponse(const LocationConfig& location, const HttpRequest& request);
+
+	// Timeouts: each client carries one timer for the phase it is in,
+	// re-armed when it makes progress
+	time_t _clientTimeout(const Client* client) const;
+	void _armClientTimer(Client* client);
+	void _expireClients();
 
 	// Helper methods
 	std::string _readFile(const std::string& path);
-	std::string _getContentType(const std::string& path);
 	bool _fileExists(const std::string& path);
 };
 
@@ -0,0 +1,40 @@
+#ifndef SHAREDBUFFER_HPP
+#define SHAREDBUFFER_HPP
+
+#include <string>
+#include <cstddef>
+
+// Reference-counted immutable byte block. Copies share the same storage, so
+// a header block or cached body can sit in many output queues at once.
+class SharedBuffer {
+private:
+	struct Handle {
+		std::string data;
+		int refs;
+	};
+	Handle* _handle;
+
+	void _release();
+
+public:
+	SharedBuffer();
+	explicit SharedBuffer(const std::string& data);
+	SharedBuffer(const char* data, size_t len);
+	SharedBuffer(const SharedBuffer& other);
+	SharedBuffer& operator=(const SharedBuffer& other);
+	~SharedBuffer();
+
+	const char* data() const { return _handle ? _handle->data.data() : ""; }
+	size_t size() const { return _handle ? _handle->data.size() : 0; }
+	bool empty() const { return size() == 0; }
+	const std::string& str() const;
+	void reset();
+
+	// In-place writing for a buffer still being filled. Appending is always
+	// safe, since readers address bytes by offset and never keep pointers;
+	// anything else needs unique().
+	bool unique() const { return _handle && _handle->refs == 1; }
+	std::string& writable();
+};
+
+#endif // SHAREDBUFFER_HPP
@@ -0,0 +1,33 @@
+#ifndef SHAREDFILE_HPP
+#define SHAREDFILE_HPP
+
+#include <sys/types.h>
+
+// Reference-counted file descriptor. Responses are copied by value, so the
+// fd behind a file-backed body is closed only when the last copy goes away.
+class SharedFile {
+private:
+	struct Handle {
+		int fd;
+		int refs;
+	};
+	Handle* _handle;
+
+	void _release();
+
+public:
+	SharedFile();
+	explicit SharedFile(int fd);
+	SharedFile(const SharedFile& other);
+	SharedFile& operator=(const SharedFile& other);
+	~SharedFile();
+
+	// Opens read-only (close-on-exec so CGI children never inherit it)
+	static SharedFile open(const char* path);
+
+	int fd() const { return _handle ? _handle->fd : -1; }
+	bool valid() const { return _handle != 0; }
+	void reset();
+};
+
+#endif // SHAREDFILE_HPP
@@ -0,0 +1,107 @@
+#ifndef STATICFILECACHE_HPP
+#define STATICFILECACHE_HPP
+
+#include "SharedBuffer.hpp"
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define STATIC_CACHE_DEFAULT_SIZE 16777216    // 16MB
+#define STATIC_CACHE_DEFAULT_MAX_FILE 1048576 // 1MB
+
+// What a look for a precompressed sibling (file.br, file.gz) found
+struct SiblingProbe {
+	std::string encoding;
+	std::string path;
+	bool exists; // a regular file
+	bool usable; // and no older than the file itself
+	time_t mtime;
+	off_t size;
+	ino_t inode;
+};
+
+struct CachedFile {
+	std::string key;  // the path, plus the content coding for compressed variants
+	std::string path; // file revalidated with stat()
+	SharedBuffer content;
+	SharedBuffer header_block;       // entity headers (type, length, validators) + blank line
+	SharedBuffer not_modified_block; // validators only, for 304 responses
+	std::string mime_type;
+	std::string encoding; // Content-Encoding of `content`, empty for the file as is
+	bool listing;         // autoindex page: `path` is the directory, no ranges
+	bool no_gain;         // gzip variant marker: compressing `path` did not pay, send it as is
+	std::vector<SiblingProbe> siblings; // probe record: siblings looked for, found or not
+	std::string etag;
+	std::string last_modified;
+	time_t mtime;
+	off_t size;
+	ino_t inode;
+	time_t validated_at;
+	std::list<CachedFile*>::iterator lru;
+};
+
+// Bounded LRU cache of small static files keyed by resolved path. Entries are
+// revalidated against stat() at most once per second. Compressed variants
+// (a .gz/.br sibling, or a gzip copy made here) sit next to the plain file
+// under variantKey(), autoindex pages next to their directory under
+// listingKey(). Empty entries next to them remember that gzip did not pay
+// and which siblings were looked for; those are revalidated the same way.
+class StaticFileCache {
+private:
+	std::map<std::string, CachedFile*> _entries;
+	std::list<CachedFile*> _lru; // front = most recently used
+	size_t _max_bytes;
+	size_t _max_file_size;
+	size_t _bytes;
+
+	void _evict(CachedFile* entry);
+	bool _stillValid(CachedFile* entry, time_t now);
+	CachedFile* _insert(const std::string& key, const std::string& path, const struct stat& st,
+	                    const std::string& content, const std::string& mime_type,
+	                    const std::string& encoding, const std::string& tag, bool vary,
+	                    bool listing, time_t now);
+
+	StaticFileCache(const StaticFileCache&);
+	StaticFileCache& operator=(const StaticFileCache&);
+
+public:
+	StaticFileCache(size_t max_bytes = STATIC_CACHE_DEFAULT_SIZE,
+	                size_t max_file_size = STATIC_CACHE_DEFAULT_MAX_FILE);
+	~StaticFileCache();
+
+	const CachedFile* lookup(const std::string& key, time_t now);
+	// `st` describes `path`; `encoding` is the variant's content coding and
+	// `vary` adds Vary: Accept-Encoding to its headers
+	const CachedFile* insert(const std::string& key, const std::string& path, const struct stat& st,
+	                         const std::string& content, const std::string& mime_type,
+	                         const std::string& encoding, bool vary, time_t now);
+	// Rendered directory listing; valid while the directory's mtime holds
+	const CachedFile* insertListing(const std::string& key, const std::string& path, const struct stat& st,
+	                                const std::string& content, const std::string& mime_type,
+	                                const std::string& variant, time_t now);
+	// Remembers that gzip made `path` no smaller, so it is not tried again
+	// until the file changes
+	void insertNoGain(const std::string& path, const struct stat& st, time_t now);
+	// Sibling probes of `path` (`st`); one for the same encoding is replaced
+	void recordSiblings(const std::string& path, const struct stat& st,
+	                    const std::vector<SiblingProbe>& probes, time_t now);
+	// NULL until recorded, and again once the file or a sibling changes
+	const std::vector<SiblingProbe>* lookupSiblings(const std::string& path, time_t now);
+	// Drops the file and its compressed variants
+	void invalidate(const std::string& path);
+	void clear();
+
+	bool accepts(off_t size) const;
+	static std::string makeETag(const struct stat& st, const std::string& encoding = "");
+	static std::string variantKey(const std::string& path, const std::string& encoding);
+	// `variant` tells the format and page apart
+	static std::string listingKey(const std::string& path, const std::string& variant);
+	size_t count() const { return _entries.size(); }
+	size_t bytes() const { return _bytes; }
+};
+
+#endif // STATICFILECACHE_HPP
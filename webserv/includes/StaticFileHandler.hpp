@@ -4,18 +4,80 @@
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
 #include <string>
+#include <vector>
+#include <ctime>
+#include <sys/stat.h>
+
+#define MAX_BYTE_RANGES 32
+#define GZIP_MIN_LENGTH 1024 // smaller files are not worth compressing
+#define GZIP_COMP_LEVEL 6
+#define AUTOINDEX_PAGE_SIZE 1000 // entries per listing page, ?page=N for the others
+
+// Content codings named in Accept-Encoding that we can serve
+enum ContentCoding {
+    CODING_GZIP = 1,
+    CODING_BR = 2
+};
+
+struct ByteRange {
+    off_t first;
+    off_t last; // inclusive
+};
+
+enum RangeResult {
+    RANGE_IGNORE,       // no (usable) Range header: send the whole file
+    RANGE_SATISFIABLE,
+    RANGE_UNSATISFIABLE // 416
+};
+
+struct ListingEntry {
+    std::string name;
+    bool directory;
+
+    bool operator<(const ListingEntry& other) const { return name < other.name; }
+};
+
+class StaticFileCache;
+struct CachedFile;
+struct SiblingProbe;
+class FileSink;
 
 class StaticFileHandler {
 private:
     std::string root_directory;
     bool directory_listing_enabled;
     std::string default_file;
+    StaticFileCache* cache;
+    bool gzip_static;       // serve file.br / file.gz siblings to clients that take them
+    bool gzip_on;           // gzip cacheable text files once, keep the result in the cache
+    size_t gzip_min_length;
+    int gzip_level;
     
-    std::string getMimeType(const std::string& path) const;
-    std::string readFile(const std::string& path, bool& success) const;
+    bool compressible(const std::string& mime_type) const;
+    unsigned int acceptedCodings(const HttpRequest& request) const;
+    const CachedFile* lookupCached(const std::string& path, unsigned int accepted, time_t now) const;
+    HttpResponse serveFile(const HttpRequest& request, const std::string& path,
+                           const struct stat& st, time_t now) const;
+    bool serveEncoded(const HttpRequest& request, const std::string& path, const struct stat& st,
+                      const std::string& mime_type, unsigned int accepted, time_t now,
+                      std::vector<SiblingProbe>& probes, HttpResponse& response) const;
+    HttpResponse serveRepresentation(const HttpRequest& request, const std::string& key,
+                                     const std::string& path, const struct stat& st,
+                                     const std::string& mime_type, const std::string& encoding,
+                                     time_t now) const;
+    HttpResponse serveCached(const HttpRequest& request, const CachedFile& entry) const;
+    bool isNotModified(const HttpRequest& request, const std::string& etag, time_t mtime) const;
+    RangeResult evaluateRange(const HttpRequest& request, const std::string& etag, time_t mtime,
+                              off_t size, std::vector<ByteRange>& ranges) const;
+    HttpResponse servePartial(const std::string& path, const std::string& mime_type,
+                              const std::string& etag, time_t mtime, off_t size,
+                              RangeResult result, const std::vector<ByteRange>& ranges) const;
     bool fileExists(const std::string& path) const;
-    bool isDirectory(const std::string& path) const;
-    std::string generateDirectoryListing(const std::string& path, const std::string& uri) const;
+    bool readDirectory(const std::string& path, std::vector<ListingEntry>& entries) const;
+    HttpResponse serveListing(const HttpRequest& request, const std::string& path,
+                              const struct stat& st, time_t now) const;
+    std::string renderListing(const std::vector<ListingEntry>& entries, const std::string& uri,
+                              size_t page, size_t pages, bool json) const;
     std::string combinePaths(const std::string& base, const std::string& relative) const;
     bool isPathSafe(const std::string& path) const;
     
@@ -25,9 +87,24 @@ public:
     
     HttpResponse handleRequest(const HttpRequest& request);
     
+    // PUT: a sink storing the body at root + URI as it arrives, moved over
+    // the old file once complete (NULL with the status in `error` when the
+    // URI cannot name a file). handlePut() answers once the body is in;
+    // without `streamed` the in-memory body is written then.
+    FileSink* createSink(const HttpRequest& request, int& error) const;
+    HttpResponse handlePut(const HttpRequest& request, const BodySink* streamed = NULL);
+    
     void setRootDirectory(const std::string& root) { root_directory = root; }
     void setDirectoryListing(bool enabled) { directory_listing_enabled = enabled; }
     void setDefaultFile(const std::string& file) { default_file = file; }
+    void setCache(StaticFileCache* file_cache) { cache = file_cache; }
+    void setCompression(bool sidecars, bool on_the_fly, size_t min_length = GZIP_MIN_LENGTH,
+                        int level = GZIP_COMP_LEVEL) {
+        gzip_static = sidecars;
+        gzip_on = on_the_fly;
+        gzip_min_length = min_length;
+        gzip_level = level;
+    }
 };
 
 #endif
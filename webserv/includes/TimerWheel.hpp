@@ -0,0 +1,49 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <vector>
+#include <cstddef>
+#include <ctime>
+
+#define TIMER_WHEEL_SLOTS 512 // one-second slots; longer timers take extra laps
+
+// Intrusive timer embedded in the object it times out. `id` tells the
+// owner which object fired (a client fd).
+struct TimerNode {
+	TimerNode* prev;
+	TimerNode* next;
+	time_t expires;
+	time_t slot_time; // when the slot it is linked in comes up
+	int id;
+
+	TimerNode() : prev(NULL), next(NULL), expires(0), slot_time(0), id(-1) {}
+	bool armed() const { return next != NULL; }
+};
+
+// Hashed timing wheel with one-second resolution. Scheduling and
+// cancelling are O(1). Pushing a deadline later only updates the node,
+// which moves to its real slot when its current one comes up. The work
+// per tick is therefore proportional to the timers due in it, not to the
+// number of connections.
+class TimerWheel {
+private:
+	std::vector<TimerNode> _slots; // list heads
+	time_t _now;                   // last second processed
+
+	TimerWheel(const TimerWheel&);
+	TimerWheel& operator=(const TimerWheel&);
+
+	void _link(TimerNode* node);
+	static void _unlink(TimerNode* node);
+
+public:
+	explicit TimerWheel(time_t now);
+
+	void schedule(TimerNode* node, time_t expires);
+	void cancel(TimerNode* node);
+	// Processes every second up to `now`; ids of the timers that fired
+	// are appended to `expired` and their nodes are disarmed
+	void advance(time_t now, std::vector<int>& expired);
+};
+
+#endif // TIMERWHEEL_HPP
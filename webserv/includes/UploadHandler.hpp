@@ -3,34 +3,35 @@
 
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
+#include "MultipartParser.hpp"
+#include "FileSink.hpp"
 #include <string>
 #include <vector>
 
-struct UploadedFile {
-    std::string filename;
-    std::string content_type;
-    std::string content;
-    size_t size;
-};
-
 class UploadHandler {
 private:
     std::string upload_directory;
+    std::string upload_uri;   // where the directory is served, for Location headers
     size_t max_upload_size;
     
-    bool parseMultipartFormData(const std::string& body, const std::string& boundary,
-                               std::vector<UploadedFile>& files);
-    bool saveFile(const std::string& filename, const std::string& content);
-    std::string sanitizeFilename(const std::string& filename) const;
     bool directoryExists(const std::string& path) const;
     bool createDirectory(const std::string& path) const;
+    FileSink* openRawSink(size_t expected, int& error) const;
     
 public:
     UploadHandler(const std::string& upload_dir, size_t max_size = 10485760); // 10MB default
     
-    HttpResponse handleUpload(const HttpRequest& request);
+    // Sink that writes the body to disk while it arrives: the parts of a
+    // multipart/form-data body, anything else as one file under a generated
+    // name. NULL with the response status in `error` when it cannot be stored.
+    BodySink* createSink(const HttpRequest& request, int& error) const;
+    
+    // `streamed` is the sink the body went through; without one the
+    // in-memory body is decoded here
+    HttpResponse handleUpload(const HttpRequest& request, const BodySink* streamed = NULL);
     
     void setUploadDirectory(const std::string& dir) { upload_directory = dir; }
+    void setUploadUri(const std::string& uri) { upload_uri = uri; }
     void setMaxUploadSize(size_t size) { max_upload_size = size; }
     size_t getMaxUploadSize() const { return max_upload_size; }
 };
@@ -0,0 +1,64 @@
+#include "Arena.hpp"
+#include <cstring>
+
+#define ARENA_ALIGN sizeof(void*)
+
+Arena::Arena() : _used(0), _cursor(_inline.bytes), _left(ARENA_INLINE_SIZE) {}
+
+Arena::~Arena() {
+	for (size_t i = 0; i < _blocks.size(); ++i)
+		delete[] _blocks[i];
+}
+
+void* Arena::allocate(size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > _left)
+		_grow(size);
+	void* ptr = _cursor;
+	_cursor += size;
+	_left -= size;
+	return ptr;
+}
+
+char* Arena::copy(const char* data, size_t len) {
+	char* ptr = static_cast<char*>(allocate(len + 1));
+	std::memcpy(ptr, data, len);
+	ptr[len] = '\0';
+	return ptr;
+}
+
+// Moves on to the next block, reusing one kept from before a reset() when big enough
+void Arena::_grow(size_t size) {
+	if (_used < _blocks.size() && _sizes[_used] < size) {
+		delete[] _blocks[_used];
+		_blocks.erase(_blocks.begin() + _used);
+		_sizes.erase(_sizes.begin() + _used);
+	}
+	if (_used == _blocks.size()) {
+		size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		_blocks.push_back(new char[block_size]);
+		_sizes.push_back(block_size);
+	}
+	_cursor = _blocks[_used];
+	_left = _sizes[_used];
+	_used++;
+}
+
+void Arena::reset() {
+	// Keep one ordinary block for the next request, give back anything else
+	size_t keep = (!_blocks.empty() && _sizes[0] == ARENA_BLOCK_SIZE) ? 1 : 0;
+	for (size_t i = keep; i < _blocks.size(); ++i)
+		delete[] _blocks[i];
+	_blocks.resize(keep);
+	_sizes.resize(keep);
+	_used = 0;
+	_cursor = _inline.bytes;
+	_left = ARENA_INLINE_SIZE;
+}
+
+size_t Arena::heapBytes() const {
+	size_t total = 0;
+	for (size_t i = 0; i < _sizes.size(); ++i)
+		total += _sizes[i];
+	return total;
+}
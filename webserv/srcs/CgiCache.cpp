@@ -0,0 +1,234 @@
+#include "CgiCache.hpp"
+#include "HttpResponse.hpp"
+#include "HttpDate.hpp"
+
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+
+CgiCache::CgiCache(size_t max_bytes, size_t max_entry)
+	: _max_bytes(max_bytes), _max_entry(max_entry), _bytes(0) {}
+
+CgiCache::~CgiCache() {
+	while (!_lru.empty())
+		_evict(_lru.back());
+	for (std::map<std::string, CgiCacheFill*>::iterator it = _fills.begin(); it != _fills.end(); ++it)
+		delete it->second;
+}
+
+void CgiCache::configure(size_t max_bytes, size_t max_entry) {
+	while (!_lru.empty())
+		_evict(_lru.back());
+	_max_bytes = max_bytes;
+	_max_entry = max_entry;
+}
+
+// NUL cannot appear in a request target, so the parts never run together
+std::string CgiCache::makeKey(size_t server, const std::string& uri, const std::string& query) {
+	std::ostringstream key;
+	key << "GET" << '\0' << server << '\0' << uri << '?' << query;
+	return key.str();
+}
+
+//
+/* Entries */
+//
+
+void CgiCache::_evict(CgiCacheEntry* entry) {
+	_lru.erase(entry->lru);
+	_entries.erase(entry->key);
+	_bytes -= entry->size;
+	delete entry;
+}
+
+// Takes ownership; least recently used entries make room
+void CgiCache::_store(CgiCacheEntry* entry) {
+	std::map<std::string, CgiCacheEntry*>::iterator old = _entries.find(entry->key);
+	if (old != _entries.end())
+		_evict(old->second);
+	while (!_lru.empty() && _bytes + entry->size > _max_bytes)
+		_evict(_lru.back());
+	_lru.push_front(entry);
+	entry->lru = _lru.begin();
+	_entries[entry->key] = entry;
+	_bytes += entry->size;
+}
+
+void CgiCache::_storePass(const std::string& key, time_t ttl, time_t now) {
+	CgiCacheEntry* entry = new CgiCacheEntry();
+	entry->key = key;
+	entry->status = 0;
+	entry->stored = now;
+	entry->expires = now + ttl;
+	entry->pass = true;
+	entry->size = key.size();
+	_store(entry);
+}
+
+const CgiCacheEntry* CgiCache::lookup(const std::string& key, time_t now) {
+	std::map<std::string, CgiCacheEntry*>::iterator it = _entries.find(key);
+	if (it == _entries.end())
+		return NULL;
+	CgiCacheEntry* entry = it->second;
+	if (now >= entry->expires) {
+		_evict(entry);
+		return NULL;
+	}
+	_lru.splice(_lru.begin(), _lru, entry->lru);
+	return entry;
+}
+
+HttpResponse CgiCache::respond(const CgiCacheEntry& entry, time_t now) {
+	HttpResponse response(entry.status);
+	for (size_t i = 0; i < entry.headers.size(); ++i)
+		response.setHeader(entry.headers[i].first, entry.headers[i].second);
+	response.setBody(entry.body);
+	std::ostringstream age;
+	age << (now > entry.stored ? now - entry.stored : 0);
+	response.setHeader("Age", age.str());
+	return response;
+}
+
+//
+/* Fills */
+//
+
+CgiCacheFill* CgiCache::findFill(const std::string& key) {
+	std::map<std::string, CgiCacheFill*>::iterator it = _fills.find(key);
+	return it == _fills.end() ? NULL : it->second;
+}
+
+CgiCacheFill* CgiCache::startFill(const std::string& key, time_t default_ttl) {
+	CgiCacheFill* fill = new CgiCacheFill();
+	fill->key = key;
+	fill->default_ttl = default_ttl;
+	fill->status = 0;
+	fill->ttl = 0;
+	fill->has_headers = false;
+	_fills[key] = fill;
+	return fill;
+}
+
+static std::string lowercase(const std::string& value) {
+	std::string lower = value;
+	for (size_t i = 0; i < lower.size(); ++i)
+		lower[i] = std::tolower(static_cast<unsigned char>(lower[i]));
+	return lower;
+}
+
+void CgiCache::fillHeaders(CgiCacheFill* fill, const HttpResponse& response, time_t now) {
+	fill->has_headers = true;
+	fill->status = response.getStatusCode();
+	fill->ttl = freshness(response, fill->default_ttl, now);
+	if (!fill->ttl)
+		return;
+	// Framing and connection headers belong to each response sent
+	const std::vector<std::pair<std::string, std::string> >& headers = response.getHeaders();
+	for (size_t i = 0; i < headers.size(); ++i) {
+		std::string name = lowercase(headers[i].first);
+		if (name != "server" && name != "content-length" && name != "transfer-encoding" &&
+		    name != "connection" && name != "keep-alive")
+			fill->headers.push_back(headers[i]);
+	}
+}
+
+bool CgiCache::fillBody(CgiCacheFill* fill, const char* data, size_t len) {
+	if (!fill->ttl)
+		return false;
+	if (fill->body.size() + len > _max_entry) {
+		fill->ttl = 0;
+		std::string().swap(fill->body);
+		return false;
+	}
+	fill->body.append(data, len);
+	return true;
+}
+
+void CgiCache::finishFill(CgiCacheFill* fill, time_t now) {
+	_fills.erase(fill->key);
+	size_t size = fill->key.size() + fill->body.size();
+	for (size_t i = 0; i < fill->headers.size(); ++i)
+		size += fill->headers[i].first.size() + fill->headers[i].second.size();
+
+	if (fill->has_headers && fill->ttl > 0 && size <= _max_bytes) {
+		CgiCacheEntry* entry = new CgiCacheEntry();
+		entry->key = fill->key;
+		entry->status = fill->status;
+		entry->headers.swap(fill->headers);
+		entry->body = SharedBuffer(fill->body);
+		entry->stored = now;
+		entry->expires = now + fill->ttl;
+		entry->pass = false;
+		entry->size = size;
+		_store(entry);
+	} else if (fill->default_ttl > 0) {
+		// Not storable: the next requests run the script side by side
+		_storePass(fill->key, fill->default_ttl, now);
+	}
+	std::string().swap(fill->body);
+}
+
+void CgiCache::abortFill(CgiCacheFill* fill) {
+	_fills.erase(fill->key);
+}
+
+//
+/* Freshness */
+//
+
+time_t CgiCache::freshness(const HttpResponse& response, time_t default_ttl, time_t now) {
+	switch (response.getStatusCode()) {
+		case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 410:
+			break;
+		default:
+			return 0;
+	}
+
+	long max_age = -1;
+	long s_maxage = -1;
+	bool has_expires = false;
+	time_t expires = 0;
+	const std::vector<std::pair<std::string, std::string> >& headers = response.getHeaders();
+	for (size_t i = 0; i < headers.size(); ++i) {
+		std::string name = lowercase(headers[i].first);
+		if (name == "set-cookie")
+			return 0; // one client's session must not reach the others
+		if (name == "vary")
+			return 0; // the key holds no request headers to tell variants apart
+		if (name == "expires") {
+			// An unparseable date means already expired
+			has_expires = true;
+			if (!HttpDate::parse(headers[i].second, expires))
+				expires = 0;
+			continue;
+		}
+		if (name != "cache-control")
+			continue;
+		std::string value = lowercase(headers[i].second);
+		size_t start = 0;
+		while (start < value.size()) {
+			size_t end = value.find(',', start);
+			if (end == std::string::npos)
+				end = value.size();
+			size_t first = value.find_first_not_of(" \t", start);
+			size_t last = value.find_last_not_of(" \t", end - 1);
+			std::string directive = first < end && last >= first ? value.substr(first, last - first + 1) : "";
+			start = end + 1;
+			if (directive == "no-store" || directive == "no-cache" || directive == "private")
+				return 0;
+			if (directive.compare(0, 8, "max-age=") == 0)
+				max_age = std::strtol(directive.c_str() + 8, NULL, 10);
+			else if (directive.compare(0, 9, "s-maxage=") == 0)
+				s_maxage = std::strtol(directive.c_str() + 9, NULL, 10);
+		}
+	}
+
+	// A shared cache prefers s-maxage, then max-age, then Expires
+	if (s_maxage >= 0)
+		return static_cast<time_t>(s_maxage);
+	if (max_age >= 0)
+		return static_cast<time_t>(max_age);
+	if (has_expires)
+		return expires > now ? expires - now : 0;
+	return default_ttl;
+}
@@ -0,0 +1,142 @@
+#include "CgiProcess.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+
+CgiProcess::CgiProcess(int client_fd, time_t deadline)
+	: CgiStream(client_fd, deadline), _pid(-1), _stdin_fd(-1), _stdout_fd(-1),
+	  _input_offset(0), _exited(false), _status(0) {}
+
+CgiProcess::~CgiProcess() {
+	closeInput();
+	closeOutput();
+}
+
+static void closePipe(int fds[2]) {
+	if (fds[0] != -1) close(fds[0]);
+	if (fds[1] != -1) close(fds[1]);
+}
+
+// Absolute path so the script still resolves after the child's chdir()
+static std::string absolutePath(const std::string& path) {
+	char resolved[PATH_MAX];
+	if (realpath(path.c_str(), resolved) == NULL)
+		return path;
+	return resolved;
+}
+
+bool CgiProcess::start(const std::string& script_path, const std::string& interpreter,
+                       const std::vector<std::string>& env, const SharedBuffer& body) {
+	int stdin_pipe[2] = { -1, -1 };
+	int stdout_pipe[2] = { -1, -1 };
+	if (pipe(stdin_pipe) < 0 || pipe(stdout_pipe) < 0) {
+		closePipe(stdin_pipe);
+		closePipe(stdout_pipe);
+		return false;
+	}
+	// No other child inherits these; dup2() clears the flag on stdin/stdout
+	for (int i = 0; i < 2; ++i) {
+		fcntl(stdin_pipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(stdout_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	std::string script = absolutePath(script_path);
+	std::string program = interpreter.find('/') != std::string::npos ? absolutePath(interpreter) : interpreter;
+	size_t slash = script.find_last_of('/');
+	std::string directory = slash == std::string::npos ? "." : script.substr(0, slash + 1);
+
+	// Everything execve() needs is built before fork()
+	std::vector<char*> envp;
+	for (size_t i = 0; i < env.size(); ++i)
+		envp.push_back(const_cast<char*>(env[i].c_str()));
+	envp.push_back(NULL);
+
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(program.c_str()));
+	argv.push_back(const_cast<char*>(script.c_str()));
+	argv.push_back(NULL);
+
+	_pid = fork();
+	if (_pid < 0) {
+		closePipe(stdin_pipe);
+		closePipe(stdout_pipe);
+		return false;
+	}
+
+	if (_pid == 0) {
+		dup2(stdin_pipe[0], STDIN_FILENO);
+		dup2(stdout_pipe[1], STDOUT_FILENO);
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		// CGI scripts run in their own directory (relative path access)
+		if (chdir(directory.c_str()) == 0)
+			execve(program.c_str(), &argv[0], &envp[0]);
+		const char failure[] = "Status: 500\r\n\r\nCGI exec failed";
+		if (write(STDOUT_FILENO, failure, sizeof(failure) - 1) < 0) {}
+		_exit(1);
+	}
+
+	close(stdin_pipe[0]);
+	close(stdout_pipe[1]);
+	_stdin_fd = stdin_pipe[1];
+	_stdout_fd = stdout_pipe[0];
+	fcntl(_stdin_fd, F_SETFL, fcntl(_stdin_fd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(_stdout_fd, F_SETFL, fcntl(_stdout_fd, F_GETFL, 0) | O_NONBLOCK);
+
+	_input = body;
+	if (_input.empty())
+		closeInput();
+	return true;
+}
+
+bool CgiProcess::writeInput() {
+	while (_stdin_fd != -1 && _input_offset < _input.size()) {
+		ssize_t n = write(_stdin_fd, _input.data() + _input_offset, _input.size() - _input_offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			return false; // EPIPE: the script stopped reading
+		}
+		_input_offset += n;
+	}
+	return true;
+}
+
+ssize_t CgiProcess::readOutput(char* buf, size_t len) {
+	if (_stdout_fd == -1)
+		return 0;
+	ssize_t n;
+	do {
+		n = read(_stdout_fd, buf, len);
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+void CgiProcess::closeInput() {
+	if (_stdin_fd != -1) {
+		close(_stdin_fd);
+		_stdin_fd = -1;
+	}
+	_input.reset();
+}
+
+void CgiProcess::closeOutput() {
+	if (_stdout_fd != -1) {
+		close(_stdout_fd);
+		_stdout_fd = -1;
+	}
+}
+
+void CgiProcess::kill() {
+	if (_pid > 0 && !_exited)
+		::kill(_pid, SIGKILL);
+}
+
+bool CgiProcess::inputDone() const {
+	return _input_offset >= _input.size();
+}
@@ -0,0 +1,81 @@
+#include "CgiStream.hpp"
+#include "HttpResponse.hpp"
+#include <cctype>
+#include <cstdlib>
+
+#define CGI_MAX_HEADERS 8192
+
+CgiStream::CgiStream(int client_fd, time_t deadline)
+	: _client_fd(client_fd), _headers_done(false), _deadline(deadline),
+	  _chunked(false), _head_only(false), _keep_alive(false) {}
+
+static std::string trimValue(const std::string& value) {
+	size_t first = value.find_first_not_of(" \t");
+	if (first == std::string::npos)
+		return "";
+	size_t last = value.find_last_not_of(" \t\r");
+	return value.substr(first, last - first + 1);
+}
+
+int CgiStream::parseHeaders(const char* data, size_t len, HttpResponse& response, std::string& body) {
+	_header_buf.append(data, len);
+
+	// RFC 3875 says CRLF, many scripts print bare LF
+	size_t crlf = _header_buf.find("\r\n\r\n");
+	size_t lf = _header_buf.find("\n\n");
+	size_t end = crlf < lf ? crlf : lf;
+	if (end == std::string::npos)
+		return _header_buf.size() > CGI_MAX_HEADERS ? -1 : 0;
+	size_t body_start = end + (end == crlf ? 4 : 2);
+
+	bool has_status = false;
+	bool has_location = false;
+	response.setContentType("text/html");
+
+	size_t pos = 0;
+	while (pos < end) {
+		size_t eol = _header_buf.find('\n', pos);
+		if (eol == std::string::npos || eol > end)
+			eol = end;
+		std::string line = _header_buf.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty())
+			continue;
+
+		size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			return -1;
+		std::string name = line.substr(0, colon);
+		std::string value = trimValue(line.substr(colon + 1));
+		std::string lower = name;
+		for (size_t i = 0; i < lower.size(); ++i)
+			lower[i] = std::tolower(static_cast<unsigned char>(lower[i]));
+
+		if (lower == "status") {
+			int code = std::atoi(value.c_str());
+			if (code < 100 || code > 999)
+				return -1;
+			response.setStatusCode(code);
+			has_status = true;
+		} else if (lower == "content-type") {
+			response.setContentType(value);
+		} else if (lower == "content-length") {
+			response.setHeader("Content-Length", value);
+		} else if (lower == "location") {
+			response.setHeader("Location", value);
+			has_location = true;
+		} else if (lower != "connection" && lower != "keep-alive" && lower != "transfer-encoding") {
+			// Hop-by-hop headers are the server's business
+			response.setHeader(name, value);
+		}
+	}
+	if (has_location && !has_status)
+		response.setStatusCode(302);
+
+	body.assign(_header_buf, body_start, std::string::npos);
+	_header_buf.clear();
+	_headers_done = true;
+	return 1;
+}
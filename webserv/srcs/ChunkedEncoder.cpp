@@ -0,0 +1,61 @@
+#include "ChunkedEncoder.hpp"
+
+static const SharedBuffer& crlf() {
+    static const SharedBuffer buffer("\r\n", 2);
+    return buffer;
+}
+
+static const SharedBuffer& lastChunk() {
+    static const SharedBuffer buffer("0\r\n\r\n", 5);
+    return buffer;
+}
+
+std::string ChunkedEncoder::chunkHeader(size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[sizeof(size_t) * 2 + 2];
+    size_t pos = sizeof(buf);
+
+    buf[--pos] = '\n';
+    buf[--pos] = '\r';
+    do {
+        buf[--pos] = digits[length & 0xf];
+        length >>= 4;
+    } while (length > 0);
+    return std::string(buf + pos, sizeof(buf) - pos);
+}
+
+void ChunkedEncoder::appendChunk(OutputQueue& queue, const SharedBuffer& data) {
+    // A zero-size chunk would terminate the body
+    if (data.empty())
+        return;
+    queue.push(chunkHeader(data.size()));
+    queue.push(data);
+    queue.push(crlf());
+}
+
+void ChunkedEncoder::appendChunk(OutputQueue& queue, const OutputSegment& segment) {
+    if (segment.length == 0)
+        return;
+    queue.push(chunkHeader(segment.length));
+    queue.push(segment);
+    queue.push(crlf());
+}
+
+void ChunkedEncoder::appendChunk(OutputQueue& queue, const char* data, size_t length) {
+    if (length == 0)
+        return;
+    appendChunk(queue, SharedBuffer(data, length));
+}
+
+void ChunkedEncoder::appendLastChunk(OutputQueue& queue) {
+    queue.push(lastChunk());
+}
+
+std::string ChunkedEncoder::encode(const char* data, size_t length) {
+    if (length == 0)
+        return "";
+    std::string chunk = chunkHeader(length);
+    chunk.append(data, length);
+    chunk += "\r\n";
+    return chunk;
+}
@@ -1,10 +1,45 @@
 #include "Client.hpp"
 
-Client::Client() : _fd(-1), _last_activity(time(NULL)) {}
+Client::Client() : _fd(-1), _state(CONN_IDLE), _requests_served(0), _body_sink(NULL), _cgi(NULL),
+	_cache_fill(NULL), _cache_wait(NULL),
+	_listener(0), _server(NULL), _config(NULL), _read_window(READ_WINDOW_MIN), _read_pending(false),
+	_output_blocked(false),
+	_peer_addr(0), _request_start(0), _request_parsed(0), _flush_start(0), _response_status(0),
+	_response_bytes(0) {}
 
-Client::Client(int fd) : _fd(fd), _last_activity(time(NULL)) {}
 
-Client::~Client() {}
+Client::~Client() {
+	delete _body_sink;
+}
+
+void Client::attach(int fd) {
+	_fd = fd;
+	_timer.id = fd;
+	_state = CONN_IDLE;
+	_requests_served = 0;
+	_read_window = READ_WINDOW_MIN;
+	_read_pending = false;
+	_output_blocked = false;
+	_request_start = 0;
+	_request_parsed = 0;
+	_flush_start = 0;
+	_response_status = 0;
+	_response_bytes = 0;
+	_trace.clear();
+	_flushing_trace.clear();
+}
+
+void Client::recycle() {
+	setBodySink(NULL);
+	_request.reset();
+	_output.clear();
+	_cgi = NULL;
+	_cache_fill = NULL;
+	_cache_wait = NULL;
+	_server = NULL;
+	_config = NULL;
+	_fd = -1;
+}
 
 // Getters
 int Client::getFd() const {
@@ -19,16 +54,36 @@ const HttpRequest& Client::getRequest() const {
 	return _request;
 }
 
-time_t Client::getLastActivity() const {
-	return _last_activity;
-}
-
-// Activity tracking
-void Client::updateActivity() {
-	_last_activity = time(NULL);
+void Client::growReadWindow() {
+	if (_read_window < READ_WINDOW_MAX)
+		_read_window *= 2;
 }
 
 // Request management
 void Client::resetRequest() {
-	_request = HttpRequest();
+	if (_request.isComplete())
+		_requests_served++;
+
+	// Bytes of the next pipelined request stay in the buffer
+	_request.resetKeepingPipelined();
+	setBodySink(NULL);
+	_request_start = 0;
+	_request_parsed = 0;
+	_response_status = 0;
+	_response_bytes = 0;
+	_trace.clear();
+	bool pipelined = _request.hasBufferedData();
+	if (pipelined) {
+		setRequestStart(Logger::clockUs()); // already here
+		WS_TRACE_PARSE(_trace, _request.parse("", 0));
+	}
+	_state = pipelined ? CONN_READING : CONN_IDLE;
+}
+
+void Client::setBodySink(BodySink* sink) {
+	if (sink == _body_sink)
+		return;
+	delete _body_sink;
+	_body_sink = sink;
+	_request.setBodySink(sink);
 }
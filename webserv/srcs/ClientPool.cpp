@@ -0,0 +1,40 @@
+#include "ClientPool.hpp"
+#include "Client.hpp"
+
+ClientPool::ClientPool(size_t capacity) : _active(0) {
+	_slots.reserve(capacity);
+	_free.reserve(capacity);
+	for (size_t i = 0; i < capacity; ++i)
+		_slots.push_back(new Client());
+	// Hand out low slots first so their warmed-up buffers get reused
+	for (size_t i = capacity; i > 0; --i)
+		_free.push_back(_slots[i - 1]);
+	_by_fd.resize(capacity + 16, NULL);
+}
+
+ClientPool::~ClientPool() {
+	for (size_t i = 0; i < _slots.size(); ++i)
+		delete _slots[i];
+}
+
+Client* ClientPool::acquire(int fd) {
+	if (_free.empty() || fd < 0)
+		return NULL;
+	Client* client = _free.back();
+	_free.pop_back();
+	if (static_cast<size_t>(fd) >= _by_fd.size())
+		_by_fd.resize(fd + 1, NULL);
+	_by_fd[fd] = client;
+	client->attach(fd);
+	_active++;
+	return client;
+}
+
+void ClientPool::release(Client* client) {
+	int fd = client->getFd();
+	if (fd >= 0 && static_cast<size_t>(fd) < _by_fd.size())
+		_by_fd[fd] = NULL;
+	client->recycle();
+	_free.push_back(client);
+	_active--;
+}
@@ -1,10 +1,15 @@
 #include "Config.hpp"
+#include "HttpRequest.hpp"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <vector>
 #include <cstdlib>
+#include <cctype>
+#include <climits>
+#include <cerrno>
+#include <stdexcept>
 
 Config::Config() {}
 
@@ -12,7 +17,7 @@ Config::Config(const std::string& config_file) : _config_file(config_file) {}
 
 Config::~Config() {}
 
-bool Config::parse() {
+bool Config::parse(bool fallback) {
 	// If config file is specified, parse it
 	if (!_config_file.empty()) {
 		try {
@@ -20,6 +25,8 @@ bool Config::parse() {
 			return !_servers.empty();
 		} catch (const std::exception& e) {
 			std::cerr << "Config parse error: " << e.what() << std::endl;
+			if (!fallback)
+				return false;
 			// Fall back to default configuration
 		}
 	}
@@ -62,6 +69,7 @@ bool Config::parse() {
 	default_config.error_pages[404] = "./www/404.html";
 	default_config.error_pages[500] = "./www/500.html";
 
+	_compile(default_config);
 	_servers.push_back(default_config);
 
 	return true;
@@ -76,20 +84,53 @@ const ServerConfig& Config::getServerConfig(size_t index) const {
 }
 
 const LocationConfig* Config::findLocation(const std::string& uri, const ServerConfig& server) const {
-	const LocationConfig* best_match = NULL;
-	size_t best_match_len = 0;
+	int index = server.routes.match(uri);
+	return index >= 0 ? &server.locations[index] : NULL;
+}
 
-	for (size_t i = 0; i < server.locations.size(); ++i) {
-		const LocationConfig& loc = server.locations[i];
-		if (uri.find(loc.path) == 0) {
-			if (loc.path.length() > best_match_len) {
-				best_match = &loc;
-				best_match_len = loc.path.length();
-			}
-		}
+const ExtensionHandler* LocationConfig::findHandler(const std::string& uri) const {
+	if (handlers.empty())
+		return NULL;
+	size_t dot_pos = uri.find_last_of("./");
+	if (dot_pos == std::string::npos || uri[dot_pos] != '.')
+		return NULL;
+	size_t length = uri.size() - dot_pos;
+	for (size_t i = 0; i < handlers.size(); ++i) {
+		const std::string& extension = handlers[i].extension;
+		if (extension.size() == length && uri.compare(dot_pos, length, extension) == 0)
+			return &handlers[i];
 	}
+	return NULL;
+}
+
+// Precomputes what requests look up: the location trie, method masks and
+// extension handlers
+void Config::_compile(ServerConfig& config) {
+	config.routes.clear();
+	for (size_t i = 0; i < config.locations.size(); ++i) {
+		LocationConfig& location = config.locations[i];
+		config.routes.insert(location.path, static_cast<int>(i));
+
+		location.method_mask = 0;
+		for (size_t j = 0; j < location.methods.size(); ++j) {
+			const std::string& name = location.methods[j];
+			HttpMethod method = HttpRequest::methodFromToken(name.data(), name.size());
+			if (method != UNKNOWN)
+				location.method_mask |= 1u << method;
+		}
 
-	return best_match;
+		location.handlers.clear();
+		for (std::map<std::string, std::string>::const_iterator it = location.fastcgi_pass.begin();
+		     it != location.fastcgi_pass.end(); ++it) {
+			ExtensionHandler handler = { it->first, HANDLER_FASTCGI, it->second };
+			location.handlers.push_back(handler);
+		}
+		for (std::map<std::string, std::string>::const_iterator it = location.cgi_extensions.begin();
+		     it != location.cgi_extensions.end(); ++it) {
+			ExtensionHandler handler = { it->first, HANDLER_CGI, it->second };
+			location.handlers.push_back(handler);
+		}
+	}
 }
 
 // Extract server-level directives and location blocks
@@ -105,14 +146,53 @@ void Config::_parseServerBlock(const std::string& block, ServerConfig& config) {
 
 		if (line.find("listen") == 0)
 		{
+			// listen [host:]port [default_server] [backlog=N] [rcvbuf=size] [sndbuf=size]
+			//        [deferred[=seconds]] [fastopen=N] [nodelay=on|off];
 			std::vector<std::string> tokens = _split(line, ' ');
+			for (size_t j = 1; j < tokens.size(); ++j)
+			{
+				if (!tokens[j].empty() && tokens[j][tokens[j].length() - 1] == ';')
+					tokens[j] = tokens[j].substr(0, tokens[j].length() - 1);
+			}
 			if (tokens.size() >= 2)
 			{
 				std::string port_str = tokens[1];
-				if (port_str[port_str.length() - 1] == ';')
-					port_str = port_str.substr(0, port_str.length() - 1);
+				size_t colon = port_str.rfind(':');
+				if (colon != std::string::npos)
+				{
+					config.host = port_str.substr(0, colon);
+					port_str = port_str.substr(colon + 1);
+				}
 				config.port = std::atoi(port_str.c_str());
 			}
+			for (size_t j = 2; j < tokens.size(); ++j)
+			{
+				const std::string& option = tokens[j];
+				std::string value = option.find('=') != std::string::npos ? option.substr(option.find('=') + 1) : "";
+				ListenOptions& options = config.listen_options;
+				if (option == "default_server")
+				{
+					config.default_server = true;
+					continue;
+				}
+				if (option.compare(0, 8, "backlog=") == 0 && _parseSize(value) > 0)
+					options.backlog = _parseSize(value);
+				else if (option.compare(0, 7, "rcvbuf=") == 0)
+					options.rcvbuf = _parseSize(value);
+				else if (option.compare(0, 7, "sndbuf=") == 0)
+					options.sndbuf = _parseSize(value);
+				else if (option == "deferred")
+					options.defer_accept = 1;
+				else if (option.compare(0, 9, "deferred=") == 0)
+					options.defer_accept = _parseSize(value);
+				else if (option.compare(0, 9, "fastopen=") == 0)
+					options.fastopen = _parseSize(value);
+				else if (option.compare(0, 8, "nodelay=") == 0)
+					options.tcp_nodelay = value != "off";
+				else
+					continue;
+				config.has_listen_options = true;
+			}
 		}
 		else if (line.find("host") == 0)
 		{
@@ -126,12 +206,19 @@ void Config::_parseServerBlock(const std::string& block, ServerConfig& config) {
 		}
 		else if (line.find("server_name") == 0)
 		{
+			// server_name name...; names are compared case-insensitively
 			std::vector<std::string> tokens = _split(line, ' ');
-			if (tokens.size() >= 2)
+			for (size_t j = 1; j < tokens.size(); ++j)
 			{
-				config.server_name = tokens[1];
-				if (config.server_name[config.server_name.length() - 1] == ';')
-					config.server_name = config.server_name.substr(0, config.server_name.length() - 1);
+				std::string name = tokens[j];
+				if (!name.empty() && name[name.length() - 1] == ';')
+					name = name.substr(0, name.length() - 1);
+				if (name.empty())
+					continue;
+				if (config.server_names.empty())
+					config.server_name = name;
+				std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+				config.server_names.push_back(name);
 			}
 		}
 		else if (line.find("max_body_size") == 0 || line.find("client_max_body_size") == 0)
@@ -142,7 +229,194 @@ void Config::_parseServerBlock(const std::string& block, ServerConfig& config) {
 				std::string size_str = tokens[1];
 				if (size_str[size_str.length() - 1] == ';')
 					size_str = size_str.substr(0, size_str.length() - 1);
-				config.max_body_size = std::atoi(size_str.c_str());
+				config.max_body_size = _parseByteCount("client_max_body_size", size_str, MAX_BODY_SIZE_LIMIT);
+			}
+		}
+		else if (line.find("cgi_cache_size") == 0 || line.find("cgi_cache_max_entry") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string size_str = tokens[1];
+				if (size_str[size_str.length() - 1] == ';')
+					size_str = size_str.substr(0, size_str.length() - 1);
+				size_t value = _parseSize(size_str);
+				if (line.find("cgi_cache_size") == 0)
+					config.cgi_cache_size = value;
+				else
+					config.cgi_cache_max_entry = value;
+			}
+		}
+		else if (line.find("static_cache_size") == 0 || line.find("static_cache_max_file") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string size_str = tokens[1];
+				if (size_str[size_str.length() - 1] == ';')
+					size_str = size_str.substr(0, size_str.length() - 1);
+				size_t value = std::strtoul(size_str.c_str(), NULL, 10);
+				if (line.find("static_cache_size") == 0)
+					config.static_cache_size = value;
+				else
+					config.static_cache_max_file = value;
+			}
+		}
+		else if (line.find("keepalive_timeout") == 0 || line.find("keepalive_requests") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value_str = tokens[1];
+				if (value_str[value_str.length() - 1] == ';')
+					value_str = value_str.substr(0, value_str.length() - 1);
+				size_t value = std::strtoul(value_str.c_str(), NULL, 10);
+				if (line.find("keepalive_timeout") == 0)
+					config.keepalive_timeout = static_cast<time_t>(value);
+				else
+					config.keepalive_requests = value;
+			}
+		}
+		else if (line.find("client_header_timeout") == 0 || line.find("client_body_timeout") == 0 ||
+		         line.find("send_timeout") == 0 || line.find("cgi_timeout") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value_str = tokens[1];
+				if (value_str[value_str.length() - 1] == ';')
+					value_str = value_str.substr(0, value_str.length() - 1);
+				time_t value = static_cast<time_t>(std::strtoul(value_str.c_str(), NULL, 10));
+				if (value > 0 && line.find("client_header_timeout") == 0)
+					config.client_header_timeout = value;
+				else if (value > 0 && line.find("client_body_timeout") == 0)
+					config.client_body_timeout = value;
+				else if (value > 0 && line.find("send_timeout") == 0)
+					config.send_timeout = value;
+				else if (value > 0)
+					config.cgi_timeout = value;
+			}
+		}
+		else if (line.find("access_log_sample") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				size_t value = std::strtoul(tokens[1].c_str(), NULL, 10);
+				if (value > 0)
+					config.access_log_sample = value;
+			}
+		}
+		else if (line.find("access_log") == 0 || line.find("error_log") == 0)
+		{
+			// access_log <target> [combined|json];  error_log <target> [level];
+			// Words up to the ';', so a trailing comment is not taken for a format
+			std::vector<std::string> words = _split(line, ' ');
+			std::vector<std::string> tokens;
+			for (size_t j = 0; j < words.size(); ++j)
+			{
+				if (words[j].empty())
+					continue;
+				bool last = words[j][words[j].length() - 1] == ';';
+				tokens.push_back(last ? words[j].substr(0, words[j].length() - 1) : words[j]);
+				if (last)
+					break;
+			}
+			bool access = line.find("access_log") == 0;
+			if (tokens.size() >= 2)
+				(access ? config.access_log : config.error_log) = tokens[1];
+			if (tokens.size() >= 3)
+				(access ? config.access_log_format : config.error_log_level) = tokens[2];
+		}
+		else if (line.find("worker_processes") == 0)
+		{
+			// worker_processes N | auto;
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value = tokens[1];
+				if (value[value.length() - 1] == ';')
+					value = value.substr(0, value.length() - 1);
+				size_t count = std::strtoul(value.c_str(), NULL, 10);
+				if (value == "auto")
+					config.worker_processes = 0;
+				else if (count > 0)
+					config.worker_processes = count;
+			}
+		}
+		else if (line.find("max_connections") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value_str = tokens[1];
+				if (value_str[value_str.length() - 1] == ';')
+					value_str = value_str.substr(0, value_str.length() - 1);
+				size_t value = std::strtoul(value_str.c_str(), NULL, 10);
+				if (value > 0)
+					config.max_connections = value;
+			}
+		}
+		else if (line.find("limit_conn_per_ip") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value = tokens[1];
+				if (value[value.length() - 1] == ';')
+					value = value.substr(0, value.length() - 1);
+				config.limit_conn_per_ip = std::strtoul(value.c_str(), NULL, 10);
+			}
+		}
+		else if (line.find("limit_req") == 0)
+		{
+			// limit_req <N>r/s|<N>r/m [burst=N];
+			std::vector<std::string> tokens = _split(line, ' ');
+			for (size_t j = 1; j < tokens.size(); ++j)
+			{
+				std::string value = tokens[j];
+				bool last = value[value.length() - 1] == ';';
+				if (last)
+					value = value.substr(0, value.length() - 1);
+				if (value.compare(0, 6, "burst=") == 0)
+					config.limit_req_burst = std::strtoul(value.c_str() + 6, NULL, 10);
+				else if (j == 1)
+				{
+					char* end;
+					double rate = std::strtod(value.c_str(), &end);
+					if (std::string(end) == "r/m")
+						rate /= 60;
+					else if (std::string(end) != "r/s")
+						rate = 0; // unknown unit: no limit
+					config.limit_req_rate = rate > 0 ? rate : 0;
+				}
+				if (last)
+					break;
+			}
+		}
+		else if (line.find("server_timing") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value = tokens[1];
+				if (value[value.length() - 1] == ';')
+					value = value.substr(0, value.length() - 1);
+				config.server_timing = (value == "on");
+			}
+		}
+		else if (line.find("slow_request_threshold") == 0)
+		{
+			// slow_request_threshold <ms>;
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value = tokens[1];
+				if (value[value.length() - 1] == ';')
+					value = value.substr(0, value.length() - 1);
+				config.slow_request_threshold = std::strtol(value.c_str(), NULL, 10);
+				if (config.slow_request_threshold < 0)
+					config.slow_request_threshold = 0;
 			}
 		}
 		else if (line.find("error_page") == 0)
@@ -157,17 +431,31 @@ void Config::_parseServerBlock(const std::string& block, ServerConfig& config) {
 				config.error_pages[error_code] = error_path;
 			}
 		}
+		else if (line.find("types") == 0 && line.find('{') != std::string::npos)
+		{
+			// types { text/html html htm; ... }
+			std::string types_block;
+			if (!_nestedBlock(block, line, block_search_pos, types_block)) break;
+			std::vector<std::string> type_lines = _split(types_block, '\n');
+			std::string directives;
+			for (size_t j = 0; j < type_lines.size(); ++j)
+				directives += type_lines[j].substr(0, type_lines[j].find('#')) + " ";
+			std::vector<std::string> entries = _split(directives, ';');
+			for (size_t j = 0; j < entries.size(); ++j)
+			{
+				std::istringstream fields(entries[j]);
+				std::string type;
+				std::string extension;
+				if (!(fields >> type))
+					continue;
+				while (fields >> extension)
+					config.types.push_back(std::make_pair(extension, type));
+			}
+		}
 		else if (line.find("location") == 0)
 		{
-			// Find the opening brace for this location block starting from where
-			// we last finished (not from line index `i` which is wrong)
-			size_t start = block.find("{", block_search_pos);
-			if (start == std::string::npos) break;
-			size_t end = _findClosingBrace(block, start);
-			if (end == std::string::npos) break;
-			std::string loc_block = block.substr(start + 1, end - start - 1);
-			// Advance past this location block for the next iteration
-			block_search_pos = end + 1;
+			std::string loc_block;
+			if (!_nestedBlock(block, line, block_search_pos, loc_block)) break;
 
 			std::vector<std::string> tokens = _split(line, ' ');
 			LocationConfig location;
@@ -252,6 +540,119 @@ void Config::_parseLocationBlock(const std::string& block, LocationConfig& locat
 					location.redirect = location.redirect.substr(0, location.redirect.length() - 1);
 			}
 		}
+		else if (line.find("gzip_static") == 0 || line.find("gzip_min_length") == 0 ||
+		         line.find("gzip_comp_level") == 0 || line.find("gzip ") == 0)
+		{
+			// gzip on|off; gzip_static on|off; gzip_min_length size; gzip_comp_level 1-9;
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value = tokens[1];
+				if (value[value.length() - 1] == ';')
+					value = value.substr(0, value.length() - 1);
+				if (tokens[0] == "gzip_static")
+					location.gzip_static = (value == "on");
+				else if (tokens[0] == "gzip_min_length")
+					location.gzip_min_length = _parseSize(value);
+				else if (tokens[0] == "gzip_comp_level")
+				{
+					int level = std::atoi(value.c_str());
+					if (level >= 1 && level <= 9)
+						location.gzip_comp_level = level;
+				}
+				else
+					location.gzip = (value == "on");
+			}
+		}
+		else if (line.find("stub_status") == 0)
+		{
+			// stub_status [text|prometheus];
+			std::vector<std::string> tokens = _split(line, ' ');
+			std::string format = tokens.size() >= 2 ? tokens[1] : "text";
+			if (!format.empty() && format[format.length() - 1] == ';')
+				format = format.substr(0, format.length() - 1);
+			location.stub_status = format.empty() ? "text" : format;
+		}
+		else if (line.find("fastcgi_pass") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 3)
+			{
+				std::string extension = tokens[1];
+				std::string address = tokens[2];
+				if (address[address.length() - 1] == ';')
+					address = address.substr(0, address.length() - 1);
+				location.fastcgi_pass[extension] = address;
+			}
+		}
+		else if (line.find("cgi_cache_valid") == 0)
+		{
+			// cgi_cache_valid <seconds>; (0 = off)
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				long seconds = std::atol(tokens[1].c_str());
+				location.cgi_cache_valid = seconds > 0 ? static_cast<time_t>(seconds) : 0;
+			}
+		}
+		else if (line.find("fastcgi_connections") == 0)
+		{
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				size_t count = static_cast<size_t>(std::atol(tokens[1].c_str()));
+				if (count > 0)
+					location.fastcgi_connections = count;
+			}
+		}
+		else if (line.find("proxy_pass") == 0)
+		{
+			// proxy_pass http://host:port[/path] [http://host:port ...];
+			// The path of the first URL replaces the location prefix
+			std::vector<std::string> tokens = _split(line, ' ');
+			location.proxy_pass.clear();
+			location.proxy_uri.clear();
+			for (size_t j = 1; j < tokens.size(); ++j)
+			{
+				std::string address = tokens[j];
+				if (!address.empty() && address[address.length() - 1] == ';')
+					address = address.substr(0, address.length() - 1);
+				if (address.compare(0, 7, "http://") == 0)
+					address = address.substr(7);
+				size_t slash = address.find('/');
+				if (slash != std::string::npos)
+				{
+					if (location.proxy_pass.empty())
+						location.proxy_uri = address.substr(slash);
+					address = address.substr(0, slash);
+				}
+				if (!address.empty())
+					location.proxy_pass.push_back(address);
+			}
+		}
+		else if (line.find("proxy_") == 0)
+		{
+			// proxy_balance round_robin|least_conn; proxy_keepalive <idle connections>;
+			// proxy_max_fails <n>; proxy_fail_timeout <seconds>; proxy_timeout <seconds>;
+			std::vector<std::string> tokens = _split(line, ' ');
+			if (tokens.size() >= 2)
+			{
+				std::string value = tokens[1];
+				if (value[value.length() - 1] == ';')
+					value = value.substr(0, value.length() - 1);
+				long number = std::atol(value.c_str());
+				if (tokens[0] == "proxy_balance")
+					location.proxy_least_conn = (value == "least_conn");
+				else if (tokens[0] == "proxy_keepalive" && number >= 0)
+					location.proxy_keepalive = static_cast<size_t>(number);
+				else if (tokens[0] == "proxy_max_fails" && number >= 0)
+					location.proxy_max_fails = static_cast<size_t>(number);
+				else if (tokens[0] == "proxy_fail_timeout" && number > 0)
+					location.proxy_fail_timeout = static_cast<time_t>(number);
+				else if (tokens[0] == "proxy_timeout" && number > 0)
+					location.proxy_timeout = static_cast<time_t>(number);
+			}
+		}
 		else if (line.find("cgi") == 0)
 		{
 			std::vector<std::string> tokens = _split(line, ' ');
@@ -291,13 +692,39 @@ void Config::_parseConfigFile(const std::string& path){
 
 		std::string server_block = content.substr(block_start + 1, block_end - block_start - 1);
 		ServerConfig config;
+		config.index = _servers.size();
 		_parseServerBlock(server_block, config);
+		_compile(config);
 		_servers.push_back(config);
 
 		pos = block_end + 1;
 	}
 }
 
+bool Config::_nestedBlock(const std::string& block, const std::string& line, size_t& search_pos,
+                          std::string& body) const {
+	// Find the opening brace for this block starting from where we last
+	// finished (not from line index `i` which is wrong), on this very
+	// line: a commented-out block before it has braces too
+	size_t line_pos = block.find(line, search_pos);
+	while (line_pos != std::string::npos && line_pos > 0 &&
+	       block.find_last_not_of(" \t", line_pos - 1) != std::string::npos &&
+	       block[block.find_last_not_of(" \t", line_pos - 1)] != '\n')
+		line_pos = block.find(line, line_pos + 1);
+	if (line_pos != std::string::npos)
+		search_pos = line_pos;
+	size_t start = block.find("{", search_pos);
+	if (start == std::string::npos)
+		return false;
+	size_t end = _findClosingBrace(block, start);
+	if (end == std::string::npos)
+		return false;
+	body = block.substr(start + 1, end - start - 1);
+	// Advance past this block for the next one
+	search_pos = end + 1;
+	return true;
+}
+
 size_t Config::_findClosingBrace(const std::string& str, size_t start) const
 {
 	int depth = 1;
@@ -325,6 +752,41 @@ std::string Config::_trim(const std::string& str) const {
 	return str.substr(start, end - start);
 }
 
+int Config::_parseSize(const std::string& value) {
+	char* end;
+	long size = std::strtol(value.c_str(), &end, 10);
+	if (end == value.c_str() || size < 0)
+		return 0;
+	if (*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if (*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	else if (*end != '\0')
+		return 0;
+	return size > INT_MAX ? INT_MAX : static_cast<int>(size);
+}
+
+size_t Config::_parseByteCount(const std::string& directive, const std::string& value, size_t limit) {
+	const char* digits = value.c_str();
+	char* end;
+	errno = 0;
+	unsigned long count = std::strtoul(digits, &end, 10);
+	size_t scale = 1;
+	if (*end == 'k' || *end == 'K')
+		scale = 1024;
+	else if (*end == 'm' || *end == 'M')
+		scale = 1024 * 1024;
+	else if (*end == 'g' || *end == 'G')
+		scale = 1024 * 1024 * 1024;
+	if (scale > 1)
+		++end;
+	// strtoul() takes a sign and wraps negative numbers around
+	if (end == digits || *end != '\0' || !std::isdigit(static_cast<unsigned char>(digits[0])) ||
+	    errno == ERANGE || count > limit / scale)
+		throw std::runtime_error(directive + ": invalid or out of range size: " + value);
+	return static_cast<size_t>(count) * scale;
+}
+
 std::vector<std::string> Config::_split(const std::string& str, char delimiter) const {
 	std::vector<std::string> tokens;
 	std::istringstream stream(str);
@@ -0,0 +1,71 @@
+#include "ErrorPages.hpp"
+#include "HttpResponse.hpp"
+#include <fstream>
+#include <sstream>
+
+std::map<int, ErrorPage> ErrorPages::_pages;
+std::vector<std::map<int, ErrorPage> > ErrorPages::_overrides;
+size_t ErrorPages::_selected = 0;
+
+static const int standard_errors[] = {
+	400, 403, 404, 405, 408, 409, 413, 416, 417, 431, 500, 501, 502, 503, 504, 505, 507
+};
+
+ErrorPage ErrorPages::_render(const std::string& html) {
+	std::ostringstream headers;
+	headers << "Content-Type: text/html\r\n"
+	        << "Content-Length: " << html.size() << "\r\n"
+	        << "\r\n";
+	ErrorPage page;
+	page.header_block = SharedBuffer(headers.str());
+	page.body = SharedBuffer(html);
+	return page;
+}
+
+ErrorPage ErrorPages::_builtin(int code) {
+	std::ostringstream path;
+	path << ERROR_PAGES_DIR << "/" << code << ".html";
+	std::ifstream file(path.str().c_str());
+	if (file.is_open()) {
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		return _render(buffer.str());
+	}
+
+	std::ostringstream html;
+	html << "<html><body><h1>" << code << " " << HttpResponse::getStatusMessage(code)
+	     << "</h1></body></html>";
+	return _render(html.str());
+}
+
+void ErrorPages::reset() {
+	_overrides.clear();
+	_selected = 0;
+	_loadBundled();
+}
+
+void ErrorPages::_loadBundled() {
+	_pages.clear();
+	for (size_t i = 0; i < sizeof(standard_errors) / sizeof(standard_errors[0]); ++i)
+		_pages[standard_errors[i]] = _builtin(standard_errors[i]);
+}
+
+void ErrorPages::set(size_t set, int code, const std::string& html) {
+	if (set >= _overrides.size())
+		_overrides.resize(set + 1);
+	_overrides[set][code] = _render(html);
+}
+
+const ErrorPage& ErrorPages::get(int code) {
+	if (_selected < _overrides.size()) {
+		std::map<int, ErrorPage>::const_iterator custom = _overrides[_selected].find(code);
+		if (custom != _overrides[_selected].end())
+			return custom->second;
+	}
+	if (_pages.empty())
+		_loadBundled();
+	std::map<int, ErrorPage>::iterator it = _pages.find(code);
+	if (it == _pages.end())
+		it = _pages.insert(std::make_pair(code, _builtin(code))).first;
+	return it->second;
+}
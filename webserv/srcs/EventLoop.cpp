@@ -0,0 +1,290 @@
+#include "EventLoop.hpp"
+
+#include <unistd.h>
+
+#define EVENT_BATCH 1024
+#define EVENT_REGISTERED 0x80 // internal marker so an empty interest set stays registered
+
+//
+/* Common interest bookkeeping */
+//
+
+void EventLoop::_setInterest(int fd, unsigned int events) {
+	if (fd < 0) return;
+	if (static_cast<size_t>(fd) >= _interest.size())
+		_interest.resize(fd + 1, 0);
+	_interest[fd] = events | EVENT_REGISTERED;
+}
+
+void EventLoop::_clearInterest(int fd) {
+	if (fd >= 0 && static_cast<size_t>(fd) < _interest.size())
+		_interest[fd] = 0;
+}
+
+unsigned int EventLoop::interest(int fd) const {
+	if (fd < 0 || static_cast<size_t>(fd) >= _interest.size())
+		return 0;
+	return _interest[fd] & ~EVENT_REGISTERED;
+}
+
+bool EventLoop::isRegistered(int fd) const {
+	return fd >= 0 && static_cast<size_t>(fd) < _interest.size() && _interest[fd] != 0;
+}
+
+void EventLoop::setWriteInterest(int fd, bool enabled) {
+	if (!isRegistered(fd)) return;
+	unsigned int current = interest(fd);
+	unsigned int wanted = enabled ? (current | EVENT_WRITE) : (current & ~EVENT_WRITE);
+	if (wanted != current)
+		modify(fd, wanted);
+}
+
+void EventLoop::setReadInterest(int fd, bool enabled) {
+	if (!isRegistered(fd)) return;
+	unsigned int current = interest(fd);
+	unsigned int wanted = enabled ? (current | EVENT_READ) : (current & ~EVENT_READ);
+	if (wanted != current)
+		modify(fd, wanted);
+}
+
+EventLoop* EventLoop::create() {
+#if !defined(WEBSERV_EVENT_POLL)
+# if defined(__linux__)
+	EpollEventLoop* ep = new EpollEventLoop();
+	if (ep->isOpen()) return ep;
+	delete ep;
+# elif defined(WEBSERV_HAVE_KQUEUE)
+	KqueueEventLoop* kq = new KqueueEventLoop();
+	if (kq->isOpen()) return kq;
+	delete kq;
+# endif
+#endif
+	return new PollEventLoop();
+}
+
+//
+/* poll() fallback */
+//
+
+PollEventLoop::PollEventLoop() {}
+
+short PollEventLoop::_toPoll(unsigned int events) {
+	short mask = 0;
+	if (events & EVENT_READ) mask |= POLLIN;
+	if (events & EVENT_WRITE) mask |= POLLOUT;
+	return mask;
+}
+
+bool PollEventLoop::add(int fd, unsigned int events) {
+	if (fd < 0 || isRegistered(fd)) return false;
+	if (static_cast<size_t>(fd) >= _index.size())
+		_index.resize(fd + 1, -1);
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = _toPoll(events);
+	pfd.revents = 0;
+	_index[fd] = static_cast<int>(_fds.size());
+	_fds.push_back(pfd);
+	_setInterest(fd, events);
+	return true;
+}
+
+bool PollEventLoop::modify(int fd, unsigned int events) {
+	if (!isRegistered(fd)) return false;
+	_fds[_index[fd]].events = _toPoll(events);
+	_setInterest(fd, events);
+	return true;
+}
+
+void PollEventLoop::remove(int fd) {
+	if (!isRegistered(fd)) return;
+	// Swap the last entry into the hole so removal stays O(1)
+	int pos = _index[fd];
+	int last = static_cast<int>(_fds.size()) - 1;
+	if (pos != last) {
+		_fds[pos] = _fds[last];
+		_index[_fds[pos].fd] = pos;
+	}
+	_fds.pop_back();
+	_index[fd] = -1;
+	_clearInterest(fd);
+}
+
+int PollEventLoop::wait(std::vector<IoEvent>& events, int timeout_ms) {
+	events.clear();
+	if (_fds.empty()) {
+		usleep(timeout_ms * 1000);
+		return 0;
+	}
+
+	int ready = poll(&_fds[0], _fds.size(), timeout_ms);
+	if (ready <= 0) return ready;
+
+	for (size_t i = 0; i < _fds.size() && static_cast<int>(events.size()) < ready; ++i) {
+		short revents = _fds[i].revents;
+		if (revents == 0) continue;
+
+		IoEvent ev;
+		ev.fd = _fds[i].fd;
+		ev.events = 0;
+		if (revents & POLLIN) ev.events |= EVENT_READ;
+		if (revents & POLLOUT) ev.events |= EVENT_WRITE;
+		if (revents & (POLLERR | POLLHUP | POLLNVAL)) ev.events |= EVENT_ERROR;
+		events.push_back(ev);
+	}
+	return static_cast<int>(events.size());
+}
+
+//
+/* epoll (Linux) */
+//
+
+#if defined(__linux__)
+
+EpollEventLoop::EpollEventLoop() : _epfd(epoll_create1(EPOLL_CLOEXEC)), _buffer(EVENT_BATCH) {}
+
+EpollEventLoop::~EpollEventLoop() {
+	if (_epfd != -1)
+		close(_epfd);
+}
+
+unsigned int EpollEventLoop::_toEpoll(unsigned int events) {
+	unsigned int mask = 0;
+	if (events & EVENT_READ) mask |= EPOLLIN;
+	if (events & EVENT_WRITE) mask |= EPOLLOUT;
+	if (events & EVENT_EDGE) mask |= EPOLLET;
+	return mask;
+}
+
+bool EpollEventLoop::add(int fd, unsigned int events) {
+	if (fd < 0 || isRegistered(fd)) return false;
+	struct epoll_event ev;
+	ev.events = _toEpoll(events);
+	ev.data.u64 = 0;
+	ev.data.fd = fd;
+	if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return false;
+	_setInterest(fd, events);
+	return true;
+}
+
+bool EpollEventLoop::modify(int fd, unsigned int events) {
+	if (!isRegistered(fd)) return false;
+	struct epoll_event ev;
+	ev.events = _toEpoll(events);
+	ev.data.u64 = 0;
+	ev.data.fd = fd;
+	if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+		return false;
+	_setInterest(fd, events);
+	return true;
+}
+
+void EpollEventLoop::remove(int fd) {
+	if (!isRegistered(fd)) return;
+	struct epoll_event ev; // non-NULL for pre-2.6.9 kernels
+	epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, &ev);
+	_clearInterest(fd);
+}
+
+int EpollEventLoop::wait(std::vector<IoEvent>& events, int timeout_ms) {
+	events.clear();
+	int ready = epoll_wait(_epfd, &_buffer[0], static_cast<int>(_buffer.size()), timeout_ms);
+	if (ready <= 0) return ready;
+
+	for (int i = 0; i < ready; ++i) {
+		IoEvent ev;
+		ev.fd = _buffer[i].data.fd;
+		ev.events = 0;
+		if (_buffer[i].events & EPOLLIN) ev.events |= EVENT_READ;
+		if (_buffer[i].events & EPOLLOUT) ev.events |= EVENT_WRITE;
+		if (_buffer[i].events & (EPOLLERR | EPOLLHUP)) ev.events |= EVENT_ERROR;
+		events.push_back(ev);
+	}
+	return ready;
+}
+
+#endif
+
+//
+/* kqueue (BSD / macOS) */
+//
+
+#if defined(WEBSERV_HAVE_KQUEUE)
+
+KqueueEventLoop::KqueueEventLoop() : _kq(kqueue()), _buffer(EVENT_BATCH) {}
+
+KqueueEventLoop::~KqueueEventLoop() {
+	if (_kq != -1)
+		close(_kq);
+}
+
+// kqueue has one filter per direction: only submit the filters that changed
+bool KqueueEventLoop::_apply(int fd, unsigned int old_events, unsigned int new_events) {
+	struct kevent changes[2];
+	int n = 0;
+	unsigned short clear = (new_events & EVENT_EDGE) ? EV_CLEAR : 0;
+	bool edge_changed = (old_events & EVENT_EDGE) != (new_events & EVENT_EDGE);
+
+	if ((new_events & EVENT_READ) && (!(old_events & EVENT_READ) || edge_changed))
+		EV_SET(&changes[n++], fd, EVFILT_READ, EV_ADD | EV_ENABLE | clear, 0, 0, NULL);
+	else if (!(new_events & EVENT_READ) && (old_events & EVENT_READ))
+		EV_SET(&changes[n++], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+
+	if ((new_events & EVENT_WRITE) && (!(old_events & EVENT_WRITE) || edge_changed))
+		EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_ADD | EV_ENABLE | clear, 0, 0, NULL);
+	else if (!(new_events & EVENT_WRITE) && (old_events & EVENT_WRITE))
+		EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+
+	if (n == 0) return true;
+	return kevent(_kq, changes, n, NULL, 0, NULL) >= 0;
+}
+
+bool KqueueEventLoop::add(int fd, unsigned int events) {
+	if (fd < 0 || isRegistered(fd)) return false;
+	if (!_apply(fd, 0, events))
+		return false;
+	_setInterest(fd, events);
+	return true;
+}
+
+bool KqueueEventLoop::modify(int fd, unsigned int events) {
+	if (!isRegistered(fd)) return false;
+	if (!_apply(fd, interest(fd), events))
+		return false;
+	_setInterest(fd, events);
+	return true;
+}
+
+void KqueueEventLoop::remove(int fd) {
+	if (!isRegistered(fd)) return;
+	_apply(fd, interest(fd) & (EVENT_READ | EVENT_WRITE), 0);
+	_clearInterest(fd);
+}
+
+int KqueueEventLoop::wait(std::vector<IoEvent>& events, int timeout_ms) {
+	events.clear();
+	struct timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+	int ready = kevent(_kq, NULL, 0, &_buffer[0], static_cast<int>(_buffer.size()), &ts);
+	if (ready <= 0) return ready;
+
+	for (int i = 0; i < ready; ++i) {
+		IoEvent ev;
+		ev.fd = static_cast<int>(_buffer[i].ident);
+		ev.events = 0;
+		if (_buffer[i].flags & EV_ERROR)
+			ev.events |= EVENT_ERROR;
+		else if (_buffer[i].filter == EVFILT_READ)
+			ev.events |= EVENT_READ; // EOF surfaces as a 0-byte recv
+		else if (_buffer[i].filter == EVFILT_WRITE)
+			ev.events |= (_buffer[i].flags & EV_EOF) ? EVENT_ERROR : EVENT_WRITE;
+		events.push_back(ev);
+	}
+	return ready;
+}
+
+#endif
@@ -0,0 +1,612 @@
+#include "FastCgi.hpp"
+#include "Logger.hpp"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FCGI_VERSION_1 1
+#define FCGI_HEADER_LEN 8
+#define FCGI_MAX_CONTENT 65535
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+
+//
+/* Record encoding */
+//
+
+static std::string recordHeader(int type, unsigned short id, size_t length) {
+	char header[FCGI_HEADER_LEN];
+	header[0] = FCGI_VERSION_1;
+	header[1] = static_cast<char>(type);
+	header[2] = static_cast<char>((id >> 8) & 0xff);
+	header[3] = static_cast<char>(id & 0xff);
+	header[4] = static_cast<char>((length >> 8) & 0xff);
+	header[5] = static_cast<char>(length & 0xff);
+	header[6] = 0; // no padding
+	header[7] = 0;
+	return std::string(header, sizeof(header));
+}
+
+// Name-value lengths: one byte below 128, else four with the high bit set
+static void appendLength(std::string& out, size_t len) {
+	if (len < 128) {
+		out += static_cast<char>(len);
+		return;
+	}
+	out += static_cast<char>(((len >> 24) & 0x7f) | 0x80);
+	out += static_cast<char>((len >> 16) & 0xff);
+	out += static_cast<char>((len >> 8) & 0xff);
+	out += static_cast<char>(len & 0xff);
+}
+
+// "NAME=value" strings as FastCGI name-value pairs
+static std::string encodePairs(const std::vector<std::string>& env) {
+	std::string out;
+	for (size_t i = 0; i < env.size(); ++i) {
+		size_t eq = env[i].find('=');
+		if (eq == std::string::npos)
+			continue;
+		appendLength(out, eq);
+		appendLength(out, env[i].size() - eq - 1);
+		out.append(env[i], 0, eq);
+		out.append(env[i], eq + 1, std::string::npos);
+	}
+	return out;
+}
+
+static bool readLength(const unsigned char*& p, const unsigned char* end, size_t& len) {
+	if (p >= end)
+		return false;
+	if (!(*p & 0x80)) {
+		len = *p++;
+		return true;
+	}
+	if (end - p < 4)
+		return false;
+	len = (static_cast<size_t>(p[0] & 0x7f) << 24) | (static_cast<size_t>(p[1]) << 16) |
+	      (static_cast<size_t>(p[2]) << 8) | p[3];
+	p += 4;
+	return true;
+}
+
+static bool unixAddress(const std::string& path, FastCgiBackend* backend) {
+	struct sockaddr_un* un = reinterpret_cast<struct sockaddr_un*>(&backend->addr);
+	if (path.empty() || path.size() >= sizeof(un->sun_path))
+		return false;
+	std::memset(&backend->addr, 0, sizeof(backend->addr));
+	un->sun_family = AF_UNIX;
+	std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+	backend->addr_len = sizeof(struct sockaddr_un);
+	return true;
+}
+
+static bool inetAddress(const std::string& address, FastCgiBackend* backend) {
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+		return false;
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+
+	struct addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = NULL;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+		return false;
+	std::memcpy(&backend->addr, res->ai_addr, res->ai_addrlen);
+	backend->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return true;
+}
+
+//
+/* FastCgiRequest */
+//
+
+FastCgiRequest::FastCgiRequest(FastCgiBackend* backend, int client_fd, time_t deadline,
+                               const std::vector<std::string>& env, const SharedBuffer& body)
+	: CgiStream(client_fd, deadline), _backend(backend), _conn(NULL), _id(0),
+	  _params(encodePairs(env)), _body(body), _got_output(false), _retried(false), _ended(false) {}
+
+int FastCgiRequest::outputFd() const {
+	return _conn ? _conn->fd : -1;
+}
+
+const std::string& FastCgiRequest::address() const {
+	return _backend->address;
+}
+
+//
+/* Pool setup */
+//
+
+FastCgiPool::FastCgiPool(EventLoop* loop) : _loop(loop) {}
+
+FastCgiPool::~FastCgiPool() {
+	_purge();
+	for (std::map<std::string, FastCgiBackend*>::iterator it = _backends.begin(); it != _backends.end(); ++it) {
+		FastCgiBackend* backend = it->second;
+		for (size_t i = 0; i < backend->connections.size(); ++i) {
+			FastCgiConnection* conn = backend->connections[i];
+			_loop->remove(conn->fd);
+			close(conn->fd);
+			for (std::map<unsigned short, FastCgiRequest*>::iterator r = conn->requests.begin(); r != conn->requests.end(); ++r)
+				delete r->second;
+			delete conn;
+		}
+		for (size_t i = 0; i < backend->waiting.size(); ++i)
+			delete backend->waiting[i];
+		for (size_t i = 0; i < backend->workers.size(); ++i) {
+			::kill(backend->workers[i], SIGKILL);
+			waitpid(backend->workers[i], NULL, 0);
+		}
+		if (backend->listen_fd != -1) {
+			close(backend->listen_fd);
+			unlink(backend->socket_path.c_str());
+		}
+		delete backend;
+	}
+}
+
+bool FastCgiPool::addBackend(const std::string& address, size_t connections) {
+	std::map<std::string, FastCgiBackend*>::iterator it = _backends.find(address);
+	if (it != _backends.end()) {
+		// Shared by several locations: the largest pool wins (spawned workers stay as started)
+		if (it->second->program.empty())
+			it->second->max_connections = std::max(it->second->max_connections, connections);
+		return true;
+	}
+
+	FastCgiBackend* backend = new FastCgiBackend();
+	backend->address = address;
+	backend->max_connections = connections > 0 ? connections : 1;
+
+	bool ok;
+	if (address.compare(0, 5, "unix:") == 0) {
+		ok = unixAddress(address.substr(5), backend);
+	} else if (address.compare(0, 6, "spawn:") == 0) {
+		std::ostringstream path;
+		path << "/tmp/webserv-fcgi-" << getpid() << "-" << _backends.size() << ".sock";
+		backend->program = address.substr(6);
+		backend->socket_path = path.str();
+		ok = !backend->program.empty() && unixAddress(backend->socket_path, backend) && _spawnWorkers(backend);
+	} else {
+		ok = inetAddress(address, backend);
+	}
+
+	if (!ok) {
+		if (backend->listen_fd != -1) {
+			close(backend->listen_fd);
+			unlink(backend->socket_path.c_str());
+		}
+		delete backend;
+		return false;
+	}
+	_backends[address] = backend;
+	return true;
+}
+
+// Workers inherit the listen socket as fd 0 (FCGI_LISTENSOCK_FILENO) and
+// accept on it themselves; the server connects to it like any other backend
+bool FastCgiPool::_spawnWorkers(FastCgiBackend* backend) {
+	if (backend->listen_fd == -1) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return false;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		unlink(backend->socket_path.c_str());
+		if (bind(fd, reinterpret_cast<struct sockaddr*>(&backend->addr), backend->addr_len) < 0 ||
+		    listen(fd, SOMAXCONN) < 0) {
+			close(fd);
+			return false;
+		}
+		backend->listen_fd = fd;
+	}
+
+	while (backend->workers.size() < backend->max_connections) {
+		pid_t pid = fork();
+		if (pid < 0)
+			return !backend->workers.empty();
+		if (pid == 0) {
+			dup2(backend->listen_fd, STDIN_FILENO);
+			signal(SIGPIPE, SIG_DFL);
+			signal(SIGCHLD, SIG_DFL);
+			char* argv[2];
+			argv[0] = const_cast<char*>(backend->program.c_str());
+			argv[1] = NULL;
+			execv(argv[0], argv);
+			_exit(127);
+		}
+		backend->workers.push_back(pid);
+	}
+	return true;
+}
+
+bool FastCgiPool::workerExited(pid_t pid) {
+	for (std::map<std::string, FastCgiBackend*>::iterator it = _backends.begin(); it != _backends.end(); ++it) {
+		std::vector<pid_t>& workers = it->second->workers;
+		std::vector<pid_t>::iterator w = std::find(workers.begin(), workers.end(), pid);
+		if (w != workers.end()) {
+			WS_WARN("FastCGI worker " << pid << " exited (" << it->first << ")");
+			workers.erase(w);
+			return true;
+		}
+	}
+	return false;
+}
+
+void FastCgiPool::tick(time_t now, std::vector<FastCgiRequest*>& expired) {
+	_purge();
+	for (std::map<std::string, FastCgiBackend*>::iterator it = _backends.begin(); it != _backends.end(); ++it) {
+		FastCgiBackend* backend = it->second;
+		// Respawn crashed workers, at most once per delay so a broken app can't fork-loop
+		if (!backend->program.empty() && backend->workers.size() < backend->max_connections &&
+		    now >= backend->next_spawn) {
+			_spawnWorkers(backend);
+			backend->next_spawn = now + FCGI_RESPAWN_DELAY;
+		}
+
+		for (size_t i = 0; i < backend->waiting.size(); ++i) {
+			if (now >= backend->waiting[i]->deadline())
+				expired.push_back(backend->waiting[i]);
+		}
+		for (size_t i = 0; i < backend->connections.size(); ++i) {
+			std::map<unsigned short, FastCgiRequest*>& requests = backend->connections[i]->requests;
+			for (std::map<unsigned short, FastCgiRequest*>::iterator r = requests.begin(); r != requests.end(); ++r) {
+				if (r->second && now >= r->second->deadline())
+					expired.push_back(r->second);
+			}
+		}
+	}
+}
+
+void FastCgiPool::_purge() {
+	for (size_t i = 0; i < _released.size(); ++i)
+		delete _released[i];
+	_released.clear();
+}
+
+//
+/* Connections */
+//
+
+FastCgiConnection* FastCgiPool::_connect(FastCgiBackend* backend) {
+	int fd = socket(backend->addr.ss_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return NULL;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	int rc = connect(fd, reinterpret_cast<struct sockaddr*>(&backend->addr), backend->addr_len);
+	if (rc < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return NULL;
+	}
+
+	FastCgiConnection* conn = new FastCgiConnection();
+	conn->fd = fd;
+	conn->backend = backend;
+	conn->connected = rc == 0;
+	// Level-triggered; write interest is dropped once connected and flushed
+	_loop->add(fd, EVENT_READ | EVENT_WRITE);
+	_connections[fd] = conn;
+	backend->connections.push_back(conn);
+
+	// Ask once whether the application multiplexes connections
+	if (!backend->probed) {
+		backend->probed = true;
+		std::vector<std::string> names;
+		names.push_back("FCGI_MPXS_CONNS=");
+		names.push_back("FCGI_MAX_REQS=");
+		SharedBuffer query(encodePairs(names));
+		_queueRecord(conn, FCGI_GET_VALUES, 0, query, 0, query.size());
+	}
+	return conn;
+}
+
+size_t FastCgiPool::_capacity(const FastCgiBackend* backend) const {
+	if (!backend->multiplexed)
+		return 1;
+	size_t cap = FCGI_MAX_MULTIPLEX;
+	if (backend->max_requests > 0 && backend->max_requests < cap)
+		cap = backend->max_requests;
+	return cap;
+}
+
+// Hands waiting requests to connections with room, opening new ones up to the limit
+void FastCgiPool::_assign(FastCgiBackend* backend, std::vector<FastCgiEvent>& events) {
+	while (!backend->waiting.empty()) {
+		FastCgiConnection* conn = NULL;
+		for (size_t i = 0; i < backend->connections.size() && !conn; ++i) {
+			if (backend->connections[i]->requests.size() < _capacity(backend))
+				conn = backend->connections[i];
+		}
+		if (!conn && backend->connections.size() < backend->max_connections)
+			conn = _connect(backend);
+		if (!conn)
+			break;
+		FastCgiRequest* request = backend->waiting.front();
+		backend->waiting.pop_front();
+		_begin(conn, request);
+	}
+
+	// Backend unreachable: nothing would ever pick these up
+	if (backend->connections.empty()) {
+		while (!backend->waiting.empty()) {
+			FastCgiEvent ev;
+			ev.request = backend->waiting.front();
+			ev.type = FCGI_EVENT_ERROR;
+			events.push_back(ev);
+			backend->waiting.pop_front();
+		}
+	}
+}
+
+void FastCgiPool::_queueRecord(FastCgiConnection* conn, int type, unsigned short id,
+                               const SharedBuffer& content, size_t offset, size_t length) {
+	// An empty record (length 0) ends a stream
+	do {
+		size_t n = length > FCGI_MAX_CONTENT ? FCGI_MAX_CONTENT : length;
+		conn->output.push(recordHeader(type, id, n));
+		conn->output.push(content, offset, n);
+		offset += n;
+		length -= n;
+	} while (length > 0);
+}
+
+void FastCgiPool::_begin(FastCgiConnection* conn, FastCgiRequest* request) {
+	unsigned short id = 1;
+	if (conn->backend->multiplexed) {
+		id = conn->next_id;
+		while (id == 0 || conn->requests.find(id) != conn->requests.end())
+			++id;
+		conn->next_id = static_cast<unsigned short>(id + 1);
+	}
+	conn->requests[id] = request;
+	request->_conn = conn;
+	request->_id = id;
+
+	static const char begin[FCGI_HEADER_LEN] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+	_queueRecord(conn, FCGI_BEGIN_REQUEST, id, SharedBuffer(begin, sizeof(begin)), 0, sizeof(begin));
+	if (!request->_params.empty())
+		_queueRecord(conn, FCGI_PARAMS, id, request->_params, 0, request->_params.size());
+	_queueRecord(conn, FCGI_PARAMS, id, SharedBuffer(), 0, 0);
+	// The body goes out as slices of the shared buffer, never copied
+	if (!request->_body.empty())
+		_queueRecord(conn, FCGI_STDIN, id, request->_body, 0, request->_body.size());
+	_queueRecord(conn, FCGI_STDIN, id, SharedBuffer(), 0, 0);
+
+	_loop->setReadInterest(conn->fd, true);
+	_loop->setWriteInterest(conn->fd, true);
+}
+
+// Requests without output on a reused connection are retried once (the
+// backend may have closed it while idle); anything else fails
+void FastCgiPool::_closeConnection(FastCgiConnection* conn, std::vector<FastCgiEvent>& events) {
+	FastCgiBackend* backend = conn->backend;
+	_loop->remove(conn->fd);
+	close(conn->fd);
+	_connections.erase(conn->fd);
+	backend->connections.erase(std::find(backend->connections.begin(), backend->connections.end(), conn));
+
+	for (std::map<unsigned short, FastCgiRequest*>::iterator it = conn->requests.begin(); it != conn->requests.end(); ++it) {
+		FastCgiRequest* request = it->second;
+		if (!request)
+			continue;
+		request->_conn = NULL;
+		if (conn->served > 0 && !request->_got_output && !request->_retried) {
+			request->_retried = true;
+			backend->waiting.push_front(request);
+		} else {
+			FastCgiEvent ev;
+			ev.request = request;
+			ev.type = FCGI_EVENT_ERROR;
+			events.push_back(ev);
+		}
+	}
+	delete conn;
+
+	if (!backend->waiting.empty())
+		_assign(backend, events);
+}
+
+//
+/* Requests */
+//
+
+FastCgiRequest* FastCgiPool::submit(const std::string& address, int client_fd, time_t deadline,
+                                    const std::vector<std::string>& env, const SharedBuffer& body) {
+	std::map<std::string, FastCgiBackend*>::iterator it = _backends.find(address);
+	if (it == _backends.end())
+		return NULL;
+	FastCgiBackend* backend = it->second;
+	if (backend->connections.empty() && !_connect(backend))
+		return NULL;
+
+	FastCgiRequest* request = new FastCgiRequest(backend, client_fd, deadline, env, body);
+	backend->waiting.push_back(request);
+	_assign(backend, _deferred); // a connection exists, so nothing fails here
+	return request;
+}
+
+void FastCgiPool::release(FastCgiRequest* request) {
+	FastCgiBackend* backend = request->_backend;
+	FastCgiConnection* conn = request->_conn;
+	request->detach();
+	request->_conn = NULL;
+
+	if (conn && !request->_ended) {
+		if (backend->multiplexed) {
+			// Keep the id reserved until the application confirms with END_REQUEST
+			conn->requests[request->_id] = NULL;
+			_queueRecord(conn, FCGI_ABORT_REQUEST, request->_id, SharedBuffer(), 0, 0);
+			_loop->setWriteInterest(conn->fd, true);
+			_loop->setReadInterest(conn->fd, true);
+		} else {
+			// An abort would hold the connection until the script ends: drop it
+			conn->requests.erase(request->_id);
+			_closeConnection(conn, _deferred);
+		}
+	} else if (!conn) {
+		std::deque<FastCgiRequest*>::iterator w = std::find(backend->waiting.begin(), backend->waiting.end(), request);
+		if (w != backend->waiting.end())
+			backend->waiting.erase(w);
+	}
+
+	for (size_t i = 0; i < _deferred.size(); ) {
+		if (_deferred[i].request == request)
+			_deferred.erase(_deferred.begin() + i);
+		else
+			++i;
+	}
+	_released.push_back(request);
+}
+
+void FastCgiPool::takeEvents(std::vector<FastCgiEvent>& out) {
+	out.insert(out.end(), _deferred.begin(), _deferred.end());
+	_deferred.clear();
+}
+
+//
+/* Event handling */
+//
+
+void FastCgiPool::handleEvent(int fd, unsigned int events, std::vector<FastCgiEvent>& out) {
+	_purge();
+	takeEvents(out);
+	std::map<int, FastCgiConnection*>::iterator it = _connections.find(fd);
+	if (it == _connections.end())
+		return;
+	FastCgiConnection* conn = it->second;
+
+	if (!conn->connected) {
+		if (!(events & (EVENT_WRITE | EVENT_ERROR)))
+			return;
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			_closeConnection(conn, out);
+			return;
+		}
+		conn->connected = true;
+	}
+
+	if (events & EVENT_WRITE) {
+		FlushResult result = conn->output.flush(fd);
+		if (result == FLUSH_ERROR) {
+			_closeConnection(conn, out);
+			return;
+		}
+		if (result == FLUSH_DONE)
+			_loop->setWriteInterest(fd, false);
+	}
+
+	if ((events & (EVENT_READ | EVENT_ERROR)) && !_readRecords(conn, out))
+		_closeConnection(conn, out);
+}
+
+// Reads once and handles every complete record; false when the connection is done
+bool FastCgiPool::_readRecords(FastCgiConnection* conn, std::vector<FastCgiEvent>& events) {
+	char buffer[FCGI_MAX_CONTENT + 1];
+	ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	if (n == 0)
+		return false;
+
+	// Parse straight from the read buffer unless a partial record is pending
+	const char* data = buffer;
+	size_t size = static_cast<size_t>(n);
+	if (!conn->input.empty()) {
+		conn->input.append(buffer, n);
+		data = conn->input.data();
+		size = conn->input.size();
+	}
+
+	size_t pos = 0;
+	while (size - pos >= FCGI_HEADER_LEN) {
+		const unsigned char* h = reinterpret_cast<const unsigned char*>(data + pos);
+		if (h[0] != FCGI_VERSION_1)
+			return false;
+		size_t length = (static_cast<size_t>(h[4]) << 8) | h[5];
+		size_t total = FCGI_HEADER_LEN + length + h[6];
+		if (size - pos < total)
+			break;
+		unsigned short id = static_cast<unsigned short>((h[2] << 8) | h[3]);
+		_handleRecord(conn, h[1], id, data + pos + FCGI_HEADER_LEN, length, events);
+		pos += total;
+	}
+
+	std::string rest(data + pos, size - pos);
+	conn->input.swap(rest);
+	return true;
+}
+
+void FastCgiPool::_handleRecord(FastCgiConnection* conn, int type, unsigned short id,
+                                const char* content, size_t length, std::vector<FastCgiEvent>& events) {
+	FastCgiBackend* backend = conn->backend;
+
+	if (type == FCGI_GET_VALUES_RESULT) {
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(content);
+		const unsigned char* end = p + length;
+		size_t name_len, value_len;
+		while (readLength(p, end, name_len) && readLength(p, end, value_len) &&
+		       static_cast<size_t>(end - p) >= name_len + value_len) {
+			std::string name(reinterpret_cast<const char*>(p), name_len);
+			std::string value(reinterpret_cast<const char*>(p) + name_len, value_len);
+			p += name_len + value_len;
+			if (name == "FCGI_MPXS_CONNS")
+				backend->multiplexed = value == "1";
+			else if (name == "FCGI_MAX_REQS")
+				backend->max_requests = static_cast<size_t>(std::atol(value.c_str()));
+		}
+		_assign(backend, events);
+		return;
+	}
+
+	std::map<unsigned short, FastCgiRequest*>::iterator it = conn->requests.find(id);
+	if (it == conn->requests.end())
+		return; // unknown id or management record
+	FastCgiRequest* request = it->second;
+
+	if (type == FCGI_STDOUT) {
+		if (request && length > 0) {
+			request->_got_output = true;
+			FastCgiEvent ev;
+			ev.request = request;
+			ev.type = FCGI_EVENT_OUTPUT;
+			ev.data = SharedBuffer(content, length);
+			events.push_back(ev);
+		}
+	} else if (type == FCGI_STDERR) {
+		if (length > 0) {
+			std::string message(content, length);
+			while (!message.empty() && (message[message.size() - 1] == '\n' || message[message.size() - 1] == '\r'))
+				message.erase(message.size() - 1);
+			WS_WARN("FastCGI (" << backend->address << "): " << message);
+		}
+	} else if (type == FCGI_END_REQUEST) {
+		conn->requests.erase(it);
+		conn->served++;
+		if (request) {
+			request->_ended = true;
+			request->_conn = NULL;
+			FastCgiEvent ev;
+			ev.request = request;
+			ev.type = FCGI_EVENT_END;
+			events.push_back(ev);
+		}
+		// A paused request may have held reads back; the next one starts fresh
+		_loop->setReadInterest(conn->fd, true);
+		_assign(backend, events);
+	}
+}
@@ -0,0 +1,181 @@
+#include "FileSink.hpp"
+#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static unsigned long temp_counter = 0;
+
+// Status for a failed file operation: the client named a path that cannot
+// hold a file (409), may not write there (403), or the disk is full (507)
+static int statusForErrno(int err) {
+    switch (err) {
+        case ENOENT:
+        case ENOTDIR:
+        case EISDIR:
+        case EEXIST:
+            return 409;
+        case EACCES:
+        case EPERM:
+        case EROFS:
+            return 403;
+        case ENOSPC:
+#ifdef EDQUOT
+        case EDQUOT:
+#endif
+        case EFBIG:
+            return 507;
+        default:
+            return 500;
+    }
+}
+
+FileSink::FileSink(const std::string& target_path, bool replace_existing)
+    : target(target_path), replace(replace_existing), existed(false), fd(-1),
+      buffered(0), written(0), reserved(0), error_code(500) {}
+
+FileSink::~FileSink() {
+    if (fd >= 0)
+        close(fd);
+    if (!temp_path.empty())
+        unlink(temp_path.c_str());
+}
+
+bool FileSink::fail(int code) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (!temp_path.empty()) {
+        unlink(temp_path.c_str());
+        temp_path.clear();
+    }
+    error_code = code;
+    return false;
+}
+
+bool FileSink::open(size_t expected) {
+    struct stat st;
+    if (stat(target.c_str(), &st) == 0) {
+        if (S_ISDIR(st.st_mode))
+            return fail(409);
+        if (!replace)
+            return fail(409); // never clobbered: pick another name
+        existed = true;
+    }
+
+    size_t slash = target.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "" : target.substr(0, slash + 1);
+    for (int attempt = 0; attempt < 16; ++attempt) {
+        std::ostringstream name;
+        name << directory << ".upload-" << getpid() << "-" << temp_counter++ << ".part";
+        temp_path = name.str();
+        fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0)
+            break;
+        if (errno != EEXIST) {
+            int err = errno;
+            temp_path.clear();
+            return fail(statusForErrno(err));
+        }
+    }
+    if (fd < 0) {
+        temp_path.clear();
+        return fail(500);
+    }
+
+#if defined(__linux__)
+    // Reserve the blocks now: a full disk fails before the body is read,
+    // and the file is laid out in one piece instead of growing per write.
+    // Capped, so a client declaring a huge length cannot pin disk it
+    // never sends.
+    if (expected > FILE_SINK_MAX_RESERVE)
+        expected = FILE_SINK_MAX_RESERVE;
+    if (expected > 0) {
+        if (fallocate(fd, 0, 0, static_cast<off_t>(expected)) == 0)
+            reserved = static_cast<off_t>(expected);
+        else if (errno != EOPNOTSUPP && errno != ENOSYS)
+            return fail(statusForErrno(errno));
+    }
+#else
+    (void)expected;
+#endif
+    return true;
+}
+
+bool FileSink::flush(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return fail(statusForErrno(errno));
+        }
+        data += n;
+        len -= n;
+        written += n;
+    }
+    return true;
+}
+
+bool FileSink::write(const char* data, size_t len) {
+    if (fd < 0)
+        return false;
+
+    // Top up the chunk being gathered first
+    if (buffered > 0) {
+        size_t room = FILE_SINK_CHUNK - buffered;
+        size_t take = len < room ? len : room;
+        std::memcpy(&buffer[buffered], data, take);
+        buffered += take;
+        data += take;
+        len -= take;
+        if (buffered < FILE_SINK_CHUNK)
+            return true;
+        buffered = 0;
+        if (!flush(&buffer[0], FILE_SINK_CHUNK))
+            return false;
+    }
+
+    // Whole chunks need no copy, the tail waits for more data
+    size_t direct = len - len % FILE_SINK_CHUNK;
+    if (direct > 0 && !flush(data, direct))
+        return false;
+    if (len > direct) {
+        if (buffer.empty())
+            buffer.resize(FILE_SINK_CHUNK);
+        std::memcpy(&buffer[0], data + direct, len - direct);
+        buffered = len - direct;
+    }
+    return true;
+}
+
+bool FileSink::finish() {
+    if (fd < 0)
+        return false;
+    if (buffered > 0) {
+        size_t pending = buffered;
+        buffered = 0;
+        if (!flush(&buffer[0], pending))
+            return false;
+    }
+    // A chunked body may stop short of what was reserved
+    if (reserved > written && ftruncate(fd, written) != 0)
+        return fail(statusForErrno(errno));
+
+    int rc = close(fd);
+    fd = -1;
+    if (rc != 0)
+        return fail(statusForErrno(errno));
+    if (replace)
+        rc = std::rename(temp_path.c_str(), target.c_str());
+    else if ((rc = link(temp_path.c_str(), target.c_str())) == 0)
+        unlink(temp_path.c_str());
+    if (rc != 0)
+        return fail(statusForErrno(errno));
+    temp_path.clear();
+    return true;
+}
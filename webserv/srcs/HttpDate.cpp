@@ -0,0 +1,82 @@
+#include "HttpDate.hpp"
+#include <cstdio>
+#include <cstring>
+
+static const char* const g_days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char* const g_months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+std::string HttpDate::format(time_t t) {
+	struct tm gmt;
+	gmtime_r(&t, &gmt);
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+	         g_days[gmt.tm_wday], gmt.tm_mday, g_months[gmt.tm_mon],
+	         gmt.tm_year + 1900, gmt.tm_hour, gmt.tm_min, gmt.tm_sec);
+	return buf;
+}
+
+static time_t g_now = 0;
+static std::string g_now_formatted;
+
+const std::string& HttpDate::now() {
+	if (g_now == 0)
+		tick(time(NULL));
+	return g_now_formatted;
+}
+
+void HttpDate::tick(time_t t) {
+	if (t == g_now)
+		return;
+	g_now = t;
+	g_now_formatted = format(t);
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (no timegm() in C++98)
+static long daysFromCivil(long y, int m, int d) {
+	y -= m <= 2;
+	long era = (y >= 0 ? y : y - 399) / 400;
+	long yoe = y - era * 400;
+	long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static int monthIndex(const char* name) {
+	for (int i = 0; i < 12; ++i) {
+		if (strncmp(name, g_months[i], 3) == 0)
+			return i;
+	}
+	return -1;
+}
+
+bool HttpDate::parse(const std::string& value, time_t& out) {
+	char month[4] = { 0 };
+	int day = 0, year = 0, hour = 0, min = 0, sec = 0;
+	const char* s = value.c_str();
+
+	// Skip the day name, which we don't need
+	const char* comma = strchr(s, ',');
+	if (comma) {
+		// IMF-fixdate: "06 Nov 1994 08:49:37 GMT" or RFC 850: "06-Nov-94 08:49:37 GMT"
+		if (sscanf(comma + 1, " %2d %3s %4d %2d:%2d:%2d", &day, month, &year, &hour, &min, &sec) != 6 &&
+		    sscanf(comma + 1, " %2d-%3[A-Za-z]-%4d %2d:%2d:%2d", &day, month, &year, &hour, &min, &sec) != 6)
+			return false;
+		if (year < 100)
+			year += (year < 70) ? 2000 : 1900;
+	} else {
+		// asctime: "Sun Nov  6 08:49:37 1994"
+		char wday[4];
+		if (sscanf(s, "%3s %3s %2d %2d:%2d:%2d %4d", wday, month, &day, &hour, &min, &sec, &year) != 7)
+			return false;
+	}
+
+	int mon = monthIndex(month);
+	if (mon < 0 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60)
+		return false;
+
+	long days = daysFromCivil(year, mon + 1, day);
+	out = static_cast<time_t>(days * 86400L + hour * 3600L + min * 60L + sec);
+	return true;
+}
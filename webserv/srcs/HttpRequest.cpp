@@ -1,48 +1,102 @@
 #include "HttpRequest.hpp"
-#include <sstream>
-#include <algorithm>
+#include "Scanner.hpp"
 #include <cctype>
+#include <cstring>
+#include <new>
 
-static std::string trim(const std::string& str) {
-    size_t first = str.find_first_not_of(" \t\r\n");
-    if (first == std::string::npos)
-        return "";
-    size_t last = str.find_last_not_of(" \t\r\n");
-    return str.substr(first, (last - first + 1));
+#define MAX_HEADER_BYTES 8192
+#define MAX_CHUNK_LINE 4096 // chunk-size line including extensions
+#define BUFFER_KEEP_CAPACITY 65536 // larger buffers are given back between requests
+
+static const struct {
+    const char* name;
+    size_t length;
+} known_header_names[HDR_COUNT] = {
+    { "host", 4 },
+    { "content-length", 14 },
+    { "content-type", 12 },
+    { "transfer-encoding", 17 },
+    { "connection", 10 },
+    { "range", 5 },
+    { "if-none-match", 13 }
+};
+
+static bool equalsIgnoreCase(const char* a, const char* b, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+static int classifyHeader(const char* name, size_t len) {
+    for (int i = 0; i < HDR_COUNT; ++i) {
+        if (known_header_names[i].length == len && equalsIgnoreCase(name, known_header_names[i].name, len))
+            return i;
+    }
+    return -1;
 }
 
-static std::string toLower(const std::string& str) {
-    std::string lower = str;
-    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-    return lower;
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t';
 }
 
 HttpRequest::HttpRequest() 
-    : method(UNKNOWN), state(REQUEST_LINE), bytes_parsed(0), 
-      content_length(0), error_code(0) {
+    : method(UNKNOWN), extra_fields(NULL), extra_capacity(0), field_count(0), header_end(0), state(REQUEST_LINE), bytes_parsed(0), scan_pos(0),
+      content_length(0), error_code(0), chunked(false), chunk_state(CHUNK_SIZE),
+      chunk_remaining(0), body_received(0), max_body_size(0), body_sink(NULL),
+      pause_after_headers(false), body_started(false) {
 }
 
 void HttpRequest::reset() {
+    raw_data.clear();
+    clearFields();
+}
+
+void HttpRequest::resetKeepingPipelined() {
+    // Shift the unread bytes down in place; the buffer keeps its capacity
+    raw_data.erase(0, state == COMPLETE ? bytes_parsed : raw_data.size());
+    clearFields();
+}
+
+void HttpRequest::clearFields() {
+    // Connections are pooled: don't let one big request pin its buffers
+    if (body.capacity() > BUFFER_KEEP_CAPACITY)
+        std::string().swap(body);
+    if (raw_data.capacity() > BUFFER_KEEP_CAPACITY && raw_data.size() <= BUFFER_KEEP_CAPACITY)
+        std::string(raw_data).swap(raw_data);
     method = UNKNOWN;
     uri.clear();
     query_string.clear();
     http_version.clear();
-    headers.clear();
+    for (int i = 0; i < HDR_COUNT; ++i)
+        known_headers[i] = Slice();
+    extra_fields = NULL;
+    extra_capacity = 0;
+    field_count = 0;
+    arena.reset();
+    header_end = 0;
     body.clear();
     state = REQUEST_LINE;
-    raw_data.clear();
     bytes_parsed = 0;
+    scan_pos = 0;
     content_length = 0;
     boundary.clear();
     error_code = 0;
+    chunked = false;
+    chunk_state = CHUNK_SIZE;
+    chunk_remaining = 0;
+    body_received = 0;
+    body_sink = NULL;
+    body_started = false;
 }
 
-HttpMethod HttpRequest::stringToMethod(const std::string& method_str) {
-    if (method_str == "GET") return GET;
-    if (method_str == "POST") return POST;
-    if (method_str == "DELETE") return DELETE;
-    if (method_str == "PUT") return PUT;
-    if (method_str == "HEAD") return HEAD;
+HttpMethod HttpRequest::methodFromToken(const char* token, size_t len) {
+    if (len == 3 && std::memcmp(token, "GET", 3) == 0) return GET;
+    if (len == 4 && std::memcmp(token, "POST", 4) == 0) return POST;
+    if (len == 6 && std::memcmp(token, "DELETE", 6) == 0) return DELETE;
+    if (len == 3 && std::memcmp(token, "PUT", 3) == 0) return PUT;
+    if (len == 4 && std::memcmp(token, "HEAD", 4) == 0) return HEAD;
     return UNKNOWN;
 }
 
@@ -57,149 +111,478 @@ std::string HttpRequest::getMethodString() const {
     }
 }
 
-void HttpRequest::parseRequestLine(const std::string& line) {
-    std::istringstream iss(line);
-    std::string method_str;
-    
-    iss >> method_str >> uri >> http_version;
-    
-    method = stringToMethod(method_str);
+// method SP request-target SP HTTP-version, split in place
+void HttpRequest::parseRequestLine(size_t start, size_t end) {
+    const char* line = raw_data.data();
+    Slice tokens[3];
+    int count = 0;
+    size_t i = start;
+    while (count < 3) {
+        while (i < end && isSpace(line[i]))
+            ++i;
+        if (i == end)
+            break;
+        size_t token_start = i;
+        while (i < end && !isSpace(line[i]))
+            ++i;
+        tokens[count++] = Slice(token_start, i - token_start);
+    }
     
+    method = methodFromToken(line + tokens[0].offset, tokens[0].length);
     if (method == UNKNOWN) {
-        error_code = 405; // Method Not Allowed
-        state = ERROR;
+        fail(405); // Method Not Allowed
         return;
     }
-    
-    if (uri.empty() || http_version.empty()) {
-        error_code = 400; // Bad Request
-        state = ERROR;
+    if (count < 3) {
+        fail(400); // Bad Request
         return;
     }
     
     // Check HTTP version
-    if (http_version != "HTTP/1.1" && http_version != "HTTP/1.0") {
-        error_code = 505; // HTTP Version Not Supported
-        state = ERROR;
+    const char* version = line + tokens[2].offset;
+    if (tokens[2].length != 8 ||
+        (std::memcmp(version, "HTTP/1.1", 8) != 0 && std::memcmp(version, "HTTP/1.0", 8) != 0)) {
+        fail(505); // HTTP Version Not Supported
         return;
     }
+    http_version.assign(version, 8);
     
-    parseQueryString();
+    const char* target = line + tokens[1].offset;
+    const void* query = std::memchr(target, '?', tokens[1].length);
+    size_t path_len = query ? static_cast<const char*>(query) - target : tokens[1].length;
+    uri.assign(target, path_len);
+    if (query)
+        query_string.assign(target + path_len + 1, tokens[1].length - path_len - 1);
     state = HEADERS;
 }
 
-void HttpRequest::parseQueryString() {
-    size_t pos = uri.find('?');
-    if (pos != std::string::npos) {
-        query_string = uri.substr(pos + 1);
-        uri = uri.substr(0, pos);
+// field-name ":" OWS field-value OWS; known names land in fixed slots
+void HttpRequest::parseHeader(size_t start, size_t end) {
+    const char* line = raw_data.data();
+    const void* colon = std::memchr(line + start, ':', end - start);
+    if (!colon) {
+        fail(400); // Bad Request
+        return;
     }
-}
-
-void HttpRequest::parseHeader(const std::string& line) {
-    size_t pos = line.find(':');
-    if (pos == std::string::npos) {
-        error_code = 400; // Bad Request
-        state = ERROR;
+    
+    size_t name_start = start;
+    size_t name_end = static_cast<const char*>(colon) - line;
+    size_t value_start = name_end + 1;
+    size_t value_end = end;
+    // No whitespace before the colon (RFC 9112 5.1): a proxy that trims it
+    // would read a different header than the one checked here. A line
+    // starting with whitespace is obs-fold, a continuation to another
+    // parser (RFC 9112 5.2). An empty name is no field at all
+    if (name_end == name_start || isSpace(line[name_end - 1]) || isSpace(line[name_start])) {
+        fail(400);
         return;
     }
+    while (value_start < value_end && isSpace(line[value_start]))
+        ++value_start;
+    while (value_end > value_start && isSpace(line[value_end - 1]))
+        --value_end;
     
-    std::string key = trim(line.substr(0, pos));
-    std::string value = trim(line.substr(pos + 1));
+    Slice value(value_start, value_end - value_start);
+    int known = classifyHeader(line + name_start, name_end - name_start);
+    if (known >= 0) {
+        Slice& slot = known_headers[known];
+        // Conflicting lengths would let two parsers frame the body differently
+        if (known == HDR_CONTENT_LENGTH && slot.length > 0 &&
+            (slot.length != value.length || std::memcmp(line + slot.offset, line + value.offset, value.length) != 0)) {
+            fail(400);
+            return;
+        }
+        // Exactly one Host (RFC 9112 3.2)
+        if (known == HDR_HOST && slot.length > 0) {
+            fail(400);
+            return;
+        }
+        // A second Transfer-Encoding adds a coding: chunked is no longer the only one
+        if (known == HDR_TRANSFER_ENCODING && slot.length > 0) {
+            fail(501);
+            return;
+        }
+        slot = value;
+        return;
+    }
     
-    // Convert header names to lowercase for case-insensitive lookup
-    headers[toLower(key)] = value;
+    HeaderField f;
+    f.name = Slice(name_start, name_end - name_start);
+    f.value = value;
+    addField(f);
+}
+
+void HttpRequest::addField(const HeaderField& f) {
+    if (field_count < INLINE_HEADER_FIELDS) {
+        fields[field_count++] = f;
+        return;
+    }
+    size_t extra = field_count - INLINE_HEADER_FIELDS;
+    if (extra == extra_capacity) {
+        // Double into fresh arena space; the old array is reclaimed on reset()
+        size_t capacity = extra_capacity ? extra_capacity * 2 : INLINE_HEADER_FIELDS;
+        HeaderField* grown = static_cast<HeaderField*>(arena.allocate(capacity * sizeof(HeaderField)));
+        for (size_t i = 0; i < extra; ++i)
+            new (grown + i) HeaderField(extra_fields[i]);
+        extra_fields = grown;
+        extra_capacity = capacity;
+    }
+    new (extra_fields + extra) HeaderField(f);
+    field_count++;
+}
+
+const HeaderField& HttpRequest::field(size_t index) const {
+    return index < INLINE_HEADER_FIELDS ? fields[index] : extra_fields[index - INLINE_HEADER_FIELDS];
+}
+
+bool HttpRequest::findHeader(const char* name, Slice& value) const {
+    size_t len = std::strlen(name);
+    int known = classifyHeader(name, len);
+    if (known >= 0) {
+        value = known_headers[known];
+        return value.length > 0;
+    }
+    // Latest occurrence wins
+    for (size_t i = field_count; i > 0; --i) {
+        const HeaderField& f = field(i - 1);
+        if (f.name.length == len && equalsIgnoreCase(raw_data.data() + f.name.offset, name, len)) {
+            value = f.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string HttpRequest::getHeader(const char* key) const {
+    Slice value;
+    if (!findHeader(key, value))
+        return "";
+    return raw_data.substr(value.offset, value.length);
+}
+
+const char* HttpRequest::headerData(const char* key, size_t& length) const {
+    Slice value;
+    if (!findHeader(key, value)) {
+        length = 0;
+        return NULL;
+    }
+    length = value.length;
+    return raw_data.data() + value.offset;
+}
+
+const char* HttpRequest::fieldName(size_t index, size_t& length) const {
+    const HeaderField& f = field(index);
+    length = f.name.length;
+    return raw_data.data() + f.name.offset;
+}
+
+const char* HttpRequest::fieldValue(size_t index, size_t& length) const {
+    const HeaderField& f = field(index);
+    length = f.value.length;
+    return raw_data.data() + f.value.offset;
+}
+
+bool HttpRequest::hasHeader(const char* key) const {
+    Slice value;
+    return findHeader(key, value);
 }
 
-std::string HttpRequest::getHeader(const std::string& key) const {
-    std::string lower_key = toLower(key);
-    std::map<std::string, std::string>::const_iterator it = headers.find(lower_key);
-    if (it != headers.end())
-        return it->second;
-    return "";
+bool HttpRequest::headerHasToken(const char* key, const char* token) const {
+    Slice value;
+    if (!findHeader(key, value))
+        return false;
+    const char* data = raw_data.data();
+    size_t token_len = std::strlen(token);
+    size_t pos = value.offset;
+    size_t end = value.offset + value.length;
+    while (pos < end) {
+        const void* comma = std::memchr(data + pos, ',', end - pos);
+        size_t element_end = comma ? static_cast<const char*>(comma) - data : end;
+        size_t first = pos;
+        size_t last = element_end;
+        while (first < last && isSpace(data[first]))
+            ++first;
+        while (last > first && isSpace(data[last - 1]))
+            --last;
+        if (last - first == token_len && equalsIgnoreCase(data + first, token, token_len))
+            return true;
+        pos = element_end + 1;
+    }
+    return false;
 }
 
+// chunked has to be the final transfer-coding (RFC 9112 6.1), and no other
+// coding is implemented, so it must be the only one: "gzip, chunked" gets 501
 bool HttpRequest::isChunked() const {
-    std::string transfer_encoding = getHeader("Transfer-Encoding");
-    return toLower(transfer_encoding).find("chunked") != std::string::npos;
+    const Slice& te = known_headers[HDR_TRANSFER_ENCODING];
+    return te.length == 7 && equalsIgnoreCase(raw_data.data() + te.offset, "chunked", 7);
 }
 
-bool HttpRequest::parse(const char* data, size_t len) {
-    if (state == COMPLETE || state == ERROR)
-        return state == COMPLETE;
+void HttpRequest::fail(int code) {
+    error_code = code;
+    state = ERROR;
+}
+
+std::string HttpRequest::getPipelinedData() const {
+    if (state != COMPLETE || bytes_parsed >= raw_data.size())
+        return "";
+    return raw_data.substr(bytes_parsed);
+}
+
+void HttpRequest::finishHeaders() {
+    header_end = bytes_parsed;
     
-    raw_data.append(data, len);
+    // Extract boundary for multipart/form-data
+    const Slice& ct = known_headers[HDR_CONTENT_TYPE];
+    if (ct.length > 0) {
+        std::string content_type = raw_data.substr(ct.offset, ct.length);
+        if (content_type.find("multipart/form-data") != std::string::npos) {
+            size_t boundary_pos = content_type.find("boundary=");
+            if (boundary_pos != std::string::npos) {
+                boundary = content_type.substr(boundary_pos + 9);
+                // Remove quotes if present (C++98 compatible)
+                if (!boundary.empty() && boundary[0] == '"' && 
+                    boundary[boundary.length() - 1] == '"') {
+                    boundary = boundary.substr(1, boundary.length() - 2);
+                }
+            }
+        }
+    }
+    
+    // Transfer-Encoding overrides Content-Length (RFC 7230 3.3.3), but a
+    // request with both is how bodies get smuggled past another parser:
+    // refuse it rather than pick one (RFC 9112 6.1)
+    if (known_headers[HDR_TRANSFER_ENCODING].length > 0) {
+        if (known_headers[HDR_CONTENT_LENGTH].length > 0) {
+            fail(400);
+            return;
+        }
+        if (!isChunked()) {
+            fail(501); // Not Implemented: unknown transfer-coding
+            return;
+        }
+        chunked = true;
+        state = BODY;
+        return;
+    }
+    
+    const Slice& cl = known_headers[HDR_CONTENT_LENGTH];
+    for (size_t i = cl.offset; i < cl.offset + cl.length; ++i) {
+        char c = raw_data[i];
+        if (c < '0' || c > '9' || content_length > (static_cast<size_t>(-1) - 9) / 10) {
+            fail(400);
+            return;
+        }
+        content_length = content_length * 10 + (c - '0');
+    }
+    state = content_length > 0 ? BODY : COMPLETE;
+}
+
+bool HttpRequest::deliverBody(const char* data, size_t len) {
+    if (max_body_size > 0 && body_received + len > max_body_size) {
+        fail(413); // Payload Too Large
+        return false;
+    }
+    body_received += len;
+    if (!body_sink) {
+        body.append(data, len);
+    } else if (!body_sink->write(data, len)) {
+        fail(body_sink->errorCode());
+        return false;
+    }
+    return true;
+}
+
+void HttpRequest::finishBody() {
+    if (body_sink && !body_sink->finish()) {
+        fail(body_sink->errorCode());
+        return;
+    }
+    content_length = body_received;
+    state = COMPLETE;
+}
+
+void HttpRequest::parseIdentityBody() {
+    size_t available = raw_data.size() - bytes_parsed;
+    size_t wanted = content_length - body_received;
+    size_t take = available < wanted ? available : wanted;
     
-    while (state != COMPLETE && state != ERROR) {
-        if (state == REQUEST_LINE || state == HEADERS) {
-            size_t line_end = raw_data.find("\r\n", bytes_parsed);
+    if (take > 0) {
+        if (!deliverBody(raw_data.data() + bytes_parsed, take))
+            return;
+        bytes_parsed += take;
+    }
+    if (body_received == content_length)
+        finishBody();
+}
+
+// Resumes where the last unsuccessful search stopped, so a line that
+// trickles in over many reads is scanned once
+size_t HttpRequest::findLineEnd() {
+    size_t from = scan_pos > bytes_parsed ? scan_pos : bytes_parsed;
+    size_t line_end = from < raw_data.size() ? Scanner::findCrlf(raw_data.data() + from, raw_data.size() - from)
+                                             : std::string::npos;
+    if (line_end != std::string::npos)
+        line_end += from;
+    if (line_end == std::string::npos && raw_data.size() > from)
+        scan_pos = raw_data.size() - 1; // the last byte may be the '\r'
+    return line_end;
+}
+
+// chunk-size = 1*HEXDIG, optionally followed by BWS and ";" extensions
+static bool parseChunkSize(const char* line, size_t len, size_t& size) {
+    size_t i = 0;
+    size = 0;
+    for (; i < len && std::isxdigit(static_cast<unsigned char>(line[i])); ++i) {
+        if (size > (static_cast<size_t>(-1) >> 4))
+            return false; // overflow
+        char c = line[i];
+        size = (size << 4) | (std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::tolower(c) - 'a' + 10));
+    }
+    if (i == 0)
+        return false;
+    while (i < len && (line[i] == ' ' || line[i] == '\t'))
+        ++i;
+    return i == len || line[i] == ';';
+}
+
+// Decodes as far as the buffered bytes allow; resumes from chunk_state
+void HttpRequest::parseChunkedBody() {
+    while (state == BODY) {
+        size_t available = raw_data.size() - bytes_parsed;
+        
+        if (chunk_state == CHUNK_SIZE || chunk_state == CHUNK_TRAILER) {
+            size_t line_end = findLineEnd();
             if (line_end == std::string::npos) {
-                // Check for request line/header size limits
-                if (raw_data.size() > 8192) { // 8KB limit for headers
-                    error_code = 431; // Request Header Fields Too Large
-                    state = ERROR;
-                }
-                return false; // Need more data
+                if (available > (chunk_state == CHUNK_SIZE ? MAX_CHUNK_LINE : MAX_HEADER_BYTES))
+                    fail(chunk_state == CHUNK_SIZE ? 400 : 431);
+                return; // Need more data
             }
+            size_t line_start = bytes_parsed;
+            bytes_parsed = line_end + 2;
             
-            std::string line = raw_data.substr(bytes_parsed, line_end - bytes_parsed);
-            bytes_parsed = line_end + 2; // Skip \r\n
+            if (chunk_state == CHUNK_TRAILER) {
+                // Trailer fields are not used: skip them up to the empty line
+                if (line_end == line_start)
+                    finishBody();
+                continue;
+            }
             
-            if (state == REQUEST_LINE) {
-                parseRequestLine(line);
-            } else if (state == HEADERS) {
-                if (line.empty()) {
-                    // Empty line marks end of headers
-                    std::string content_len_str = getHeader("Content-Length");
-                    if (!content_len_str.empty()) {
-                        std::istringstream iss(content_len_str);
-                        iss >> content_length;
-                    }
-                    
-                    // Extract boundary for multipart/form-data
-                    std::string content_type = getHeader("Content-Type");
-                    if (content_type.find("multipart/form-data") != std::string::npos) {
-                        size_t boundary_pos = content_type.find("boundary=");
-                        if (boundary_pos != std::string::npos) {
-                            boundary = content_type.substr(boundary_pos + 9);
-                            // Remove quotes if present (C++98 compatible)
-                            if (!boundary.empty() && boundary[0] == '"' && 
-                                boundary[boundary.length() - 1] == '"') {
-                                boundary = boundary.substr(1, boundary.length() - 2);
-                            }
-                        }
-                    }
-                    
-                    if (content_length > 0 || isChunked()) {
-                        state = BODY;
-                    } else {
-                        state = COMPLETE;
-                    }
-                } else {
-                    parseHeader(line);
-                }
+            size_t size;
+            if (!parseChunkSize(raw_data.data() + line_start, line_end - line_start, size)) {
+                fail(400);
+                return;
             }
-        } else if (state == BODY) {
-            if (isChunked()) {
-                // Simplified chunked handling - in real implementation, 
-                // you'd need to properly parse chunk sizes
-                error_code = 501; // Not Implemented for chunked
-                state = ERROR;
-                return false;
+            if (size == 0) {
+                chunk_state = CHUNK_TRAILER;
+            } else if (max_body_size > 0 && size > max_body_size - body_received) {
+                fail(413); // reject before the chunk data even arrives
+                return;
             } else {
-                // Read based on Content-Length
-                size_t available = raw_data.size() - bytes_parsed;
-                if (available >= content_length) {
-                    body = raw_data.substr(bytes_parsed, content_length);
-                    bytes_parsed += content_length;
-                    state = COMPLETE;
-                } else {
-                    // Need more data
-                    return false;
-                }
+                chunk_remaining = size;
+                chunk_state = CHUNK_DATA;
+            }
+        } else if (chunk_state == CHUNK_DATA) {
+            if (available == 0)
+                return;
+            size_t take = available < chunk_remaining ? available : chunk_remaining;
+            if (!deliverBody(raw_data.data() + bytes_parsed, take))
+                return;
+            bytes_parsed += take;
+            chunk_remaining -= take;
+            if (chunk_remaining == 0)
+                chunk_state = CHUNK_DATA_CRLF;
+        } else { // CHUNK_DATA_CRLF
+            if (available < 2)
+                return;
+            if (raw_data.compare(bytes_parsed, 2, "\r\n") != 0) {
+                fail(400);
+                return;
             }
+            bytes_parsed += 2;
+            chunk_state = CHUNK_SIZE;
+        }
+    }
+}
+
+bool HttpRequest::parse(const char* data, size_t len) {
+    if (state == ERROR)
+        return false;
+    
+    // Identity body bytes with nothing buffered ahead of them go straight
+    // to the sink instead of through raw_data
+    if (state == BODY && body_started && !chunked && bytes_parsed == raw_data.size()) {
+        size_t wanted = content_length - body_received;
+        size_t take = len < wanted ? len : wanted;
+        if (take > 0 && !deliverBody(data, take))
+            return false;
+        if (body_received == content_length)
+            finishBody();
+        if (state == ERROR)
+            return false;
+        data += take;
+        len -= take;
+    }
+    
+    // Keep bytes that arrive while a complete request waits to be served:
+    // they belong to the next pipelined request
+    raw_data.append(data, len);
+    if (state == COMPLETE)
+        return true;
+    
+    while (state == REQUEST_LINE || state == HEADERS) {
+        size_t line_end = findLineEnd();
+        if (line_end == std::string::npos) {
+            // Check for request line/header size limits
+            if (raw_data.size() > MAX_HEADER_BYTES)
+                fail(431); // Request Header Fields Too Large
+            return false; // Need more data
+        }
+        // Same limit when the whole block came in one read
+        if (line_end > MAX_HEADER_BYTES) {
+            fail(431);
+            return false;
+        }
+        
+        size_t line_start = bytes_parsed;
+        bytes_parsed = line_end + 2; // Skip \r\n
+        
+        if (state == REQUEST_LINE) {
+            // Stray CRLFs before a request are ignored (RFC 7230 3.5)
+            if (line_end > line_start)
+                parseRequestLine(line_start, line_end);
+        } else if (line_end == line_start) {
+            // Empty line marks end of headers
+            finishHeaders();
+        } else {
+            parseHeader(line_start, line_end);
+        }
+    }
+    
+    if (state == BODY && pause_after_headers && !body_started)
+        return false;
+    
+    if (state == BODY) {
+        body_started = true;
+        if (chunked)
+            parseChunkedBody();
+        else
+            parseIdentityBody();
+        
+        // Decoded bytes now live in the sink: drop them so the encoded body
+        // never accumulates in raw_data (the header block stays, headers
+        // point into it)
+        if (state == BODY && bytes_parsed > header_end) {
+            scan_pos = scan_pos > bytes_parsed ? scan_pos - (bytes_parsed - header_end) : 0;
+            raw_data.erase(header_end, bytes_parsed - header_end);
+            bytes_parsed = header_end;
         }
     }
     
     return state == COMPLETE;
 }
+
+bool HttpRequest::startBody() {
+    body_started = true;
+    return parse("", 0);
+}
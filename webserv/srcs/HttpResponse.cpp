@@ -1,93 +1,300 @@
 #include "HttpResponse.hpp"
-#include <sstream>
+#include "ChunkedEncoder.hpp"
+#include "ErrorPages.hpp"
+#include "HttpDate.hpp"
 #include <fstream>
+#include <unistd.h>
 
-std::string HttpResponse::loadErrorPage(const std::string& error_code) {
-    std::string file_path = "www/errors/" + error_code + ".html";
-    std::ifstream file(file_path.c_str());
-    
-    if (file.is_open()) {
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        file.close();
-        return buffer.str();
-    }
-    
-    // Fallback to generic error response if file not found
-    return "<html><body><h1>" + error_code + " Error</h1></body></html>";
+// Precomputed status lines; other codes are formatted on the fly
+static const struct {
+    int code;
+    const char* reason;
+    const char* line;
+} g_statuses[] = {
+    { 200, "OK",                              "HTTP/1.1 200 OK\r\n" },
+    { 201, "Created",                         "HTTP/1.1 201 Created\r\n" },
+    { 204, "No Content",                      "HTTP/1.1 204 No Content\r\n" },
+    { 206, "Partial Content",                 "HTTP/1.1 206 Partial Content\r\n" },
+    { 301, "Moved Permanently",               "HTTP/1.1 301 Moved Permanently\r\n" },
+    { 302, "Found",                           "HTTP/1.1 302 Found\r\n" },
+    { 304, "Not Modified",                    "HTTP/1.1 304 Not Modified\r\n" },
+    { 400, "Bad Request",                     "HTTP/1.1 400 Bad Request\r\n" },
+    { 403, "Forbidden",                       "HTTP/1.1 403 Forbidden\r\n" },
+    { 404, "Not Found",                       "HTTP/1.1 404 Not Found\r\n" },
+    { 405, "Method Not Allowed",              "HTTP/1.1 405 Method Not Allowed\r\n" },
+    { 408, "Request Timeout",                 "HTTP/1.1 408 Request Timeout\r\n" },
+    { 409, "Conflict",                        "HTTP/1.1 409 Conflict\r\n" },
+    { 413, "Payload Too Large",               "HTTP/1.1 413 Payload Too Large\r\n" },
+    { 416, "Range Not Satisfiable",           "HTTP/1.1 416 Range Not Satisfiable\r\n" },
+    { 417, "Expectation Failed",              "HTTP/1.1 417 Expectation Failed\r\n" },
+    { 431, "Request Header Fields Too Large", "HTTP/1.1 431 Request Header Fields Too Large\r\n" },
+    { 500, "Internal Server Error",           "HTTP/1.1 500 Internal Server Error\r\n" },
+    { 501, "Not Implemented",                 "HTTP/1.1 501 Not Implemented\r\n" },
+    { 502, "Bad Gateway",                     "HTTP/1.1 502 Bad Gateway\r\n" },
+    { 503, "Service Unavailable",             "HTTP/1.1 503 Service Unavailable\r\n" },
+    { 504, "Gateway Timeout",                 "HTTP/1.1 504 Gateway Timeout\r\n" },
+    { 505, "HTTP Version Not Supported",      "HTTP/1.1 505 HTTP Version Not Supported\r\n" },
+    { 507, "Insufficient Storage",            "HTTP/1.1 507 Insufficient Storage\r\n" }
+};
+
+static const size_t g_status_count = sizeof(g_statuses) / sizeof(g_statuses[0]);
+
+// Decimal digits of `value` at the end of `buf`; returns the first digit
+static char* formatUnsigned(char* end, unsigned long value) {
+    char* p = end;
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return p;
+}
+
+static void appendUnsigned(std::string& out, unsigned long value) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* begin = formatUnsigned(end, value);
+    out.append(begin, end - begin);
 }
 
 HttpResponse::HttpResponse() 
-    : status_code(200), status_message("OK"), headers_sent(false) {
+    : status_code(200), segments_length(0), chunked(false),
+      body_dropped(false), headers_sent(false) {
+    headers.reserve(8);
     setHeader("Server", "WebServ/1.0");
 }
 
 HttpResponse::HttpResponse(int code) 
-    : status_code(code), headers_sent(false) {
-    status_message = getStatusMessage(code);
+    : status_code(code), segments_length(0), chunked(false),
+      body_dropped(false), headers_sent(false) {
+    headers.reserve(8);
     setHeader("Server", "WebServ/1.0");
 }
 
-std::string HttpResponse::getStatusMessage(int code) const {
-    switch (code) {
-        case 200: return "OK";
-        case 201: return "Created";
-        case 204: return "No Content";
-        case 301: return "Moved Permanently";
-        case 302: return "Found";
-        case 304: return "Not Modified";
-        case 400: return "Bad Request";
-        case 403: return "Forbidden";
-        case 404: return "Not Found";
-        case 405: return "Method Not Allowed";
-        case 413: return "Payload Too Large";
-        case 431: return "Request Header Fields Too Large";
-        case 500: return "Internal Server Error";
-        case 501: return "Not Implemented";
-        case 505: return "HTTP Version Not Supported";
-        default: return "Unknown";
+std::string HttpResponse::getStatusMessage(int code) {
+    for (size_t i = 0; i < g_status_count; ++i) {
+        if (g_statuses[i].code == code)
+            return g_statuses[i].reason;
     }
+    return "Unknown";
 }
 
 void HttpResponse::setStatusCode(int code) {
     status_code = code;
-    status_message = getStatusMessage(code);
 }
 
 void HttpResponse::setHeader(const std::string& key, const std::string& value) {
-    headers[key] = value;
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (headers[i].first == key) {
+            headers[i].second = value;
+            return;
+        }
+    }
+    headers.push_back(Header(key, value));
+}
+
+void HttpResponse::addHeader(const std::string& key, const std::string& value) {
+    headers.push_back(Header(key, value));
+}
+
+bool HttpResponse::hasHeader(const std::string& key) const {
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (headers[i].first == key)
+            return true;
+    }
+    return false;
+}
+
+void HttpResponse::removeHeader(const std::string& key) {
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (headers[i].first == key) {
+            headers.erase(headers.begin() + i);
+            return;
+        }
+    }
+}
+
+void HttpResponse::clearBody() {
+    header_block.reset();
+    body.reset();
+    body_segments.clear();
+    segments_length = 0;
+}
+
+void HttpResponse::updateContentLength(size_t length) {
+    if (chunked)
+        return;
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* begin = formatUnsigned(end, length);
+    setHeader("Content-Length", std::string(begin, end - begin));
 }
 
 void HttpResponse::setBody(const std::string& content) {
+    setBody(SharedBuffer(content));
+}
+
+void HttpResponse::setBody(const SharedBuffer& content) {
+    clearBody();
     body = content;
-    std::ostringstream oss;
-    oss << content.size();
-    setHeader("Content-Length", oss.str());
+    updateContentLength(content.size());
 }
 
 void HttpResponse::setContentType(const std::string& mime_type) {
     setHeader("Content-Type", mime_type);
 }
 
-std::string HttpResponse::build() {
-    std::ostringstream response;
-    
-    // Status line
-    response << "HTTP/1.1 " << status_code << " " << status_message << "\r\n";
-    
-    // Headers
-    for (std::map<std::string, std::string>::const_iterator it = headers.begin();
-         it != headers.end(); ++it) {
-        response << it->first << ": " << it->second << "\r\n";
+void HttpResponse::setFileBody(const SharedFile& file, off_t offset, size_t length) {
+    clearBody();
+    appendBodyFile(file, offset, length);
+}
+
+void HttpResponse::appendBodyFile(const SharedFile& file, off_t offset, size_t length) {
+    body.reset();
+    if (length > 0) {
+        OutputSegment seg;
+        seg.file = file;
+        seg.offset = offset;
+        seg.length = length;
+        body_segments.push_back(seg);
+        segments_length += length;
+    }
+    updateContentLength(segments_length);
+}
+
+void HttpResponse::appendBodyBuffer(const SharedBuffer& buffer) {
+    body.reset();
+    if (!buffer.empty()) {
+        OutputSegment seg;
+        seg.buffer = buffer;
+        seg.length = buffer.size();
+        body_segments.push_back(seg);
+        segments_length += buffer.size();
+    }
+    updateContentLength(segments_length);
+}
+
+void HttpResponse::dropBody() {
+    body_dropped = true;
+    body.reset();
+    body_segments.clear();
+    segments_length = 0;
+}
+
+void HttpResponse::setPrebuilt(const SharedBuffer& block, const SharedBuffer& content) {
+    clearBody();
+    removeHeader("Content-Type");
+    removeHeader("Content-Length");
+    header_block = block;
+    body = content;
+    // The prebuilt block carries its own Content-Length
+    chunked = false;
+    removeHeader("Transfer-Encoding");
+}
+
+void HttpResponse::setChunked() {
+    chunked = true;
+    removeHeader("Content-Length");
+    setHeader("Transfer-Encoding", "chunked");
+}
+
+void HttpResponse::serializeHead(std::string& out) const {
+    size_t i = 0;
+    while (i < g_status_count && g_statuses[i].code != status_code)
+        ++i;
+    if (i < g_status_count) {
+        out += g_statuses[i].line;
+    } else {
+        out += "HTTP/1.1 ";
+        appendUnsigned(out, status_code);
+        out += " Unknown\r\n";
     }
     
-    // Empty line separating headers from body
-    response << "\r\n";
+    // CGI scripts may bring their own
+    if (!hasHeader("Date")) {
+        out += "Date: ";
+        out += HttpDate::now();
+        out += "\r\n";
+    }
+    for (size_t h = 0; h < headers.size(); ++h) {
+        out += headers[h].first;
+        out += ": ";
+        out += headers[h].second;
+        out += "\r\n";
+    }
+}
+
+void HttpResponse::appendHeaders(std::string& out) const {
+    serializeHead(out);
+    // Empty line separating headers from body (already part of a prebuilt block)
+    if (header_block.empty())
+        out += "\r\n";
+    else
+        out += header_block.str();
+}
+
+std::string HttpResponse::buildHeaders() const {
+    std::string response;
+    appendHeaders(response);
+    return response;
+}
+
+std::string HttpResponse::build() {
+    std::string content = body.str();
     
-    // Body
-    response << body;
+    // The server streams segments with writev()/sendfile(); this path is for
+    // callers that want the whole response as one string
+    for (size_t i = 0; i < body_segments.size(); ++i) {
+        const OutputSegment& seg = body_segments[i];
+        if (!seg.isFile()) {
+            content.append(seg.buffer.data() + seg.offset, seg.length);
+            continue;
+        }
+        char buf[8192];
+        off_t offset = seg.offset;
+        size_t remaining = seg.length;
+        while (remaining > 0) {
+            size_t want = remaining < sizeof(buf) ? remaining : sizeof(buf);
+            ssize_t n = pread(seg.file.fd(), buf, want, offset);
+            if (n <= 0)
+                break;
+            content.append(buf, n);
+            offset += n;
+            remaining -= n;
+        }
+    }
     
-    return response.str();
+    if (chunked && !body_dropped)
+        content = ChunkedEncoder::encode(content.data(), content.size()) + "0\r\n\r\n";
+    return buildHeaders() + content;
+}
+
+void HttpResponse::appendHeadersTo(OutputQueue& queue) const {
+    std::string& out = queue.headBuffer();
+    size_t start = out.size();
+    serializeHead(out);
+    if (header_block.empty()) {
+        out += "\r\n";
+        queue.pushHead(start);
+    } else {
+        queue.pushHead(start);
+        queue.push(header_block);
+    }
+}
+
+void HttpResponse::appendTo(OutputQueue& queue) const {
+    appendHeadersTo(queue);
+    if (chunked) {
+        if (body_dropped)
+            return;
+        ChunkedEncoder::appendChunk(queue, body);
+        for (size_t i = 0; i < body_segments.size(); ++i)
+            ChunkedEncoder::appendChunk(queue, body_segments[i]);
+        ChunkedEncoder::appendLastChunk(queue);
+        return;
+    }
+    queue.push(body);
+    for (size_t i = 0; i < body_segments.size(); ++i)
+        queue.push(body_segments[i]);
 }
 
 // Static helper methods
@@ -122,56 +329,50 @@ HttpResponse HttpResponse::redirect(const std::string& location, int code) {
     return response;
 }
 
-HttpResponse HttpResponse::badRequest(const std::string& message) {
-    HttpResponse response(400);
-    std::string body = "<html><body><h1>400 Bad Request</h1><p>" + message + "</p></body></html>";
-    response.setBody(body);
-    response.setContentType("text/html");
+// Error builders share the pre-rendered page for their status
+HttpResponse HttpResponse::error(int code) {
+    HttpResponse response(code);
+    const ErrorPage& page = ErrorPages::get(code);
+    response.setPrebuilt(page.header_block, page.body);
     return response;
 }
 
-HttpResponse HttpResponse::notFound(const std::string& message) {
-    HttpResponse response(404);
-    std::string body = loadErrorPage("404");
-    if (body == "<html><body><h1>404 Error</h1></body></html>") {
-        body = "<html><body><h1>404 Not Found</h1><p>" + message + "</p></body></html>";
-    }
-    response.setBody(body);
-    response.setContentType("text/html");
-    return response;
+HttpResponse HttpResponse::badRequest() {
+    return error(400);
 }
 
-HttpResponse HttpResponse::methodNotAllowed(const std::string& message) {
-    HttpResponse response(405);
-    std::string body = "<html><body><h1>405 Method Not Allowed</h1><p>" + message + "</p></body></html>";
-    response.setBody(body);
-    response.setContentType("text/html");
-    return response;
+HttpResponse HttpResponse::notFound() {
+    return error(404);
 }
 
-HttpResponse HttpResponse::internalServerError(const std::string& message) {
-    HttpResponse response(500);
-    std::string body = loadErrorPage("500");
-    if (body == "<html><body><h1>500 Error</h1></body></html>") {
-        body = "<html><body><h1>500 Internal Server Error</h1><p>" + message + "</p></body></html>";
-    }
-    response.setBody(body);
-    response.setContentType("text/html");
-    return response;
+HttpResponse HttpResponse::methodNotAllowed() {
+    return error(405);
 }
 
-HttpResponse HttpResponse::notImplemented(const std::string& message) {
-    HttpResponse response(501);
-    std::string body = "<html><body><h1>501 Not Implemented</h1><p>" + message + "</p></body></html>";
-    response.setBody(body);
-    response.setContentType("text/html");
-    return response;
+HttpResponse HttpResponse::internalServerError() {
+    return error(500);
 }
 
-HttpResponse HttpResponse::payloadTooLarge(const std::string& message) {
-    HttpResponse response(413);
-    std::string body = "<html><body><h1>413 Payload Too Large</h1><p>" + message + "</p></body></html>";
-    response.setBody(body);
-    response.setContentType("text/html");
+HttpResponse HttpResponse::notImplemented() {
+    return error(501);
+}
+
+HttpResponse HttpResponse::payloadTooLarge() {
+    return error(413);
+}
+
+HttpResponse HttpResponse::badGateway() {
+    return error(502);
+}
+
+HttpResponse HttpResponse::gatewayTimeout() {
+    return error(504);
+}
+
+HttpResponse HttpResponse::serviceUnavailable(unsigned long retry_after) {
+    HttpResponse response = error(503);
+    std::string seconds;
+    appendUnsigned(seconds, retry_after);
+    response.setHeader("Retry-After", seconds);
     return response;
 }
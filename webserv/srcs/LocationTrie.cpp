@@ -0,0 +1,88 @@
+#include "LocationTrie.hpp"
+#include <cstring>
+
+LocationTrie::LocationTrie() : _nodes(1) {}
+
+void LocationTrie::clear() {
+	_nodes.assign(1, Node());
+}
+
+static int compareSegment(const std::string& a, const char* b, size_t length) {
+	size_t common = a.size() < length ? a.size() : length;
+	int cmp = std::memcmp(a.data(), b, common);
+	if (cmp != 0)
+		return cmp;
+	if (a.size() == length)
+		return 0;
+	return a.size() < length ? -1 : 1;
+}
+
+// Binary search; returns the child index, or -(insert position) - 1
+int LocationTrie::_findChild(size_t node, const char* segment, size_t length) const {
+	const std::vector<size_t>& children = _nodes[node].children;
+	size_t lo = 0;
+	size_t hi = children.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int cmp = compareSegment(_nodes[children[mid]].segment, segment, length);
+		if (cmp == 0)
+			return static_cast<int>(children[mid]);
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -static_cast<int>(lo) - 1;
+}
+
+void LocationTrie::insert(const std::string& path, int location) {
+	size_t node = 0;
+	size_t pos = 0;
+	while (pos < path.size()) {
+		if (path[pos] == '/') {
+			pos++;
+			continue;
+		}
+		size_t end = path.find('/', pos);
+		if (end == std::string::npos)
+			end = path.size();
+
+		int child = _findChild(node, path.data() + pos, end - pos);
+		if (child < 0) {
+			size_t at = static_cast<size_t>(-child - 1);
+			Node created;
+			created.segment = path.substr(pos, end - pos);
+			_nodes.push_back(created);
+			child = static_cast<int>(_nodes.size() - 1);
+			_nodes[node].children.insert(_nodes[node].children.begin() + at, child);
+		}
+		node = static_cast<size_t>(child);
+		pos = end;
+	}
+	if (_nodes[node].location < 0)
+		_nodes[node].location = location;
+}
+
+int LocationTrie::match(const std::string& uri) const {
+	size_t node = 0;
+	int best = _nodes[0].location;
+	size_t pos = 0;
+	while (pos < uri.size()) {
+		if (uri[pos] == '/') {
+			pos++;
+			continue;
+		}
+		size_t end = uri.find('/', pos);
+		if (end == std::string::npos)
+			end = uri.size();
+
+		int child = _findChild(node, uri.data() + pos, end - pos);
+		if (child < 0)
+			break;
+		node = static_cast<size_t>(child);
+		if (_nodes[node].location >= 0)
+			best = _nodes[node].location;
+		pos = end;
+	}
+	return best;
+}
@@ -0,0 +1,314 @@
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LOG_IDLE_USEC 20000 // writer sleep while the ring is empty
+
+Logger::Slot Logger::_ring[LOG_RING_SIZE];
+size_t Logger::_head = 0;
+size_t Logger::_tail = 0;
+size_t Logger::_dropped = 0;
+bool Logger::_running = false;
+bool Logger::_stop = false;
+pthread_t Logger::_thread;
+int Logger::_access_fd = -1;
+int Logger::_error_fd = STDERR_FILENO;
+AccessLogFormat Logger::_format = ACCESS_LOG_COMBINED;
+LogLevel Logger::_level = LEVEL_INFO;
+size_t Logger::_sample = 1;
+size_t Logger::_sample_count = 0;
+
+static const char* const g_level_names[] = { "error", "warn", "info", "debug" };
+
+//
+/* Setup */
+//
+
+int Logger::_openTarget(const std::string& target) {
+	if (target.empty() || target == "off")
+		return -1;
+	if (target == "stdout")
+		return STDOUT_FILENO;
+	if (target == "stderr")
+		return STDERR_FILENO;
+	return ::open(target.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+bool Logger::open(const std::string& access_log, AccessLogFormat format, size_t sample,
+                  const std::string& error_log, LogLevel level) {
+	close();
+	_format = format;
+	_sample = sample > 0 ? sample : 1;
+	_sample_count = 0;
+	_level = level;
+
+	bool ok = true;
+	_access_fd = _openTarget(access_log);
+	if (_access_fd == -1 && !access_log.empty() && access_log != "off")
+		ok = false;
+	_error_fd = _openTarget(error_log.empty() ? "stderr" : error_log);
+	if (_error_fd == -1) {
+		_error_fd = STDERR_FILENO;
+		ok = false;
+	}
+
+	// The writer starts with every signal blocked so they stay with the event loop
+	sigset_t all;
+	sigset_t previous;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &previous);
+	_stop = false;
+	_running = pthread_create(&_thread, NULL, _writer, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	return ok;
+}
+
+void Logger::close() {
+	if (_running) {
+		__atomic_store_n(&_stop, true, __ATOMIC_RELEASE);
+		pthread_join(_thread, NULL);
+		_running = false;
+	}
+	if (_access_fd > STDERR_FILENO)
+		::close(_access_fd);
+	if (_error_fd > STDERR_FILENO)
+		::close(_error_fd);
+	_access_fd = -1;
+	_error_fd = STDERR_FILENO;
+}
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level) {
+	for (int i = LEVEL_ERROR; i <= LEVEL_DEBUG; ++i) {
+		if (name == g_level_names[i]) {
+			level = static_cast<LogLevel>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+long long Logger::clockUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void Logger::copyField(char* dest, size_t size, const char* src, size_t len) {
+	if (!src)
+		len = 0;
+	if (len >= size)
+		len = size - 1;
+	if (len)
+		std::memcpy(dest, src, len);
+	dest[len] = '\0';
+}
+
+//
+/* Producer (event loop) */
+//
+
+// The producer owns _head, the writer owns _tail: one acquire/release pair
+// per record and no lock
+Logger::Slot* Logger::_reserve() {
+	size_t head = _head;
+	size_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= LOG_RING_SIZE) {
+		__atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	return &_ring[head % LOG_RING_SIZE];
+}
+
+void Logger::_commit() {
+	__atomic_store_n(&_head, _head + 1, __ATOMIC_RELEASE);
+}
+
+void Logger::message(LogLevel level, const std::string& text) {
+	if (!enabled(level))
+		return;
+	if (!_running) {
+		// No writer (yet): straight to the error log
+		std::string line;
+		Slot slot;
+		slot.access = false;
+		slot.level = level;
+		slot.record.time = time(NULL);
+		copyField(slot.record.target, sizeof(slot.record.target), text.data(), text.size());
+		_formatMessage(slot, line);
+		ssize_t ignored = write(_error_fd, line.data(), line.size());
+		(void)ignored;
+		return;
+	}
+	Slot* slot = _reserve();
+	if (!slot)
+		return;
+	slot->access = false;
+	slot->level = level;
+	slot->record.time = time(NULL);
+	copyField(slot->record.target, sizeof(slot->record.target), text.data(), text.size());
+	_commit();
+}
+
+void Logger::access(const AccessRecord& record) {
+	if (_access_fd == -1 || !_running)
+		return;
+	if (record.status < 400 && _sample > 1 && _sample_count++ % _sample != 0)
+		return;
+	Slot* slot = _reserve();
+	if (!slot)
+		return;
+	slot->access = true;
+	slot->level = LEVEL_INFO;
+	slot->record = record;
+	_commit();
+}
+
+//
+/* Writer thread */
+//
+
+static void appendEscaped(std::string& out, const char* text, bool json) {
+	for (const unsigned char* p = reinterpret_cast<const unsigned char*>(text); *p; ++p) {
+		if (*p == '"' || *p == '\\') {
+			out += '\\';
+			out += static_cast<char>(*p);
+		} else if (*p < 0x20 || *p == 0x7f) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), json ? "\\u%04x" : "\\x%02X", *p);
+			out += esc;
+		} else {
+			out += static_cast<char>(*p);
+		}
+	}
+}
+
+static void formatAddr(unsigned int addr, char* out, size_t size) {
+	const unsigned char* b = reinterpret_cast<const unsigned char*>(&addr);
+	snprintf(out, size, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+}
+
+void Logger::_formatAccess(const AccessRecord& r, std::string& out) {
+	char addr[16];
+	formatAddr(r.addr, addr, sizeof(addr));
+	struct tm gmt;
+	gmtime_r(&r.time, &gmt);
+	char buf[64];
+
+	if (_format == ACCESS_LOG_JSON) {
+		strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &gmt);
+		out += "{\"time\":\"";
+		out += buf;
+		out += "\",\"remote_addr\":\"";
+		out += addr;
+		out += "\",\"method\":\"";
+		appendEscaped(out, r.method, true);
+		out += "\",\"target\":\"";
+		appendEscaped(out, r.target, true);
+		out += "\",\"protocol\":\"";
+		appendEscaped(out, r.version, true);
+		snprintf(buf, sizeof(buf), "\",\"status\":%d,\"bytes\":%lu,\"latency_us\":%ld",
+		         r.status, static_cast<unsigned long>(r.bytes), r.latency_us);
+		out += buf;
+		out += ",\"referer\":\"";
+		appendEscaped(out, r.referer, true);
+		out += "\",\"user_agent\":\"";
+		appendEscaped(out, r.agent, true);
+		out += "\"}\n";
+		return;
+	}
+
+	// Combined log format, latency in microseconds appended
+	strftime(buf, sizeof(buf), "[%d/%b/%Y:%H:%M:%S +0000]", &gmt);
+	out += addr;
+	out += " - - ";
+	out += buf;
+	out += " \"";
+	appendEscaped(out, r.method, false);
+	out += ' ';
+	appendEscaped(out, r.target, false);
+	out += ' ';
+	appendEscaped(out, r.version, false);
+	snprintf(buf, sizeof(buf), "\" %d %lu \"", r.status, static_cast<unsigned long>(r.bytes));
+	out += buf;
+	appendEscaped(out, r.referer[0] ? r.referer : "-", false);
+	out += "\" \"";
+	appendEscaped(out, r.agent[0] ? r.agent : "-", false);
+	snprintf(buf, sizeof(buf), "\" %ld\n", r.latency_us);
+	out += buf;
+}
+
+void Logger::_formatMessage(const Slot& slot, std::string& out) {
+	struct tm local;
+	localtime_r(&slot.record.time, &local);
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", &local);
+	out += buf;
+	out += " [";
+	out += g_level_names[slot.level];
+	out += "] ";
+	out += slot.record.target;
+	out += '\n';
+}
+
+static void writeAll(int fd, const std::string& data) {
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t n = write(fd, data.data() + done, data.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return; // nowhere to report it
+		done += static_cast<size_t>(n);
+	}
+}
+
+void Logger::_drain(std::string& access, std::string& errors) {
+	size_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+	size_t tail = _tail;
+	for (; tail != head; ++tail) {
+		const Slot& slot = _ring[tail % LOG_RING_SIZE];
+		if (slot.access)
+			_formatAccess(slot.record, access);
+		else
+			_formatMessage(slot, errors);
+	}
+	__atomic_store_n(&_tail, tail, __ATOMIC_RELEASE);
+
+	size_t dropped = __atomic_exchange_n(&_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "log ring full, %lu records dropped", static_cast<unsigned long>(dropped));
+		Slot note;
+		note.access = false;
+		note.level = LEVEL_WARN;
+		note.record.time = time(NULL);
+		copyField(note.record.target, sizeof(note.record.target), buf, strlen(buf));
+		_formatMessage(note, errors);
+	}
+}
+
+void* Logger::_writer(void*) {
+	std::string access;
+	std::string errors;
+	while (true) {
+		bool stopping = __atomic_load_n(&_stop, __ATOMIC_ACQUIRE);
+		_drain(access, errors);
+		if (!access.empty() && _access_fd != -1)
+			writeAll(_access_fd, access);
+		if (!errors.empty())
+			writeAll(_error_fd, errors);
+		bool idle = access.empty() && errors.empty();
+		access.clear();
+		errors.clear();
+		if (stopping)
+			break;
+		if (idle)
+			usleep(LOG_IDLE_USEC);
+	}
+	return NULL;
+}
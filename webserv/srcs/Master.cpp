@@ -0,0 +1,181 @@
+#include "Master.hpp"
+#include "Server.hpp"
+#include "Config.hpp"
+
+#include <iostream>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <sys/prctl.h>
+#endif
+
+extern volatile sig_atomic_t g_shutdown;
+extern volatile sig_atomic_t g_reload;
+extern volatile sig_atomic_t g_drain;
+
+Master::Master(const std::string& config_file, size_t workers)
+	: _config_file(config_file), _count(workers > 0 ? workers : 1) {}
+
+Master::~Master() {
+	_stopWorkers();
+}
+
+size_t Master::resolveCount(size_t configured) {
+	if (configured > 0)
+		return configured;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? static_cast<size_t>(cpus) : 1;
+}
+
+//
+/* Workers */
+//
+
+bool Master::_spawn() {
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::cerr << "Failed to fork worker: " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	if (pid > 0) {
+		_workers[pid] = time(NULL);
+		return true;
+	}
+
+	// Worker: everything (sockets, log writer thread, FastCGI pool) is
+	// created here, after the fork
+#if defined(__linux__)
+	prctl(PR_SET_PDEATHSIG, SIGTERM); // do not outlive a killed master
+#endif
+	int status = 0;
+	try {
+		Server server(_config_file, true);
+		server.run();
+	} catch (const std::exception& e) {
+		std::cerr << "Worker " << getpid() << ": " << e.what() << std::endl;
+		status = 1;
+	}
+	std::exit(status);
+}
+
+bool Master::_reap(time_t now) {
+	bool healthy = true;
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		std::map<pid_t, time_t>::iterator it = _workers.find(pid);
+		if (it == _workers.end()) {
+			_draining.erase(pid);
+			continue;
+		}
+		bool early = now - it->second < WORKER_STARTUP_GRACE;
+		_workers.erase(it);
+		if (g_shutdown)
+			continue;
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0 && early) {
+			healthy = false; // bad config or port taken: respawning will not help
+			continue;
+		}
+		std::cerr << "Worker " << pid << " exited ("
+		          << (WIFSIGNALED(status) ? "signal " : "status ")
+		          << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status))
+		          << "), restarting" << std::endl;
+	}
+	return healthy;
+}
+
+void Master::_stopWorkers(int signal, time_t timeout) {
+	_workers.insert(_draining.begin(), _draining.end());
+	_draining.clear();
+	for (std::map<pid_t, time_t>::iterator it = _workers.begin(); it != _workers.end(); ++it)
+		kill(it->first, signal);
+
+	// Workers finish the loop iteration they are in and close their clients
+	time_t deadline = time(NULL) + timeout;
+	while (!_workers.empty()) {
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0) {
+			_workers.erase(pid);
+			continue;
+		}
+		if (pid < 0 && errno != EINTR) {
+			_workers.clear(); // no children left
+			break;
+		}
+		if (time(NULL) >= deadline) {
+			for (std::map<pid_t, time_t>::iterator it = _workers.begin(); it != _workers.end(); ++it) {
+				kill(it->first, SIGKILL);
+				waitpid(it->first, NULL, 0);
+			}
+			_workers.clear();
+			break;
+		}
+		usleep(50000);
+	}
+}
+
+//
+/* Supervision */
+//
+
+// The file is checked here first so a broken one reaches no worker
+void Master::_reload() {
+	Config config(_config_file);
+	if (!config.parse(false)) {
+		std::cerr << "Reload: cannot parse " << _config_file << ", workers keep their configuration" << std::endl;
+		return;
+	}
+
+	// Fewer workers: the newest ones stop accepting and finish what they
+	// have; more are started by the supervision loop
+	_count = resolveCount(config.getServerConfig(0).worker_processes);
+	while (_workers.size() > _count) {
+		std::map<pid_t, time_t>::iterator newest = _workers.begin();
+		for (std::map<pid_t, time_t>::iterator it = _workers.begin(); it != _workers.end(); ++it) {
+			if (it->second >= newest->second)
+				newest = it;
+		}
+		kill(newest->first, SIGQUIT);
+		_draining.insert(*newest);
+		_workers.erase(newest);
+	}
+	for (std::map<pid_t, time_t>::iterator it = _workers.begin(); it != _workers.end(); ++it)
+		kill(it->first, SIGHUP);
+	std::cout << "Master " << getpid() << ": reloaded, " << _count << " worker processes" << std::endl;
+}
+
+int Master::run() {
+	for (size_t i = 0; i < _count; ++i) {
+		if (!_spawn()) {
+			_stopWorkers();
+			return 1;
+		}
+	}
+	std::cout << "Master " << getpid() << ": " << _count << " worker processes" << std::endl;
+
+	while (!g_shutdown && !g_drain) {
+		// A signal cuts the sleep short; crashed workers are replaced once a second
+		sleep(1);
+		if (g_reload) {
+			g_reload = 0;
+			_reload();
+		}
+		if (!_reap(time(NULL))) {
+			std::cerr << "Worker failed to start, shutting down" << std::endl;
+			_stopWorkers();
+			return 1;
+		}
+		while (!g_shutdown && !g_drain && _workers.size() < _count && _spawn()) {}
+	}
+
+	if (g_shutdown)
+		_stopWorkers();
+	else
+		_stopWorkers(SIGQUIT, DRAIN_TIMEOUT + WORKER_STOP_TIMEOUT);
+	return 0;
+}
@@ -0,0 +1,227 @@
+#include "Metrics.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#define PROMETHEUS_FIRST_BIT 4  // histogram buckets from 16us...
+#define PROMETHEUS_LAST_BIT 26  // ...to 67s, powers of two
+
+static const char* const g_phase_names[PHASE_COUNT] = { "parse", "handler", "flush" };
+
+//
+/* LatencyHistogram */
+//
+
+LatencyHistogram::LatencyHistogram() : _total(0), _sum_us(0), _max_us(0) {
+	std::memset(_counts, 0, sizeof(_counts));
+}
+
+size_t LatencyHistogram::bucketOf(unsigned long long us) {
+	if (us < METRICS_SUB_BUCKETS)
+		return static_cast<size_t>(us);
+	int bit = 63 - __builtin_clzll(us);
+	if (bit > METRICS_MAX_BIT)
+		return METRICS_BUCKETS - 1;
+	// The power of two picks the row, the next bits below it the column
+	size_t sub = static_cast<size_t>(us >> (bit - METRICS_SUB_BITS)) - METRICS_SUB_BUCKETS;
+	return METRICS_SUB_BUCKETS * (bit - METRICS_SUB_BITS + 1) + sub;
+}
+
+unsigned long long LatencyHistogram::bucketLow(size_t index) {
+	if (index < METRICS_SUB_BUCKETS)
+		return index;
+	size_t row = index / METRICS_SUB_BUCKETS - 1;
+	size_t sub = index % METRICS_SUB_BUCKETS;
+	return static_cast<unsigned long long>(METRICS_SUB_BUCKETS + sub) << row;
+}
+
+void LatencyHistogram::record(long long us) {
+	unsigned long long value = us > 0 ? static_cast<unsigned long long>(us) : 0;
+	_counts[bucketOf(value)]++;
+	_total++;
+	_sum_us += value;
+	if (value > _max_us)
+		_max_us = value;
+}
+
+unsigned long long LatencyHistogram::quantile(double q) const {
+	if (_total == 0)
+		return 0;
+	unsigned long long rank = static_cast<unsigned long long>(q * _total + 0.5);
+	if (rank == 0)
+		rank = 1;
+	unsigned long long seen = 0;
+	for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+		seen += _counts[i];
+		if (seen >= rank) {
+			unsigned long long high = i + 1 < METRICS_BUCKETS ? bucketLow(i + 1) - 1 : _max_us;
+			return high < _max_us ? high : _max_us;
+		}
+	}
+	return _max_us;
+}
+
+unsigned long long LatencyHistogram::countBelow(unsigned long long limit_us) const {
+	size_t end = bucketOf(limit_us);
+	unsigned long long total = 0;
+	for (size_t i = 0; i < end; ++i)
+		total += _counts[i];
+	return total;
+}
+
+//
+/* Metrics */
+//
+
+unsigned long long Metrics::_counters[COUNTER_COUNT];
+unsigned long long Metrics::_responses[6];
+LatencyHistogram Metrics::_phases[PHASE_COUNT];
+time_t Metrics::_started = 0;
+
+void Metrics::reset(time_t now) {
+	std::memset(_counters, 0, sizeof(_counters));
+	std::memset(_responses, 0, sizeof(_responses));
+	for (int i = 0; i < PHASE_COUNT; ++i)
+		_phases[i] = LatencyHistogram();
+	_started = now;
+}
+
+void Metrics::response(int status, size_t bytes) {
+	int status_class = status / 100;
+	_responses[status_class >= 1 && status_class <= 5 ? status_class : 0]++;
+	_counters[COUNTER_RESPONSE_BYTES] += bytes;
+}
+
+//
+/* Rendering */
+//
+
+static void appendf(std::string& out, const char* format, unsigned long long a) {
+	char buf[128];
+	snprintf(buf, sizeof(buf), format, a);
+	out += buf;
+}
+
+void Metrics::renderText(const ConnectionGauge& gauge, time_t now, std::string& out) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), "Active connections: %lu \n", static_cast<unsigned long>(gauge.active));
+	out += buf;
+	out += "server accepts handled requests\n";
+	snprintf(buf, sizeof(buf), " %llu %llu %llu \n", _counters[COUNTER_ACCEPTED],
+	         _counters[COUNTER_HANDLED], _counters[COUNTER_REQUESTS]);
+	out += buf;
+	snprintf(buf, sizeof(buf), "Reading: %lu Writing: %lu Waiting: %lu \n",
+	         static_cast<unsigned long>(gauge.reading), static_cast<unsigned long>(gauge.writing),
+	         static_cast<unsigned long>(gauge.waiting));
+	out += buf;
+
+	appendf(out, "Uptime: %llu\n", static_cast<unsigned long long>(now - _started));
+	snprintf(buf, sizeof(buf), "Responses: 1xx %llu 2xx %llu 3xx %llu 4xx %llu 5xx %llu\n",
+	         _responses[1], _responses[2], _responses[3], _responses[4], _responses[5]);
+	out += buf;
+	appendf(out, "Bytes sent: %llu\n", _counters[COUNTER_RESPONSE_BYTES]);
+	appendf(out, "Parse errors: %llu\n", _counters[COUNTER_PARSE_ERRORS]);
+	snprintf(buf, sizeof(buf), "CGI spawned: %llu FastCGI requests: %llu\n",
+	         _counters[COUNTER_CGI_SPAWNED], _counters[COUNTER_FASTCGI_REQUESTS]);
+	out += buf;
+	appendf(out, "Proxied requests: %llu\n", _counters[COUNTER_PROXY_REQUESTS]);
+	snprintf(buf, sizeof(buf), "Timeouts: client %llu cgi %llu\n",
+	         _counters[COUNTER_CLIENT_TIMEOUTS], _counters[COUNTER_CGI_TIMEOUTS]);
+	out += buf;
+	appendf(out, "Rejected: %llu\n", _counters[COUNTER_REJECTED]);
+	snprintf(buf, sizeof(buf), "CGI cache: hits %llu coalesced %llu\n",
+	         _counters[COUNTER_CGI_CACHE_HITS], _counters[COUNTER_CGI_CACHE_COALESCED]);
+	out += buf;
+
+	out += "Latency (us): count p50 p90 p99 p99.9 max\n";
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		const LatencyHistogram& h = _phases[i];
+		snprintf(buf, sizeof(buf), "%s: %llu %llu %llu %llu %llu %llu\n", g_phase_names[i],
+		         h.count(), h.quantile(0.5), h.quantile(0.9), h.quantile(0.99), h.quantile(0.999), h.max());
+		out += buf;
+	}
+}
+
+static void appendMetric(std::string& out, const char* name, const char* type, const char* help) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+static void appendSample(std::string& out, const char* name, const char* labels, unsigned long long value) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s%s %llu\n", name, labels, value);
+	out += buf;
+}
+
+void Metrics::renderPrometheus(const ConnectionGauge& gauge, time_t now, std::string& out) {
+	appendMetric(out, "webserv_uptime_seconds", "gauge", "Seconds since the server started.");
+	appendSample(out, "webserv_uptime_seconds", "", static_cast<unsigned long long>(now - _started));
+
+	appendMetric(out, "webserv_connections", "gauge", "Open client connections by state.");
+	appendSample(out, "webserv_connections", "{state=\"active\"}", gauge.active);
+	appendSample(out, "webserv_connections", "{state=\"reading\"}", gauge.reading);
+	appendSample(out, "webserv_connections", "{state=\"writing\"}", gauge.writing);
+	appendSample(out, "webserv_connections", "{state=\"waiting\"}", gauge.waiting);
+
+	appendMetric(out, "webserv_connections_accepted_total", "counter", "Accepted client connections.");
+	appendSample(out, "webserv_connections_accepted_total", "", _counters[COUNTER_ACCEPTED]);
+	appendMetric(out, "webserv_connections_handled_total", "counter", "Accepted connections given a client slot.");
+	appendSample(out, "webserv_connections_handled_total", "", _counters[COUNTER_HANDLED]);
+
+	appendMetric(out, "webserv_requests_total", "counter", "Parsed requests.");
+	appendSample(out, "webserv_requests_total", "", _counters[COUNTER_REQUESTS]);
+	appendMetric(out, "webserv_parse_errors_total", "counter", "Requests rejected by the parser.");
+	appendSample(out, "webserv_parse_errors_total", "", _counters[COUNTER_PARSE_ERRORS]);
+
+	appendMetric(out, "webserv_responses_total", "counter", "Responses by status class.");
+	const char* const classes[] = { "{code=\"other\"}", "{code=\"1xx\"}", "{code=\"2xx\"}",
+	                                "{code=\"3xx\"}", "{code=\"4xx\"}", "{code=\"5xx\"}" };
+	for (int i = 0; i < 6; ++i)
+		appendSample(out, "webserv_responses_total", classes[i], _responses[i]);
+	appendMetric(out, "webserv_response_body_bytes_total", "counter", "Response body bytes queued.");
+	appendSample(out, "webserv_response_body_bytes_total", "", _counters[COUNTER_RESPONSE_BYTES]);
+
+	appendMetric(out, "webserv_cgi_spawned_total", "counter", "CGI processes started.");
+	appendSample(out, "webserv_cgi_spawned_total", "", _counters[COUNTER_CGI_SPAWNED]);
+	appendMetric(out, "webserv_fastcgi_requests_total", "counter", "Requests handed to FastCGI backends.");
+	appendSample(out, "webserv_fastcgi_requests_total", "", _counters[COUNTER_FASTCGI_REQUESTS]);
+	appendMetric(out, "webserv_proxy_requests_total", "counter", "Requests handed to proxy_pass upstreams.");
+	appendSample(out, "webserv_proxy_requests_total", "", _counters[COUNTER_PROXY_REQUESTS]);
+
+	appendMetric(out, "webserv_timeouts_total", "counter", "Expired deadlines.");
+	appendSample(out, "webserv_timeouts_total", "{kind=\"client\"}", _counters[COUNTER_CLIENT_TIMEOUTS]);
+	appendSample(out, "webserv_timeouts_total", "{kind=\"cgi\"}", _counters[COUNTER_CGI_TIMEOUTS]);
+	appendMetric(out, "webserv_rejected_total", "counter", "Connections and requests shed with a 503 (overload, limits).");
+	appendSample(out, "webserv_rejected_total", "", _counters[COUNTER_REJECTED]);
+	appendMetric(out, "webserv_cgi_cache_total", "counter", "Script requests answered by the micro-cache.");
+	appendSample(out, "webserv_cgi_cache_total", "{result=\"hit\"}", _counters[COUNTER_CGI_CACHE_HITS]);
+	appendSample(out, "webserv_cgi_cache_total", "{result=\"coalesced\"}", _counters[COUNTER_CGI_CACHE_COALESCED]);
+
+	// Bucket bounds are powers of two, which the log-linear buckets hit exactly
+	const char* name = "webserv_request_phase_seconds";
+	appendMetric(out, name, "histogram", "Request latency by phase.");
+	char labels[96];
+	char buf[256];
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		const LatencyHistogram& h = _phases[i];
+		for (int bit = PROMETHEUS_FIRST_BIT; bit <= PROMETHEUS_LAST_BIT; ++bit) {
+			unsigned long long limit = 1ULL << bit;
+			snprintf(labels, sizeof(labels), "{phase=\"%s\",le=\"%g\"}", g_phase_names[i], limit / 1e6);
+			snprintf(buf, sizeof(buf), "%s_bucket%s %llu\n", name, labels, h.countBelow(limit));
+			out += buf;
+		}
+		snprintf(buf, sizeof(buf), "%s_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n", name, g_phase_names[i], h.count());
+		out += buf;
+		snprintf(buf, sizeof(buf), "%s_sum{phase=\"%s\"} %.6f\n", name, g_phase_names[i], h.sum() / 1e6);
+		out += buf;
+		snprintf(buf, sizeof(buf), "%s_count{phase=\"%s\"} %llu\n", name, g_phase_names[i], h.count());
+		out += buf;
+	}
+}
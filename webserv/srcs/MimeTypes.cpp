@@ -0,0 +1,115 @@
+#include "MimeTypes.hpp"
+#include <algorithm>
+#include <cctype>
+
+std::vector<MimeType> MimeTypes::_types;
+std::string MimeTypes::_default = MIME_DEFAULT_TYPE;
+
+// Kept in extension order, the table is copied as is
+static const struct {
+	const char* extension;
+	const char* type;
+} builtin_types[] = {
+	{ "7z", "application/x-7z-compressed" },
+	{ "avif", "image/avif" },
+	{ "bmp", "image/bmp" },
+	{ "css", "text/css" },
+	{ "csv", "text/csv" },
+	{ "gif", "image/gif" },
+	{ "gz", "application/gzip" },
+	{ "htm", "text/html" },
+	{ "html", "text/html" },
+	{ "ico", "image/x-icon" },
+	{ "jpeg", "image/jpeg" },
+	{ "jpg", "image/jpeg" },
+	{ "js", "application/javascript" },
+	{ "json", "application/json" },
+	{ "map", "application/json" },
+	{ "md", "text/markdown" },
+	{ "mjs", "application/javascript" },
+	{ "mp3", "audio/mpeg" },
+	{ "mp4", "video/mp4" },
+	{ "ogg", "audio/ogg" },
+	{ "otf", "font/otf" },
+	{ "pdf", "application/pdf" },
+	{ "png", "image/png" },
+	{ "svg", "image/svg+xml" },
+	{ "tar", "application/x-tar" },
+	{ "ttf", "font/ttf" },
+	{ "txt", "text/plain" },
+	{ "wasm", "application/wasm" },
+	{ "wav", "audio/wav" },
+	{ "webm", "video/webm" },
+	{ "webp", "image/webp" },
+	{ "woff", "font/woff" },
+	{ "woff2", "font/woff2" },
+	{ "xml", "application/xml" },
+	{ "zip", "application/zip" }
+};
+
+void MimeTypes::reset() {
+	size_t count = sizeof(builtin_types) / sizeof(builtin_types[0]);
+	_types.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		_types[i].extension = builtin_types[i].extension;
+		_types[i].type = builtin_types[i].type;
+	}
+	std::sort(_types.begin(), _types.end()); // in case an edit broke the order
+}
+
+void MimeTypes::add(const std::string& extension, const std::string& type) {
+	if (_types.empty())
+		reset();
+	MimeType entry;
+	entry.extension = extension.substr(!extension.empty() && extension[0] == '.' ? 1 : 0);
+	for (size_t i = 0; i < entry.extension.size(); ++i)
+		entry.extension[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(entry.extension[i])));
+	entry.type = type;
+	if (entry.extension.empty() || type.empty())
+		return;
+	std::vector<MimeType>::iterator it = std::lower_bound(_types.begin(), _types.end(), entry);
+	if (it != _types.end() && it->extension == entry.extension)
+		it->type = type;
+	else
+		_types.insert(it, entry);
+}
+
+// <0, 0, >0 as `stored` sorts before, equal to or after the extension
+// being looked up, which is folded to lowercase on the fly
+static int compareExtension(const std::string& stored, const char* extension, size_t length) {
+	size_t common = std::min(stored.size(), length);
+	for (size_t i = 0; i < common; ++i) {
+		unsigned char a = static_cast<unsigned char>(stored[i]);
+		unsigned char b = static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(extension[i])));
+		if (a != b)
+			return a < b ? -1 : 1;
+	}
+	if (stored.size() == length)
+		return 0;
+	return stored.size() < length ? -1 : 1;
+}
+
+const std::string& MimeTypes::forExtension(const char* extension, size_t length) {
+	if (_types.empty())
+		reset();
+	size_t low = 0;
+	size_t high = _types.size();
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		int order = compareExtension(_types[middle].extension, extension, length);
+		if (order == 0)
+			return _types[middle].type;
+		if (order < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return _default;
+}
+
+const std::string& MimeTypes::lookup(const std::string& path) {
+	size_t dot = path.find_last_of("./");
+	if (dot == std::string::npos || path[dot] != '.' || dot + 1 == path.size())
+		return _default;
+	return forExtension(path.data() + dot + 1, path.size() - dot - 1);
+}
@@ -0,0 +1,279 @@
+#include "MultipartParser.hpp"
+#include <sstream>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MAX_PART_HEADERS 8192
+#define MAX_BOUNDARY_PADDING 128
+
+static unsigned long temp_counter = 0;
+
+static std::string toLower(const std::string& str) {
+    std::string lower = str;
+    for (size_t i = 0; i < lower.size(); ++i)
+        lower[i] = std::tolower(static_cast<unsigned char>(lower[i]));
+    return lower;
+}
+
+static std::string trim(const std::string& str) {
+    size_t first = str.find_first_not_of(" \t");
+    if (first == std::string::npos)
+        return "";
+    size_t last = str.find_last_not_of(" \t");
+    return str.substr(first, last - first + 1);
+}
+
+// filename="a.txt" or filename=a.txt (filename*= is not supported)
+static std::string extractFilename(const std::string& disposition) {
+    std::string lower = toLower(disposition);
+    size_t pos = 0;
+    while ((pos = lower.find("filename", pos)) != std::string::npos) {
+        size_t value = pos + 8;
+        bool at_param = pos == 0 || lower[pos - 1] == ';' || lower[pos - 1] == ' ' || lower[pos - 1] == '\t';
+        pos = value;
+        if (!at_param || value >= lower.size() || lower[value] != '=')
+            continue;
+        ++value;
+        if (value < disposition.size() && disposition[value] == '"') {
+            size_t end = disposition.find('"', value + 1);
+            if (end == std::string::npos)
+                return "";
+            return disposition.substr(value + 1, end - value - 1);
+        }
+        size_t end = disposition.find(';', value);
+        return trim(disposition.substr(value, end == std::string::npos ? std::string::npos : end - value));
+    }
+    return "";
+}
+
+MultipartParser::MultipartParser(const std::string& upload_dir, const std::string& boundary)
+    : directory(upload_dir), delimiter("\r\n--" + boundary), headers_end("\r\n\r\n"), pending("\r\n"),
+      state(PREAMBLE), error_code(0), fd(-1) {
+    // The leading CRLF lets the first boundary match the same delimiter as the others
+    if (directory.empty())
+        directory = ".";
+    if (directory[directory.size() - 1] != '/')
+        directory += '/';
+}
+
+MultipartParser::~MultipartParser() {
+    discardPart();
+}
+
+std::string MultipartParser::sanitizeFilename(const std::string& filename) {
+    std::string safe_name = filename;
+    
+    // Remove path separators and parent directory references
+    size_t last_slash = safe_name.find_last_of("/\\");
+    if (last_slash != std::string::npos) {
+        safe_name = safe_name.substr(last_slash + 1);
+    }
+    
+    // Remove dangerous characters
+    std::string result;
+    for (size_t i = 0; i < safe_name.length(); ++i) {
+        char c = safe_name[i];
+        if (std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '_' || c == '-') {
+            result += c;
+        } else {
+            result += '_';
+        }
+    }
+    
+    // Ensure filename is not empty
+    if (result.empty() || result == "." || result == "..") {
+        result = "uploaded_file";
+    }
+    
+    return result;
+}
+
+bool MultipartParser::fail(int code) {
+    discardPart();
+    state = FAILED;
+    error_code = code;
+    pending.clear();
+    return false;
+}
+
+bool MultipartParser::openTemp() {
+    for (int attempt = 0; attempt < 16; ++attempt) {
+        std::ostringstream name;
+        name << directory << ".upload-" << getpid() << "-" << temp_counter++ << ".part";
+        temp_path = name.str();
+        fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0)
+            return true;
+        if (errno != EEXIST)
+            break;
+    }
+    temp_path.clear();
+    return fail(500);
+}
+
+bool MultipartParser::parsePartHeaders(const std::string& block) {
+    std::string filename;
+    current = UploadedFile();
+    current.content_type = "application/octet-stream";
+    current.size = 0;
+    
+    size_t pos = 0;
+    while (pos < block.size()) {
+        size_t eol = block.find("\r\n", pos);
+        if (eol == std::string::npos)
+            eol = block.size();
+        std::string line = block.substr(pos, eol - pos);
+        pos = eol + 2;
+        
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            return fail(400);
+        std::string name = toLower(trim(line.substr(0, colon)));
+        std::string value = trim(line.substr(colon + 1));
+        if (name == "content-disposition")
+            filename = extractFilename(value);
+        else if (name == "content-type" && !value.empty())
+            current.content_type = value;
+    }
+    
+    // Plain form fields carry no file: their data is skipped
+    if (filename.empty())
+        return true;
+    current.filename = sanitizeFilename(filename);
+    return openTemp();
+}
+
+bool MultipartParser::writePart(const char* data, size_t len) {
+    if (fd < 0)
+        return true;
+    current.size += len;
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return fail(500);
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool MultipartParser::closePart() {
+    if (fd < 0)
+        return true;
+    int rc = close(fd);
+    fd = -1;
+    std::string final_path = directory + current.filename;
+    if (rc != 0 || std::rename(temp_path.c_str(), final_path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        temp_path.clear();
+        return fail(500);
+    }
+    temp_path.clear();
+    saved.push_back(current);
+    return true;
+}
+
+void MultipartParser::discardPart() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (!temp_path.empty()) {
+        unlink(temp_path.c_str());
+        temp_path.clear();
+    }
+}
+
+bool MultipartParser::write(const char* data, size_t len) {
+    if (state == FAILED)
+        return false;
+    if (state == EPILOGUE)
+        return true;
+    
+    // Inside a large part, with nothing carried over: scan the block where
+    // it is, and only keep a tail that could start the delimiter
+    if (pending.empty() && (state == PART_DATA || state == PREAMBLE) &&
+        delimiter.find(data, len) == std::string::npos) {
+        size_t keep = delimiter.partialSuffix(data, len);
+        if (state == PART_DATA && !writePart(data, len - keep))
+            return false;
+        pending.assign(data + len - keep, keep);
+        return true;
+    }
+    pending.append(data, len);
+    
+    while (true) {
+        if (state == PREAMBLE || state == PART_DATA) {
+            size_t pos = delimiter.find(pending.data(), pending.size());
+            if (pos == std::string::npos) {
+                // Everything but a possible delimiter prefix is part data
+                size_t keep = delimiter.partialSuffix(pending.data(), pending.size());
+                if (pending.size() > keep) {
+                    size_t safe = pending.size() - keep;
+                    if (state == PART_DATA && !writePart(pending.data(), safe))
+                        return false;
+                    pending.erase(0, safe);
+                }
+                return true;
+            }
+            if (state == PART_DATA && (!writePart(pending.data(), pos) || !closePart()))
+                return false;
+            pending.erase(0, pos + delimiter.size());
+            state = BOUNDARY_END;
+        } else if (state == BOUNDARY_END) {
+            if (pending.size() < 2)
+                return true;
+            if (pending.compare(0, 2, "--") == 0) {
+                state = EPILOGUE;
+                pending.clear();
+                return true;
+            }
+            // Transport padding may sit between the boundary and its CRLF
+            size_t eol = Scanner::findCrlf(pending.data(), pending.size());
+            if (eol == std::string::npos) {
+                if (pending.size() > MAX_BOUNDARY_PADDING)
+                    return fail(400);
+                return true;
+            }
+            if (pending.find_first_not_of(" \t") < eol)
+                return fail(400);
+            pending.erase(0, eol + 2);
+            state = PART_HEADERS;
+        } else if (state == PART_HEADERS) {
+            if (pending.size() < 2)
+                return true;
+            std::string block;
+            if (pending.compare(0, 2, "\r\n") == 0) {
+                pending.erase(0, 2); // part without headers
+            } else {
+                size_t end = headers_end.find(pending.data(), pending.size());
+                if (end == std::string::npos) {
+                    if (pending.size() > MAX_PART_HEADERS)
+                        return fail(400);
+                    return true;
+                }
+                block = pending.substr(0, end);
+                pending.erase(0, end + 4);
+            }
+            if (!parsePartHeaders(block))
+                return false;
+            state = PART_DATA;
+        } else {
+            return state != FAILED;
+        }
+    }
+}
+
+bool MultipartParser::finish() {
+    if (state == EPILOGUE)
+        return true;
+    if (state == FAILED)
+        return false;
+    return fail(400); // body ended before the close delimiter
+}
@@ -0,0 +1,160 @@
+#include "OutputQueue.hpp"
+
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <sys/sendfile.h>
+#endif
+
+#define MAX_IOVECS 64
+#define FALLBACK_CHUNK 65536
+
+OutputQueue::OutputQueue() : _pending(0) {}
+
+void OutputQueue::push(const SharedBuffer& buffer) {
+	push(buffer, 0, buffer.size());
+}
+
+void OutputQueue::push(const SharedBuffer& buffer, size_t offset, size_t length) {
+	if (length == 0)
+		return;
+	OutputSegment seg;
+	seg.buffer = buffer;
+	seg.offset = static_cast<off_t>(offset);
+	seg.length = length;
+	_segments.push_back(seg);
+	_pending += length;
+}
+
+void OutputQueue::push(const std::string& data) {
+	if (!data.empty())
+		push(SharedBuffer(data));
+}
+
+void OutputQueue::pushFile(const SharedFile& file, off_t offset, size_t length) {
+	if (length == 0 || !file.valid())
+		return;
+	OutputSegment seg;
+	seg.file = file;
+	seg.offset = offset;
+	seg.length = length;
+	_segments.push_back(seg);
+	_pending += length;
+}
+
+void OutputQueue::push(const OutputSegment& segment) {
+	if (segment.length == 0)
+		return;
+	_segments.push_back(segment);
+	_pending += segment.length;
+}
+
+std::string& OutputQueue::headBuffer() {
+	if (_head.unique())
+		_head.writable().clear();
+	else if (_head.size() > HEAD_BUFFER_LIMIT)
+		_head = SharedBuffer(); // still queued: let it go with its last segment
+	return _head.writable();
+}
+
+void OutputQueue::pushHead(size_t start) {
+	push(_head, start, _head.size() - start);
+}
+
+void OutputQueue::clear() {
+	_segments.clear();
+	_pending = 0;
+}
+
+void OutputQueue::swap(OutputQueue& other) {
+	_segments.swap(other._segments);
+	std::swap(_pending, other._pending);
+	SharedBuffer head = _head;
+	_head = other._head;
+	other._head = head;
+}
+
+// Advance past `bytes` of buffer segments at the front of the queue
+void OutputQueue::_consume(size_t bytes) {
+	_pending -= bytes;
+	while (bytes > 0 && !_segments.empty()) {
+		OutputSegment& seg = _segments.front();
+		if (bytes < seg.length) {
+			seg.offset += static_cast<off_t>(bytes);
+			seg.length -= bytes;
+			return;
+		}
+		bytes -= seg.length;
+		_segments.pop_front();
+	}
+}
+
+// Sends up to `length` bytes of a file straight from the page cache.
+// Returns bytes written, 0 when the socket is full, -1 on error or when
+// the file ends early (truncated since it was stat'ed: the promised
+// Content-Length can no longer be met, and no write event would come).
+static ssize_t sendFileRange(int sock, int file_fd, off_t& offset, size_t length) {
+#if defined(__linux__)
+	ssize_t sent = sendfile(sock, file_fd, &offset, length);
+	if (sent < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	if (sent == 0 && length > 0)
+		return -1;
+	return sent;
+#else
+	// Portable fallback: bounce through a stack buffer
+	char buf[FALLBACK_CHUNK];
+	size_t want = length < sizeof(buf) ? length : sizeof(buf);
+	ssize_t n = pread(file_fd, buf, want, offset);
+	if (n <= 0)
+		return -1;
+	ssize_t sent = send(sock, buf, n, 0);
+	if (sent < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	offset += sent;
+	return sent;
+#endif
+}
+
+FlushResult OutputQueue::flush(int fd) {
+	while (!_segments.empty()) {
+		OutputSegment& front = _segments.front();
+
+		if (front.isFile()) {
+			ssize_t sent = sendFileRange(fd, front.file.fd(), front.offset, front.length);
+			if (sent < 0)
+				return FLUSH_ERROR;
+			if (sent == 0)
+				return FLUSH_AGAIN;
+			_pending -= static_cast<size_t>(sent);
+			front.length -= static_cast<size_t>(sent);
+			if (front.length == 0)
+				_segments.pop_front();
+			continue; // keep going until the kernel reports a full socket
+		}
+
+		// Gather consecutive in-memory segments into one writev()
+		struct iovec iov[MAX_IOVECS];
+		int count = 0;
+		size_t total = 0;
+		for (std::deque<OutputSegment>::iterator it = _segments.begin();
+		     it != _segments.end() && count < MAX_IOVECS && !it->isFile(); ++it) {
+			iov[count].iov_base = const_cast<char*>(it->buffer.data() + it->offset);
+			iov[count].iov_len = it->length;
+			total += it->length;
+			count++;
+		}
+
+		ssize_t sent = writev(fd, iov, count);
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return FLUSH_AGAIN;
+		if (sent <= 0)
+			return FLUSH_ERROR;
+		_consume(static_cast<size_t>(sent));
+		if (static_cast<size_t>(sent) < total)
+			return FLUSH_AGAIN;
+	}
+	return FLUSH_DONE;
+}
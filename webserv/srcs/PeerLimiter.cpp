@@ -0,0 +1,77 @@
+#include "PeerLimiter.hpp"
+
+PeerLimiter::PeerLimiter() : _max_connections(0), _rate(0), _burst(0) {}
+
+// Also called on reload: the counts of connections still open are kept, or
+// their disconnect() would find nothing and the peer get a fresh quota
+// on top of its sockets. Buckets shrink to a smaller burst.
+void PeerLimiter::configure(size_t max_connections, double rate, size_t burst) {
+	_max_connections = max_connections;
+	_rate = rate > 0 ? rate : 0;
+	// A burst of 0 still lets a peer at the configured rate through
+	_burst = burst > 0 ? static_cast<double>(burst) : 1;
+	for (std::map<unsigned int, PeerState>::iterator it = _peers.begin(); it != _peers.end(); ++it) {
+		if (it->second.tokens > _burst)
+			it->second.tokens = _burst;
+	}
+}
+
+PeerState& PeerLimiter::_peer(unsigned int addr, long long now_us) {
+	std::map<unsigned int, PeerState>::iterator it = _peers.find(addr);
+	if (it != _peers.end())
+		return it->second;
+	PeerState& peer = _peers[addr];
+	peer.connections = 0;
+	peer.tokens = _burst; // new peers start with a full bucket
+	peer.updated_us = now_us;
+	return peer;
+}
+
+void PeerLimiter::_refill(PeerState& peer, long long now_us) const {
+	if (now_us > peer.updated_us) {
+		peer.tokens += _rate * (now_us - peer.updated_us) / 1e6;
+		if (peer.tokens > _burst)
+			peer.tokens = _burst;
+	}
+	peer.updated_us = now_us;
+}
+
+bool PeerLimiter::connect(unsigned int addr, long long now_us) {
+	if (!enabled())
+		return true;
+	PeerState& peer = _peer(addr, now_us);
+	if (_max_connections > 0 && peer.connections >= _max_connections)
+		return false;
+	peer.connections++;
+	return true;
+}
+
+void PeerLimiter::disconnect(unsigned int addr) {
+	std::map<unsigned int, PeerState>::iterator it = _peers.find(addr);
+	if (it != _peers.end() && it->second.connections > 0)
+		it->second.connections--;
+}
+
+bool PeerLimiter::allowRequest(unsigned int addr, long long now_us) {
+	if (_rate <= 0)
+		return true;
+	PeerState& peer = _peer(addr, now_us);
+	_refill(peer, now_us);
+	if (peer.tokens < 1)
+		return false;
+	peer.tokens -= 1;
+	return true;
+}
+
+void PeerLimiter::sweep(long long now_us) {
+	std::map<unsigned int, PeerState>::iterator it = _peers.begin();
+	while (it != _peers.end()) {
+		PeerState& peer = it->second;
+		if (_rate > 0)
+			_refill(peer, now_us);
+		if (peer.connections == 0 && (_rate <= 0 || peer.tokens >= _burst))
+			_peers.erase(it++);
+		else
+			++it;
+	}
+}
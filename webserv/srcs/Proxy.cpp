@@ -0,0 +1,807 @@
+#include "Proxy.hpp"
+#include "ChunkedEncoder.hpp"
+#include "Config.hpp"
+#include "HttpResponse.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#define PROXY_MAX_CHUNK_LINE 1024
+
+static bool resolveAddress(const std::string& address, ProxyServer* server) {
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+		return false;
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+	if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+		host = host.substr(1, host.size() - 2);
+
+	struct addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = NULL;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+		return false;
+	std::memcpy(&server->addr, res->ai_addr, res->ai_addrlen);
+	server->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	std::string name = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+	for (size_t i = 0; i < name.size(); ++i)
+		name[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(name[i])));
+	server->authority = port == "80" ? name : name + ":" + port;
+	return true;
+}
+
+static bool equalsIgnoreCase(const std::string& a, const char* b) {
+	size_t len = std::strlen(b);
+	if (a.size() != len)
+		return false;
+	for (size_t i = 0; i < len; ++i) {
+		if (std::tolower(static_cast<unsigned char>(a[i])) != b[i])
+			return false;
+	}
+	return true;
+}
+
+// Comma-separated token of a header value, case-insensitive
+static bool hasToken(const std::string& value, const char* token) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t end = value.find(',', start);
+		if (end == std::string::npos)
+			end = value.size();
+		size_t first = value.find_first_not_of(" \t", start);
+		size_t last = end > start ? value.find_last_not_of(" \t", end - 1) : std::string::npos;
+		if (first < end && last != std::string::npos && last >= first &&
+		    equalsIgnoreCase(value.substr(first, last - first + 1), token))
+			return true;
+		start = end + 1;
+	}
+	return false;
+}
+
+// Offset just past the blank line ending the head, npos while incomplete
+static size_t findHeadEnd(const char* data, size_t size, size_t& head_length) {
+	for (size_t i = 0; i < size; ++i) {
+		if (data[i] != '\n')
+			continue;
+		if (i + 1 < size && data[i + 1] == '\n') {
+			head_length = i;
+			return i + 2;
+		}
+		if (i + 2 < size && data[i + 1] == '\r' && data[i + 2] == '\n') {
+			head_length = i;
+			return i + 3;
+		}
+	}
+	return std::string::npos;
+}
+
+//
+/* ProxyRequest */
+//
+
+ProxyRequest::ProxyRequest(ProxyUpstream* upstream, int client_fd, time_t deadline, const std::string& head,
+                           const SharedBuffer& body, bool head_only, bool idempotent)
+	: CgiStream(client_fd, deadline), _upstream(upstream), _server(NULL), _conn(NULL), _head(head),
+	  _body(body), _head_only(head_only), _idempotent(idempotent), _got_output(false), _ended(false),
+	  _status(0), _streaming(false), _body_chunked(false), _body_done(true), _body_blocked(false),
+	  _timeout(0), _sink(NULL) {}
+
+ProxyRequest::~ProxyRequest() {
+	if (_sink)
+		_sink->detach();
+}
+
+int ProxyRequest::parseHeaders(const char* data, size_t len, HttpResponse& response, std::string& body) {
+	response.setStatusCode(_status);
+	for (size_t i = 0; i < _headers.size(); ++i)
+		response.addHeader(_headers[i].first, _headers[i].second);
+	std::vector<std::pair<std::string, std::string> >().swap(_headers);
+	body.assign(data, len);
+	_headers_done = true;
+	return 1;
+}
+
+int ProxyRequest::outputFd() const {
+	return _conn ? _conn->fd : -1;
+}
+
+const std::string& ProxyRequest::address() const {
+	return _server ? _server->address : _upstream->name;
+}
+
+//
+/* ProxyBodySink */
+//
+
+ProxyBodySink::ProxyBodySink(ProxyPool* pool, ProxyRequest* request) : _pool(pool), _request(request) {
+	request->_sink = this;
+}
+
+ProxyBodySink::~ProxyBodySink() {
+	if (_request)
+		_request->_sink = NULL;
+}
+
+bool ProxyBodySink::write(const char* data, size_t len) {
+	if (_request)
+		_pool->sendBody(_request, data, len);
+	return true; // the exchange decides the response, not the body
+}
+
+bool ProxyBodySink::finish() {
+	if (_request)
+		_pool->endBody(_request);
+	return true;
+}
+
+//
+/* Pool setup */
+//
+
+ProxyPool::ProxyPool(EventLoop* loop) : _loop(loop), _now(time(NULL)) {}
+
+ProxyPool::~ProxyPool() {
+	_purge();
+	for (std::map<int, ProxyConnection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+		_loop->remove(it->first);
+		close(it->first);
+		delete it->second->request;
+		delete it->second;
+	}
+	for (std::map<std::string, ProxyServer*>::iterator it = _servers.begin(); it != _servers.end(); ++it)
+		delete it->second;
+	for (std::map<std::string, ProxyUpstream*>::iterator it = _upstreams.begin(); it != _upstreams.end(); ++it)
+		delete it->second;
+}
+
+std::string ProxyPool::upstreamName(const LocationConfig& location) {
+	std::string name;
+	for (size_t i = 0; i < location.proxy_pass.size(); ++i) {
+		if (i > 0)
+			name += ' ';
+		name += location.proxy_pass[i];
+	}
+	return name;
+}
+
+const std::string& ProxyPool::authority(const std::string& upstream) const {
+	static const std::string none;
+	std::map<std::string, ProxyUpstream*>::const_iterator it = _upstreams.find(upstream);
+	if (it == _upstreams.end() || it->second->servers.empty())
+		return none;
+	return it->second->servers[0]->authority;
+}
+
+bool ProxyPool::addUpstream(const LocationConfig& location) {
+	std::string name = upstreamName(location);
+	if (_upstreams.find(name) != _upstreams.end())
+		return true; // shared by several locations: the first one's settings win
+
+	ProxyUpstream* upstream = new ProxyUpstream();
+	upstream->name = name;
+	upstream->least_conn = location.proxy_least_conn;
+	upstream->max_fails = location.proxy_max_fails;
+	upstream->fail_timeout = location.proxy_fail_timeout;
+	for (size_t i = 0; i < location.proxy_pass.size(); ++i) {
+		const std::string& address = location.proxy_pass[i];
+		std::map<std::string, ProxyServer*>::iterator it = _servers.find(address);
+		ProxyServer* server;
+		if (it != _servers.end()) {
+			server = it->second;
+		} else {
+			server = new ProxyServer();
+			server->address = address;
+			if (!resolveAddress(address, server)) {
+				delete server;
+				delete upstream;
+				return false;
+			}
+			_servers[address] = server;
+		}
+		server->keepalive = std::max(server->keepalive, location.proxy_keepalive);
+		upstream->servers.push_back(server);
+	}
+	_upstreams[name] = upstream;
+	return true;
+}
+
+void ProxyPool::tick(time_t now, std::vector<ProxyRequest*>& expired) {
+	_now = now;
+	_purge();
+	std::vector<ProxyConnection*> stale;
+	for (std::map<int, ProxyConnection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+		ProxyConnection* conn = it->second;
+		if (conn->request) {
+			if (now >= conn->request->deadline()) {
+				// An upstream that never answers is as failed as one that refuses
+				_markFailed(conn->request->_upstream, conn->server);
+				expired.push_back(conn->request);
+			}
+		} else if (now - conn->idle_since >= PROXY_IDLE_TIMEOUT) {
+			stale.push_back(conn);
+		}
+	}
+	for (size_t i = 0; i < stale.size(); ++i)
+		_closeConnection(stale[i]);
+}
+
+void ProxyPool::_purge() {
+	for (size_t i = 0; i < _released.size(); ++i)
+		delete _released[i];
+	_released.clear();
+}
+
+//
+/* Balancing and passive health checks */
+//
+
+// Next untried server that is not marked down: round-robin, or the one with
+// the fewest requests in flight (ties broken round-robin). A group of one
+// is never marked down, there would be nothing else to try.
+ProxyServer* ProxyPool::_pick(ProxyUpstream* upstream, const ProxyRequest* request) {
+	size_t count = upstream->servers.size();
+	ProxyServer* best = NULL;
+	size_t best_index = 0;
+	for (size_t i = 0; i < count; ++i) {
+		size_t index = (upstream->next + i) % count;
+		ProxyServer* server = upstream->servers[index];
+		if (std::find(request->_tried.begin(), request->_tried.end(), server) != request->_tried.end())
+			continue;
+		if (count > 1 && server->down_until > _now)
+			continue;
+		if (!best || (upstream->least_conn && server->active < best->active)) {
+			best = server;
+			best_index = index;
+		}
+		if (!upstream->least_conn)
+			break;
+	}
+	if (best) {
+		upstream->next = (best_index + 1) % count;
+	} else if (request->_tried.empty()) {
+		// Every server is out: this request fails, the next ones try them all again
+		for (size_t i = 0; i < count; ++i)
+			upstream->servers[i]->down_until = 0;
+	}
+	return best;
+}
+
+void ProxyPool::_markFailed(ProxyUpstream* upstream, ProxyServer* server) {
+	if (upstream->max_fails == 0 || upstream->servers.size() < 2)
+		return;
+	if (_now - server->fail_start >= upstream->fail_timeout) {
+		server->fails = 0;
+		server->fail_start = _now;
+	}
+	if (++server->fails >= upstream->max_fails) {
+		WS_WARN("Upstream " << server->address << " marked down for " << upstream->fail_timeout << "s");
+		server->fails = 0;
+		server->down_until = _now + upstream->fail_timeout;
+	}
+}
+
+//
+/* Connections */
+//
+
+ProxyConnection* ProxyPool::_connect(ProxyServer* server) {
+	int fd = socket(server->addr.ss_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return NULL;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	int rc = connect(fd, reinterpret_cast<struct sockaddr*>(&server->addr), server->addr_len);
+	if (rc < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return NULL;
+	}
+
+	ProxyConnection* conn = new ProxyConnection();
+	conn->fd = fd;
+	conn->server = server;
+	conn->connected = rc == 0;
+	// Level-triggered; write interest is dropped once the request is flushed
+	_loop->add(fd, EVENT_READ | EVENT_WRITE);
+	_connections[fd] = conn;
+	return conn;
+}
+
+void ProxyPool::_closeConnection(ProxyConnection* conn) {
+	ProxyServer* server = conn->server;
+	_loop->remove(conn->fd);
+	close(conn->fd);
+	_connections.erase(conn->fd);
+	if (conn->request) {
+		server->active--;
+		conn->request->_conn = NULL;
+	} else {
+		std::vector<ProxyConnection*>::iterator it = std::find(server->idle.begin(), server->idle.end(), conn);
+		if (it != server->idle.end())
+			server->idle.erase(it);
+	}
+	delete conn;
+}
+
+// Servers are tried in balancer order until one takes the request: an idle
+// pooled connection first, else a new one
+bool ProxyPool::_dispatch(ProxyRequest* request) {
+	while (ProxyServer* server = _pick(request->_upstream, request)) {
+		request->_tried.push_back(server);
+		request->_server = server;
+		ProxyConnection* conn = NULL;
+		if (!server->idle.empty() && !request->_streaming) {
+			conn = server->idle.back();
+			server->idle.pop_back();
+		} else if (!(conn = _connect(server))) {
+			_markFailed(request->_upstream, server);
+			continue;
+		}
+		_begin(conn, request);
+		return true;
+	}
+	return false;
+}
+
+void ProxyPool::_begin(ProxyConnection* conn, ProxyRequest* request) {
+	conn->request = request;
+	conn->server->active++;
+	conn->state = PROXY_HEAD;
+	conn->chunk_state = CHUNK_SIZE;
+	conn->remaining = 0;
+	conn->reusable = false;
+	conn->input.clear();
+	request->_conn = conn;
+
+	// Head and body go out as slices of shared buffers, never copied; a
+	// streamed one moves on with what the failed connection never sent
+	if (!request->_unsent.empty()) {
+		conn->output.swap(request->_unsent);
+	} else {
+		conn->output.push(request->_head);
+		if (!request->_body.empty())
+			conn->output.push(request->_body);
+	}
+	_loop->setReadInterest(conn->fd, true);
+	_loop->setWriteInterest(conn->fd, true);
+}
+
+// The exchange on `conn` broke. A request with no response yet goes to the
+// next server, unless it may already have been acted on (a non-idempotent
+// request that reached a fresh connection); a reused connection closed
+// while idle is retried without counting against the server. A streamed
+// body is not kept: only a connection that never connected hands it on.
+void ProxyPool::_fail(ProxyConnection* conn, bool server_fault, std::vector<ProxyEvent>& events) {
+	ProxyRequest* request = conn->request;
+	ProxyServer* server = conn->server;
+	bool reached = conn->connected && server_fault;
+	bool retry = request && (request->_streaming ? !conn->connected : request->_idempotent || !reached);
+	if (retry && request->_streaming)
+		request->_unsent.swap(conn->output);
+	_closeConnection(conn);
+	if (!request)
+		return;
+
+	if (server_fault)
+		_markFailed(request->_upstream, server);
+	else
+		request->_tried.pop_back(); // same server, on a fresh connection this time
+	if (!request->_got_output && retry && _dispatch(request))
+		return;
+	ProxyEvent ev;
+	ev.request = request;
+	ev.type = PROXY_EVENT_ERROR;
+	events.push_back(ev);
+}
+
+//
+/* Requests */
+//
+
+ProxyRequest* ProxyPool::submit(const std::string& upstream, int client_fd, time_t deadline,
+                                const std::string& head, const SharedBuffer& body, bool head_only,
+                                bool idempotent) {
+	std::map<std::string, ProxyUpstream*>::iterator it = _upstreams.find(upstream);
+	if (it == _upstreams.end())
+		return NULL;
+	ProxyRequest* request = new ProxyRequest(it->second, client_fd, deadline, head, body, head_only, idempotent);
+	if (!_dispatch(request)) {
+		delete request;
+		return NULL;
+	}
+	return request;
+}
+
+ProxyRequest* ProxyPool::submitStreamed(const std::string& upstream, int client_fd, time_t deadline,
+                                        const std::string& head, bool chunked, bool head_only,
+                                        bool idempotent) {
+	std::map<std::string, ProxyUpstream*>::iterator it = _upstreams.find(upstream);
+	if (it == _upstreams.end())
+		return NULL;
+	ProxyRequest* request = new ProxyRequest(it->second, client_fd, deadline, head, SharedBuffer(), head_only,
+	                                         idempotent);
+	request->_streaming = true;
+	request->_body_chunked = chunked;
+	request->_body_done = false;
+	request->_timeout = deadline - _now;
+	if (!_dispatch(request)) {
+		delete request;
+		return NULL;
+	}
+	return request;
+}
+
+void ProxyPool::sendBody(ProxyRequest* request, const char* data, size_t len) {
+	ProxyConnection* conn = request->_conn;
+	if (!conn || len == 0)
+		return;
+	request->_deadline = _now + request->_timeout;
+	if (request->_body_chunked)
+		ChunkedEncoder::appendChunk(conn->output, data, len);
+	else
+		conn->output.push(SharedBuffer(data, len));
+	if (conn->output.pendingBytes() > PROXY_BODY_HIGH_WATER)
+		request->_body_blocked = true;
+	_loop->setWriteInterest(conn->fd, true);
+}
+
+void ProxyPool::endBody(ProxyRequest* request) {
+	request->_body_done = true;
+	ProxyConnection* conn = request->_conn;
+	if (!conn || !request->_body_chunked)
+		return;
+	ChunkedEncoder::appendLastChunk(conn->output);
+	_loop->setWriteInterest(conn->fd, true);
+}
+
+void ProxyPool::release(ProxyRequest* request) {
+	request->detach();
+	if (request->_sink) {
+		request->_sink->detach();
+		request->_sink = NULL;
+	}
+	// Mid-response: the rest of it would arrive on the connection
+	if (request->_conn && !request->_ended)
+		_closeConnection(request->_conn);
+
+	for (size_t i = 0; i < _deferred.size(); ) {
+		if (_deferred[i].request == request)
+			_deferred.erase(_deferred.begin() + i);
+		else
+			++i;
+	}
+	_released.push_back(request);
+}
+
+void ProxyPool::takeEvents(std::vector<ProxyEvent>& out) {
+	out.insert(out.end(), _deferred.begin(), _deferred.end());
+	_deferred.clear();
+}
+
+//
+/* Event handling */
+//
+
+void ProxyPool::handleEvent(int fd, unsigned int events, std::vector<ProxyEvent>& out) {
+	_purge();
+	takeEvents(out);
+	std::map<int, ProxyConnection*>::iterator it = _connections.find(fd);
+	if (it == _connections.end())
+		return;
+	ProxyConnection* conn = it->second;
+
+	// Idle: the server closed it (or sent something unasked for)
+	if (!conn->request) {
+		_closeConnection(conn);
+		return;
+	}
+
+	if (!conn->connected) {
+		if (!(events & (EVENT_WRITE | EVENT_ERROR)))
+			return;
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			_fail(conn, true, out);
+			return;
+		}
+		conn->connected = true;
+	}
+
+	if (events & EVENT_WRITE) {
+		FlushResult result = conn->output.flush(fd);
+		if (result == FLUSH_ERROR) {
+			// The server may have answered and closed early: read that first
+			if (!(events & (EVENT_READ | EVENT_ERROR))) {
+				_fail(conn, conn->served == 0, out);
+				return;
+			}
+			conn->output.clear();
+		}
+		if (conn->output.empty())
+			_loop->setWriteInterest(fd, false);
+		ProxyRequest* request = conn->request;
+		if (request->_body_blocked && conn->output.pendingBytes() <= PROXY_BODY_HIGH_WATER / 2) {
+			request->_body_blocked = false;
+			ProxyEvent ev;
+			ev.request = request;
+			ev.type = PROXY_EVENT_DRAINED;
+			out.push_back(ev);
+		}
+	}
+
+	if (events & (EVENT_READ | EVENT_ERROR))
+		_readResponse(conn, out);
+}
+
+void ProxyPool::_readResponse(ProxyConnection* conn, std::vector<ProxyEvent>& events) {
+	char buffer[65536];
+	ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			_fail(conn, true, events);
+		return;
+	}
+	if (n == 0) {
+		if (conn->state == PROXY_BODY_CLOSE) {
+			_finish(conn, false, events);
+			return;
+		}
+		// Nothing at all on a reused connection: closed while it sat idle
+		bool stale = conn->served > 0 && conn->state == PROXY_HEAD && conn->input.empty();
+		_fail(conn, !stale, events);
+		return;
+	}
+
+	// Parse straight from the read buffer unless a partial line is pending
+	const char* data = buffer;
+	size_t size = static_cast<size_t>(n);
+	if (!conn->input.empty()) {
+		conn->input.append(buffer, n);
+		data = conn->input.data();
+		size = conn->input.size();
+	}
+
+	size_t used = _parseResponse(conn, data, size, events);
+	if (used == std::string::npos) {
+		WS_WARN("Invalid response from upstream " << conn->server->address);
+		_fail(conn, true, events);
+		return;
+	}
+	if (conn->state == PROXY_DONE) {
+		// Bytes past the end of the response: the connection can't be trusted
+		_finish(conn, conn->reusable && used == size, events);
+		return;
+	}
+	std::string rest(data + used, size - used);
+	conn->input.swap(rest);
+}
+
+// Consumes what it can (npos when the response is malformed); stops at the
+// end of the response
+size_t ProxyPool::_parseResponse(ProxyConnection* conn, const char* data, size_t size,
+                                 std::vector<ProxyEvent>& events) {
+	size_t pos = 0;
+	while (pos < size && conn->state != PROXY_DONE) {
+		const char* p = data + pos;
+		size_t avail = size - pos;
+
+		if (conn->state == PROXY_HEAD) {
+			size_t head_length;
+			size_t body_start = findHeadEnd(p, avail, head_length);
+			if (body_start == std::string::npos)
+				return avail > PROXY_MAX_HEADERS ? std::string::npos : pos;
+			if (!_parseHead(conn, p, head_length))
+				return std::string::npos;
+			pos += body_start;
+			if (conn->state != PROXY_HEAD)
+				_deliver(conn, NULL, 0, events); // the head goes out before any body
+			continue;
+		}
+
+		if (conn->state == PROXY_BODY_CLOSE) {
+			_deliver(conn, p, avail, events);
+			return size;
+		}
+
+		if (conn->state == PROXY_BODY_LENGTH ||
+		    (conn->state == PROXY_BODY_CHUNKED && conn->chunk_state == CHUNK_DATA)) {
+			size_t n = std::min(avail, conn->remaining);
+			_deliver(conn, p, n, events);
+			conn->remaining -= n;
+			pos += n;
+			if (conn->remaining == 0) {
+				if (conn->state == PROXY_BODY_LENGTH)
+					conn->state = PROXY_DONE;
+				else
+					conn->chunk_state = CHUNK_DATA_CRLF;
+			}
+			continue;
+		}
+
+		// Chunked framing lines: size, the CRLF after the data, trailers
+		const char* eol = static_cast<const char*>(std::memchr(p, '\n', avail));
+		if (!eol)
+			return avail > PROXY_MAX_CHUNK_LINE ? std::string::npos : pos;
+		size_t line_length = eol - p;
+		if (line_length > 0 && p[line_length - 1] == '\r')
+			--line_length;
+		pos += eol - p + 1;
+
+		if (conn->chunk_state == CHUNK_SIZE) {
+			size_t chunk = 0;
+			size_t digits = 0;
+			for (; digits < line_length && std::isxdigit(static_cast<unsigned char>(p[digits])); ++digits) {
+				if (chunk > (static_cast<size_t>(-1) >> 4))
+					return std::string::npos;
+				int c = std::tolower(static_cast<unsigned char>(p[digits]));
+				chunk = chunk * 16 + (c >= 'a' ? c - 'a' + 10 : c - '0');
+			}
+			if (digits == 0)
+				return std::string::npos;
+			conn->remaining = chunk;
+			conn->chunk_state = chunk > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+		} else if (conn->chunk_state == CHUNK_DATA_CRLF) {
+			if (line_length != 0)
+				return std::string::npos;
+			conn->chunk_state = CHUNK_SIZE;
+		} else if (line_length == 0) {
+			conn->state = PROXY_DONE; // trailers are dropped
+		}
+	}
+	return pos;
+}
+
+// Status line and header fields (without the blank line). Interim 1xx
+// responses are skipped; the headers kept are the end-to-end ones.
+bool ProxyPool::_parseHead(ProxyConnection* conn, const char* data, size_t length) {
+	ProxyRequest* request = conn->request;
+	std::string head(data, length);
+	size_t eol = head.find('\n');
+	std::string status_line = head.substr(0, eol);
+	if (!status_line.empty() && status_line[status_line.size() - 1] == '\r')
+		status_line.erase(status_line.size() - 1);
+	if (status_line.size() < 12 || status_line.compare(0, 7, "HTTP/1.") != 0 || status_line[8] != ' ' ||
+	    !std::isdigit(static_cast<unsigned char>(status_line[9])) ||
+	    !std::isdigit(static_cast<unsigned char>(status_line[10])) ||
+	    !std::isdigit(static_cast<unsigned char>(status_line[11])))
+		return false;
+	int status = (status_line[9] - '0') * 100 + (status_line[10] - '0') * 10 + (status_line[11] - '0');
+	bool http11 = status_line[7] != '0';
+	if (status < 100 || status == 101)
+		return false; // no protocol upgrades through the proxy
+	if (status < 200)
+		return true;
+
+	request->_status = status;
+	request->_headers.clear();
+	bool chunked = false;
+	bool has_length = false;
+	size_t content_length = 0;
+	bool close = !http11;
+	size_t pos = eol == std::string::npos ? head.size() : eol + 1;
+	while (pos < head.size()) {
+		size_t end = head.find('\n', pos);
+		if (end == std::string::npos)
+			end = head.size();
+		std::string line = head.substr(pos, end - pos);
+		pos = end + 1;
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty())
+			continue;
+		size_t colon = line.find(':');
+		if (colon == std::string::npos || colon == 0)
+			return false;
+		std::string name = line.substr(0, colon);
+		size_t first = line.find_first_not_of(" \t", colon + 1);
+		size_t last = line.find_last_not_of(" \t");
+		std::string value = first == std::string::npos ? "" : line.substr(first, last - first + 1);
+
+		if (equalsIgnoreCase(name, "content-length")) {
+			size_t parsed = 0;
+			for (size_t i = 0; i < value.size(); ++i) {
+				if (!std::isdigit(static_cast<unsigned char>(value[i])) || parsed > (static_cast<size_t>(-1) - 9) / 10)
+					return false;
+				parsed = parsed * 10 + (value[i] - '0');
+			}
+			if (value.empty() || (has_length && parsed != content_length))
+				return false;
+			has_length = true;
+			content_length = parsed;
+		} else if (equalsIgnoreCase(name, "transfer-encoding")) {
+			if (!hasToken(value, "chunked"))
+				return false;
+			chunked = true;
+		} else if (equalsIgnoreCase(name, "connection")) {
+			if (hasToken(value, "close"))
+				close = true;
+			else if (hasToken(value, "keep-alive"))
+				close = false;
+		} else if (equalsIgnoreCase(name, "content-type")) {
+			request->_headers.push_back(std::make_pair(std::string("Content-Type"), value));
+		} else if (!equalsIgnoreCase(name, "keep-alive") && !equalsIgnoreCase(name, "proxy-connection") &&
+		           !equalsIgnoreCase(name, "te") && !equalsIgnoreCase(name, "trailer") &&
+		           !equalsIgnoreCase(name, "upgrade") && !equalsIgnoreCase(name, "server") &&
+		           !equalsIgnoreCase(name, "date")) {
+			// Server and Date are this server's own
+			request->_headers.push_back(std::make_pair(name, value));
+		}
+	}
+	// With both, the chunked framing is the one that counts
+	if (has_length && !chunked) {
+		std::ostringstream length_value;
+		length_value << content_length;
+		request->_headers.push_back(std::make_pair(std::string("Content-Length"), length_value.str()));
+	}
+
+	conn->reusable = !close;
+	conn->server->fails = 0; // it answers: whatever failed before is over
+	if (request->_head_only || status == 204 || status == 304 || (has_length && !chunked && content_length == 0)) {
+		conn->state = PROXY_DONE;
+	} else if (chunked) {
+		conn->state = PROXY_BODY_CHUNKED;
+		conn->chunk_state = CHUNK_SIZE;
+	} else if (has_length) {
+		conn->state = PROXY_BODY_LENGTH;
+		conn->remaining = content_length;
+	} else {
+		conn->state = PROXY_BODY_CLOSE;
+		conn->reusable = false;
+	}
+	return true;
+}
+
+void ProxyPool::_deliver(ProxyConnection* conn, const char* data, size_t len, std::vector<ProxyEvent>& events) {
+	if (len == 0 && conn->request->_got_output)
+		return;
+	conn->request->_got_output = true;
+	ProxyEvent ev;
+	ev.request = conn->request;
+	ev.type = PROXY_EVENT_OUTPUT;
+	if (len > 0)
+		ev.data = SharedBuffer(data, len);
+	events.push_back(ev);
+}
+
+// Whole response in: the connection goes back to the server's idle list
+// while there is room and the exchange left it in a known state
+void ProxyPool::_finish(ProxyConnection* conn, bool reusable, std::vector<ProxyEvent>& events) {
+	ProxyRequest* request = conn->request;
+	ProxyServer* server = conn->server;
+	request->_ended = true;
+	ProxyEvent ev;
+	ev.request = request;
+	ev.type = PROXY_EVENT_END;
+	events.push_back(ev);
+
+	conn->served++;
+	if (!reusable || !conn->output.empty() || !request->_body_done || server->idle.size() >= server->keepalive) {
+		_closeConnection(conn);
+		return;
+	}
+	server->active--;
+	conn->request = NULL;
+	request->_conn = NULL;
+	conn->state = PROXY_HEAD;
+	conn->input.clear();
+	conn->idle_since = _now;
+	server->idle.push_back(conn);
+	// Readable from now on means closed by the server
+	_loop->setWriteInterest(conn->fd, false);
+	_loop->setReadInterest(conn->fd, true);
+}
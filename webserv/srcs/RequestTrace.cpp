@@ -0,0 +1,74 @@
+#include "RequestTrace.hpp"
+
+#include <cstdio>
+
+bool RequestTrace::_active = false;
+
+RequestTrace::RequestTrace() {
+	clear();
+}
+
+void RequestTrace::clear() {
+	for (int i = 0; i < TRACE_POINTS; ++i)
+		_points[i] = 0;
+	_parse_us = 0;
+	_handler = NULL;
+}
+
+// -1 when either end was not reached
+long long RequestTrace::_span(TracePoint from, TracePoint to) const {
+	if (!_points[from] || !_points[to])
+		return -1;
+	return _points[to] - _points[from];
+}
+
+long long RequestTrace::total(long long now) const {
+	if (!_points[TRACE_START])
+		return 0;
+	return (_points[TRACE_FLUSHED] ? _points[TRACE_FLUSHED] : now) - _points[TRACE_START];
+}
+
+//
+/* Rendering */
+//
+
+static void appendMetric(std::string& out, const char* name, const char* desc, long long us) {
+	if (us < 0)
+		return;
+	char buf[96];
+	if (desc)
+		snprintf(buf, sizeof(buf), "%s%s;desc=\"%s\";dur=%.3f", out.empty() ? "" : ", ", name, desc, us / 1000.0);
+	else
+		snprintf(buf, sizeof(buf), "%s%s;dur=%.3f", out.empty() ? "" : ", ", name, us / 1000.0);
+	out += buf;
+}
+
+void RequestTrace::appendServerTiming(long long now, std::string& out) const {
+	// Header wait includes the parse time, which is also given on its own
+	appendMetric(out, "wait", NULL, _span(TRACE_START, TRACE_HEADERS));
+	appendMetric(out, "parse", NULL, _points[TRACE_HEADERS] ? _parse_us : -1);
+	appendMetric(out, "body", NULL, _span(TRACE_HEADERS, TRACE_PARSED));
+	appendMetric(out, "handler", _handler, _span(TRACE_PARSED, TRACE_HANDLER));
+	appendMetric(out, "app", NULL, _span(TRACE_HANDLER, TRACE_APP_HEADERS));
+	appendMetric(out, "total", NULL, _points[TRACE_START] ? now - _points[TRACE_START] : -1);
+}
+
+static void appendField(std::string& out, const char* name, long long us) {
+	char buf[64];
+	if (us < 0)
+		snprintf(buf, sizeof(buf), " %s=-", name);
+	else
+		snprintf(buf, sizeof(buf), " %s=%.2f", name, us / 1000.0);
+	out += buf;
+}
+
+void RequestTrace::appendSummary(std::string& out) const {
+	appendField(out, "wait", _span(TRACE_START, TRACE_HEADERS));
+	appendField(out, "parse", _points[TRACE_HEADERS] ? _parse_us : -1);
+	appendField(out, "body", _span(TRACE_HEADERS, TRACE_PARSED));
+	appendField(out, _handler ? _handler : "handler", _span(TRACE_PARSED, TRACE_HANDLER));
+	appendField(out, "app", _span(TRACE_HANDLER, TRACE_APP_HEADERS));
+	// Queueing covers streaming a script's body after its headers
+	appendField(out, "queue", _span(_points[TRACE_APP_HEADERS] ? TRACE_APP_HEADERS : TRACE_HANDLER, TRACE_QUEUED));
+	appendField(out, "flush", _span(TRACE_QUEUED, TRACE_FLUSHED));
+}
@@ -0,0 +1,215 @@
+#include "Scanner.hpp"
+
+#include <cstring>
+
+#if !defined(WEBSERV_NO_SIMD)
+# if defined(__SSE2__)
+#  define SCANNER_SSE2 1
+#  include <emmintrin.h>
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define SCANNER_AVX2 1 // compiled with a target attribute, used if cpuid says so
+#   include <immintrin.h>
+#  endif
+# elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define SCANNER_NEON 1
+#  include <arm_neon.h>
+# endif
+#endif
+
+//
+/* Scalar */
+//
+
+static size_t scalarFindCrlf(const char* data, size_t len, size_t from) {
+	while (from + 1 < len) {
+		const void* cr = std::memchr(data + from, '\r', len - from - 1);
+		if (!cr)
+			break;
+		size_t at = static_cast<const char*>(cr) - data;
+		if (data[at + 1] == '\n')
+			return at;
+		from = at + 1;
+	}
+	return std::string::npos;
+}
+
+//
+/* Vector kernels */
+//
+// Each one scans whole vectors from `from` and returns the first hit, or
+// leaves `from` at the first position it did not fully look at
+
+#if defined(SCANNER_AVX2)
+static bool hasAvx2() {
+	static int cached = -1;
+	if (cached < 0) {
+		__builtin_cpu_init();
+		cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return cached == 1;
+}
+
+__attribute__((target("avx2")))
+static size_t avx2FindPair(const char* data, size_t len, size_t& from, char a, char b, size_t gap) {
+	const __m256i va = _mm256_set1_epi8(a);
+	const __m256i vb = _mm256_set1_epi8(b);
+	for (; from + gap + 32 <= len; from += 32) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from));
+		__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + gap));
+		unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(y, vb))));
+		if (mask)
+			return from + __builtin_ctz(mask);
+	}
+	return std::string::npos;
+}
+#endif
+
+#if defined(SCANNER_SSE2)
+static size_t sse2FindPair(const char* data, size_t len, size_t& from, char a, char b, size_t gap) {
+	const __m128i va = _mm_set1_epi8(a);
+	const __m128i vb = _mm_set1_epi8(b);
+	for (; from + gap + 16 <= len; from += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + gap));
+		unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(y, vb))));
+		if (mask)
+			return from + __builtin_ctz(mask);
+	}
+	return std::string::npos;
+}
+#endif
+
+#if defined(SCANNER_NEON)
+static size_t neonFindPair(const char* data, size_t len, size_t& from, char a, char b, size_t gap) {
+	const uint8x16_t va = vdupq_n_u8(static_cast<uint8_t>(a));
+	const uint8x16_t vb = vdupq_n_u8(static_cast<uint8_t>(b));
+	for (; from + gap + 16 <= len; from += 16) {
+		uint8x16_t x = vld1q_u8(reinterpret_cast<const uint8_t*>(data + from));
+		uint8x16_t y = vld1q_u8(reinterpret_cast<const uint8_t*>(data + from + gap));
+		uint8x16_t hit = vandq_u8(vceqq_u8(x, va), vceqq_u8(y, vb));
+		// Narrow to 4 bits per lane to get a 64-bit mask
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+		if (mask)
+			return from + (__builtin_ctzll(mask) >> 2);
+	}
+	return std::string::npos;
+}
+#endif
+
+// First position p >= from with data[p] == a and data[p + gap] == b, as
+// far as whole vectors reach; `from` is left where the caller continues
+static size_t findPair(const char* data, size_t len, size_t& from, char a, char b, size_t gap) {
+#if defined(SCANNER_AVX2)
+	if (hasAvx2()) {
+		size_t hit = avx2FindPair(data, len, from, a, b, gap);
+		if (hit != std::string::npos)
+			return hit;
+	}
+#endif
+#if defined(SCANNER_SSE2)
+	return sse2FindPair(data, len, from, a, b, gap);
+#elif defined(SCANNER_NEON)
+	return neonFindPair(data, len, from, a, b, gap);
+#else
+	(void)data; (void)len; (void)from; (void)a; (void)b; (void)gap;
+	return std::string::npos;
+#endif
+}
+
+//
+/* Scanner */
+//
+
+size_t Scanner::findCrlf(const char* data, size_t len) {
+	size_t from = 0;
+	size_t hit = findPair(data, len, from, '\r', '\n', 1);
+	if (hit != std::string::npos)
+		return hit;
+	return scalarFindCrlf(data, len, from);
+}
+
+const char* Scanner::backend() {
+#if defined(SCANNER_AVX2)
+	if (hasAvx2())
+		return "avx2";
+#endif
+#if defined(SCANNER_SSE2)
+	return "sse2";
+#elif defined(SCANNER_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+//
+/* DelimiterSearch */
+//
+
+DelimiterSearch::DelimiterSearch() {
+	assign("");
+}
+
+DelimiterSearch::DelimiterSearch(const std::string& pattern) {
+	assign(pattern);
+}
+
+void DelimiterSearch::assign(const std::string& pattern) {
+	_pattern = pattern;
+	size_t m = _pattern.size();
+	for (size_t c = 0; c < 256; ++c)
+		_skip[c] = m > 0 ? m : 1;
+	for (size_t j = 0; j + 1 < m; ++j)
+		_skip[static_cast<unsigned char>(_pattern[j])] = m - 1 - j;
+}
+
+size_t DelimiterSearch::find(const char* data, size_t len) const {
+	size_t m = _pattern.size();
+	if (m == 0)
+		return 0;
+	if (len < m)
+		return std::string::npos;
+	const char* pattern = _pattern.data();
+	if (m == 1) {
+		const void* hit = std::memchr(data, pattern[0], len);
+		return hit ? static_cast<const char*>(hit) - data : std::string::npos;
+	}
+
+	// Vector filter on the first and last byte, each candidate checked in full
+	size_t from = 0;
+	while (true) {
+		size_t hit = findPair(data, len, from, pattern[0], pattern[m - 1], m - 1);
+		if (hit == std::string::npos)
+			break;
+		if (std::memcmp(data + hit + 1, pattern + 1, m - 2) == 0)
+			return hit;
+		from = hit + 1;
+	}
+
+	// Horspool over what is left
+	char last = pattern[m - 1];
+	for (size_t i = from; i + m <= len; i += _skip[static_cast<unsigned char>(data[i + m - 1])]) {
+		if (data[i + m - 1] == last && std::memcmp(data + i, pattern, m - 1) == 0)
+			return i;
+	}
+	return std::string::npos;
+}
+
+size_t DelimiterSearch::partialSuffix(const char* data, size_t len) const {
+	size_t m = _pattern.size();
+	if (m < 2 || len == 0)
+		return 0;
+	size_t start = len > m - 1 ? len - (m - 1) : 0;
+	// Earliest start wins: it is the longest tail
+	for (size_t p = start; p < len; ++p) {
+		const void* hit = std::memchr(data + p, _pattern[0], len - p);
+		if (!hit)
+			return 0;
+		p = static_cast<const char*>(hit) - data;
+		if (std::memcmp(data + p, _pattern.data(), len - p) == 0)
+			return len - p;
+	}
+	return 0;
+}
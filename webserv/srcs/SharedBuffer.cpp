@@ -0,0 +1,55 @@
+#include "SharedBuffer.hpp"
+
+SharedBuffer::SharedBuffer() : _handle(0) {}
+
+SharedBuffer::SharedBuffer(const std::string& data) : _handle(new Handle) {
+	_handle->data = data;
+	_handle->refs = 1;
+}
+
+SharedBuffer::SharedBuffer(const char* data, size_t len) : _handle(new Handle) {
+	_handle->data.assign(data, len);
+	_handle->refs = 1;
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer& other) : _handle(other._handle) {
+	if (_handle)
+		_handle->refs++;
+}
+
+SharedBuffer& SharedBuffer::operator=(const SharedBuffer& other) {
+	if (_handle != other._handle) {
+		_release();
+		_handle = other._handle;
+		if (_handle)
+			_handle->refs++;
+	}
+	return *this;
+}
+
+SharedBuffer::~SharedBuffer() {
+	_release();
+}
+
+const std::string& SharedBuffer::str() const {
+	static const std::string empty_string;
+	return _handle ? _handle->data : empty_string;
+}
+
+std::string& SharedBuffer::writable() {
+	if (!_handle) {
+		_handle = new Handle;
+		_handle->refs = 1;
+	}
+	return _handle->data;
+}
+
+void SharedBuffer::reset() {
+	_release();
+}
+
+void SharedBuffer::_release() {
+	if (_handle && --_handle->refs == 0)
+		delete _handle;
+	_handle = 0;
+}
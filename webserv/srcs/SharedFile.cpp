@@ -0,0 +1,57 @@
+#include "SharedFile.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+
+SharedFile::SharedFile() : _handle(0) {}
+
+SharedFile::SharedFile(int fd) : _handle(0) {
+	if (fd >= 0) {
+		_handle = new Handle;
+		_handle->fd = fd;
+		_handle->refs = 1;
+	}
+}
+
+SharedFile::SharedFile(const SharedFile& other) : _handle(other._handle) {
+	if (_handle)
+		_handle->refs++;
+}
+
+SharedFile& SharedFile::operator=(const SharedFile& other) {
+	if (_handle != other._handle) {
+		_release();
+		_handle = other._handle;
+		if (_handle)
+			_handle->refs++;
+	}
+	return *this;
+}
+
+SharedFile::~SharedFile() {
+	_release();
+}
+
+SharedFile SharedFile::open(const char* path) {
+	int flags = O_RDONLY;
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+	int fd = ::open(path, flags);
+#ifndef O_CLOEXEC
+	if (fd >= 0)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+	return SharedFile(fd);
+}
+
+void SharedFile::reset() {
+	_release();
+}
+
+void SharedFile::_release() {
+	if (_handle && --_handle->refs == 0) {
+		close(_handle->fd);
+		delete _handle;
+	}
+	_handle = 0;
+}
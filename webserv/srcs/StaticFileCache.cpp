@@ -0,0 +1,212 @@
+#include "StaticFileCache.hpp"
+#include "HttpDate.hpp"
+#include <sstream>
+
+StaticFileCache::StaticFileCache(size_t max_bytes, size_t max_file_size)
+	: _max_bytes(max_bytes), _max_file_size(max_file_size), _bytes(0) {}
+
+StaticFileCache::~StaticFileCache() {
+	clear();
+}
+
+bool StaticFileCache::accepts(off_t size) const {
+	return size >= 0 && static_cast<size_t>(size) <= _max_file_size &&
+	       static_cast<size_t>(size) <= _max_bytes;
+}
+
+// Strong validator derived from stat(): changes whenever size or mtime does.
+// Each content coding is a representation of its own and gets its own tag.
+std::string StaticFileCache::makeETag(const struct stat& st, const std::string& encoding) {
+	std::ostringstream oss;
+	oss << '"' << std::hex << static_cast<unsigned long>(st.st_mtime) << '-'
+	    << static_cast<unsigned long>(st.st_size);
+	if (!encoding.empty())
+		oss << '-' << encoding;
+	oss << '"';
+	return oss.str();
+}
+
+// NUL cannot appear in a path, so variants never collide with a real file
+std::string StaticFileCache::variantKey(const std::string& path, const std::string& encoding) {
+	if (encoding.empty())
+		return path;
+	return path + '\0' + encoding;
+}
+
+std::string StaticFileCache::listingKey(const std::string& path, const std::string& variant) {
+	return path + '\0' + "autoindex " + variant;
+}
+
+// Cheap revalidation: one stat() per entry per second at most, plus one per
+// sibling a probe record looked for
+bool StaticFileCache::_stillValid(CachedFile* entry, time_t now) {
+	if (entry->validated_at == now)
+		return true;
+
+	struct stat st;
+	if (stat(entry->path.c_str(), &st) != 0 || !(entry->listing ? S_ISDIR(st.st_mode) : S_ISREG(st.st_mode)))
+		return false;
+	if (st.st_mtime != entry->mtime || st.st_size != entry->size || st.st_ino != entry->inode)
+		return false;
+
+	for (size_t i = 0; i < entry->siblings.size(); ++i) {
+		const SiblingProbe& probe = entry->siblings[i];
+		bool exists = stat(probe.path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+		if (exists != probe.exists || (exists && (st.st_mtime != probe.mtime || st.st_size != probe.size ||
+		                                          st.st_ino != probe.inode))) {
+			return false;
+		}
+	}
+
+	entry->validated_at = now;
+	return true;
+}
+
+const CachedFile* StaticFileCache::lookup(const std::string& key, time_t now) {
+	std::map<std::string, CachedFile*>::iterator it = _entries.find(key);
+	if (it == _entries.end())
+		return NULL;
+
+	CachedFile* entry = it->second;
+	if (!_stillValid(entry, now)) {
+		_evict(entry);
+		return NULL;
+	}
+
+	// Move to the front of the LRU list
+	_lru.splice(_lru.begin(), _lru, entry->lru);
+	return entry;
+}
+
+const CachedFile* StaticFileCache::insert(const std::string& key, const std::string& path,
+                                          const struct stat& st, const std::string& content,
+                                          const std::string& mime_type, const std::string& encoding,
+                                          bool vary, time_t now) {
+	return _insert(key, path, st, content, mime_type, encoding, encoding, vary, false, now);
+}
+
+// A directory's mtime moves whenever an entry is added, removed or renamed
+const CachedFile* StaticFileCache::insertListing(const std::string& key, const std::string& path,
+                                                 const struct stat& st, const std::string& content,
+                                                 const std::string& mime_type, const std::string& variant,
+                                                 time_t now) {
+	return _insert(key, path, st, content, mime_type, "", "index-" + variant, false, true, now);
+}
+
+// `tag` sets this representation's ETag apart from the others of `path`
+CachedFile* StaticFileCache::_insert(const std::string& key, const std::string& path,
+                                     const struct stat& st, const std::string& content,
+                                     const std::string& mime_type, const std::string& encoding,
+                                     const std::string& tag, bool vary, bool listing, time_t now) {
+	if (!accepts(static_cast<off_t>(content.size())))
+		return NULL;
+
+	std::map<std::string, CachedFile*>::iterator old = _entries.find(key);
+	if (old != _entries.end())
+		_evict(old->second);
+
+	// Make room, least recently used first
+	while (!_lru.empty() && _bytes + content.size() > _max_bytes)
+		_evict(_lru.back());
+
+	CachedFile* entry = new CachedFile;
+	entry->key = key;
+	entry->path = path;
+	entry->content = SharedBuffer(content);
+	entry->mime_type = mime_type;
+	entry->encoding = encoding;
+	entry->listing = listing;
+	entry->no_gain = false;
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+	entry->inode = st.st_ino;
+	entry->validated_at = now;
+	entry->etag = makeETag(st, tag);
+	entry->last_modified = HttpDate::format(st.st_mtime);
+
+	// A 304 repeats Vary along with the validators (RFC 7232 4.1)
+	std::string validators = "ETag: " + entry->etag + "\r\n"
+	                       + "Last-Modified: " + entry->last_modified + "\r\n"
+	                       + (vary ? "Vary: Accept-Encoding\r\n" : "");
+	std::ostringstream headers;
+	headers << "Content-Type: " << mime_type << "\r\n"
+	        << "Content-Length: " << content.size() << "\r\n";
+	// Ranges are only served from the file as is
+	if (!encoding.empty())
+		headers << "Content-Encoding: " << encoding << "\r\n";
+	else if (!listing)
+		headers << "Accept-Ranges: bytes\r\n";
+	headers << validators
+	        << "\r\n";
+	entry->header_block = SharedBuffer(headers.str());
+	entry->not_modified_block = SharedBuffer(validators + "\r\n");
+
+	_lru.push_front(entry);
+	entry->lru = _lru.begin();
+	_entries[key] = entry;
+	_bytes += content.size();
+	return entry;
+}
+
+// An empty entry under the gzip key, validated against the file like any other
+void StaticFileCache::insertNoGain(const std::string& path, const struct stat& st, time_t now) {
+	CachedFile* entry = _insert(variantKey(path, "gzip"), path, st, "", "", "", "gzip", false, false, now);
+	if (entry)
+		entry->no_gain = true;
+}
+
+static std::string siblingsKey(const std::string& path) {
+	return path + '\0' + "siblings";
+}
+
+void StaticFileCache::recordSiblings(const std::string& path, const struct stat& st,
+                                     const std::vector<SiblingProbe>& probes, time_t now) {
+	std::string key = siblingsKey(path);
+	std::map<std::string, CachedFile*>::iterator it = _entries.find(key);
+	CachedFile* entry = it == _entries.end() ? NULL : it->second;
+	if (!entry || st.st_mtime != entry->mtime || st.st_size != entry->size || st.st_ino != entry->inode)
+		entry = _insert(key, path, st, "", "", "", "", false, false, now);
+	for (size_t i = 0; entry && i < probes.size(); ++i) {
+		size_t j = 0;
+		while (j < entry->siblings.size() && entry->siblings[j].encoding != probes[i].encoding)
+			++j;
+		if (j < entry->siblings.size())
+			entry->siblings[j] = probes[i];
+		else
+			entry->siblings.push_back(probes[i]);
+	}
+}
+
+const std::vector<SiblingProbe>* StaticFileCache::lookupSiblings(const std::string& path, time_t now) {
+	const CachedFile* entry = lookup(siblingsKey(path), now);
+	if (!entry || entry->siblings.empty())
+		return NULL;
+	return &entry->siblings;
+}
+
+void StaticFileCache::invalidate(const std::string& path) {
+	static const char* const encodings[] = { "", "gzip", "br" };
+	for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); ++i) {
+		std::map<std::string, CachedFile*>::iterator it = _entries.find(variantKey(path, encodings[i]));
+		if (it != _entries.end())
+			_evict(it->second);
+	}
+	std::map<std::string, CachedFile*>::iterator it = _entries.find(siblingsKey(path));
+	if (it != _entries.end())
+		_evict(it->second);
+}
+
+void StaticFileCache::clear() {
+	for (std::map<std::string, CachedFile*>::iterator it = _entries.begin(); it != _entries.end(); ++it)
+		delete it->second;
+	_entries.clear();
+	_lru.clear();
+	_bytes = 0;
+}
+
+void StaticFileCache::_evict(CachedFile* entry) {
+	_bytes -= entry->content.size();
+	_lru.erase(entry->lru);
+	_entries.erase(entry->key);
+	delete entry;
+}
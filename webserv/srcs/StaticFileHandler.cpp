@@ -1,48 +1,109 @@
 #include "StaticFileHandler.hpp"
-#include <fstream>
+#include "StaticFileCache.hpp"
+#include "MimeTypes.hpp"
+#include "HttpDate.hpp"
+#include "FileSink.hpp"
 #include <sstream>
 #include <sys/stat.h>
 #include <algorithm>
 #include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
 #include <dirent.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #define PATH_SEPARATOR '/'
 
 StaticFileHandler::StaticFileHandler(const std::string& root, bool dir_listing, 
                                      const std::string& def_file)
     : root_directory(root), directory_listing_enabled(dir_listing), 
-      default_file(def_file) {
-}
-
-std::string StaticFileHandler::getMimeType(const std::string& path) const {
-    size_t dot_pos = path.find_last_of('.');
-    if (dot_pos == std::string::npos)
-        return "application/octet-stream";
-    
-    std::string ext = path.substr(dot_pos);
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-    
-    if (ext == ".html" || ext == ".htm") return "text/html";
-    if (ext == ".css") return "text/css";
-    if (ext == ".js") return "application/javascript";
-    if (ext == ".json") return "application/json";
-    if (ext == ".xml") return "application/xml";
-    if (ext == ".jpg" || ext == ".jpeg") return "image/jpeg";
-    if (ext == ".png") return "image/png";
-    if (ext == ".gif") return "image/gif";
-    if (ext == ".svg") return "image/svg+xml";
-    if (ext == ".ico") return "image/x-icon";
-    if (ext == ".txt") return "text/plain";
-    if (ext == ".pdf") return "application/pdf";
-    if (ext == ".zip") return "application/zip";
-    if (ext == ".mp3") return "audio/mpeg";
-    if (ext == ".mp4") return "video/mp4";
-    if (ext == ".woff") return "font/woff";
-    if (ext == ".woff2") return "font/woff2";
-    if (ext == ".ttf") return "font/ttf";
-    
-    return "application/octet-stream";
+      default_file(def_file), cache(NULL), gzip_static(false), gzip_on(false),
+      gzip_min_length(GZIP_MIN_LENGTH), gzip_level(GZIP_COMP_LEVEL) {
+}
+
+// Text formats shrink several times; images, archives and fonts are
+// compressed already
+bool StaticFileHandler::compressible(const std::string& mime_type) const {
+    return mime_type.compare(0, 5, "text/") == 0 || mime_type == "application/javascript" ||
+           mime_type == "application/json" || mime_type == "application/xml" ||
+           mime_type == "image/svg+xml";
+}
+
+// Codings the client takes (RFC 7231 5.3.4): q=0 rules one out, "*"
+// stands for every coding not listed otherwise
+unsigned int StaticFileHandler::acceptedCodings(const HttpRequest& request) const {
+    if (!gzip_static && !gzip_on)
+        return 0;
+    std::string header = request.getHeader("Accept-Encoding");
+    unsigned int accepted = 0;
+    unsigned int refused = 0;
+    bool any = false;
+    size_t pos = 0;
+    while (pos < header.length()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos)
+            end = header.length();
+        std::string item = header.substr(pos, end - pos);
+        pos = end + 1;
+        
+        size_t semi = item.find(';');
+        std::string name = item.substr(0, semi);
+        size_t first = name.find_first_not_of(" \t");
+        size_t last = name.find_last_not_of(" \t");
+        if (first == std::string::npos)
+            continue;
+        name = name.substr(first, last - first + 1);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        
+        bool zero = false;
+        if (semi != std::string::npos) {
+            size_t q = item.find("q=", semi);
+            if (q != std::string::npos)
+                zero = std::strtod(item.c_str() + q + 2, NULL) <= 0;
+        }
+        unsigned int coding = name == "gzip" || name == "x-gzip" ? CODING_GZIP : name == "br" ? CODING_BR : 0;
+        if (name == "*")
+            any = !zero;
+        else if (zero)
+            refused |= coding;
+        else
+            accepted |= coding;
+    }
+    if (any)
+        accepted |= CODING_GZIP | CODING_BR;
+    return accepted & ~refused;
+}
+
+// Whole file in memory, for the cache and for compression
+static bool readWhole(int fd, size_t size, std::string& content) {
+    content.resize(size);
+    size_t done = 0;
+    while (done < content.size()) {
+        ssize_t n = pread(fd, &content[done], content.size() - done, done);
+        if (n <= 0)
+            break;
+        done += static_cast<size_t>(n);
+    }
+    return done == content.size();
+}
+
+static bool gzipBuffer(const std::string& in, int level, std::string& out) {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // 16 + window bits: gzip header and trailer instead of zlib's
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
 }
 
 bool StaticFileHandler::fileExists(const std::string& path) const {
@@ -50,24 +111,380 @@ bool StaticFileHandler::fileExists(const std::string& path) const {
     return (stat(path.c_str(), &buffer) == 0);
 }
 
-bool StaticFileHandler::isDirectory(const std::string& path) const {
-    struct stat buffer;
-    if (stat(path.c_str(), &buffer) != 0)
+// Does the client hold a current copy? (RFC 7232 section 6 precedence:
+// If-None-Match wins over If-Modified-Since)
+bool StaticFileHandler::isNotModified(const HttpRequest& request, const std::string& etag,
+                                      time_t mtime) const {
+    std::string if_none_match = request.getHeader("If-None-Match");
+    if (!if_none_match.empty()) {
+        if (if_none_match == "*")
+            return true;
+        // Weak comparison over a comma-separated list
+        size_t pos = 0;
+        while (pos < if_none_match.length()) {
+            size_t end = if_none_match.find(',', pos);
+            if (end == std::string::npos)
+                end = if_none_match.length();
+            size_t first = if_none_match.find_first_not_of(" \t", pos);
+            if (first < end) {
+                if (if_none_match.compare(first, 2, "W/") == 0)
+                    first += 2;
+                size_t last = if_none_match.find_last_not_of(" \t", end - 1);
+                if (last >= first && if_none_match.compare(first, last - first + 1, etag) == 0)
+                    return true;
+            }
+            pos = end + 1;
+        }
         return false;
-    return S_ISDIR(buffer.st_mode);
+    }
+    
+    std::string if_modified_since = request.getHeader("If-Modified-Since");
+    time_t since;
+    if (!if_modified_since.empty() && HttpDate::parse(if_modified_since, since))
+        return mtime <= since;
+    return false;
+}
+
+static bool parseOffset(const std::string& str, size_t begin, size_t end, off_t& out) {
+    if (begin >= end)
+        return false;
+    off_t value = 0;
+    for (size_t i = begin; i < end; ++i) {
+        if (str[i] < '0' || str[i] > '9')
+            return false;
+        off_t next = value * 10 + (str[i] - '0');
+        if (next < value)
+            return false; // overflow
+        value = next;
+    }
+    out = value;
+    return true;
+}
+
+// Range / If-Range handling (RFC 7233). Syntax errors make us ignore the
+// header and send the full representation, as the RFC recommends.
+RangeResult StaticFileHandler::evaluateRange(const HttpRequest& request, const std::string& etag,
+                                             time_t mtime, off_t size,
+                                             std::vector<ByteRange>& ranges) const {
+    if (request.getMethod() != GET)
+        return RANGE_IGNORE;
+    std::string header = request.getHeader("Range");
+    if (header.empty())
+        return RANGE_IGNORE;
+    
+    // A stale If-Range validator means "send me everything"
+    std::string if_range = request.getHeader("If-Range");
+    if (!if_range.empty()) {
+        if (if_range[0] == '"' || if_range.compare(0, 2, "W/") == 0) {
+            if (if_range != etag)
+                return RANGE_IGNORE;
+        } else {
+            time_t date;
+            if (!HttpDate::parse(if_range, date) || date != mtime)
+                return RANGE_IGNORE;
+        }
+    }
+    
+    if (header.length() < 6 || header.compare(0, 6, "bytes=") != 0)
+        return RANGE_IGNORE;
+    
+    size_t pos = 6;
+    size_t specs = 0;
+    while (pos <= header.length()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos)
+            end = header.length();
+        size_t first = header.find_first_not_of(" \t", pos);
+        size_t last = (end > pos) ? header.find_last_not_of(" \t", end - 1) : std::string::npos;
+        pos = end + 1;
+        if (first == std::string::npos || first >= end || last == std::string::npos || last < first)
+            continue; // empty list element
+        if (++specs > MAX_BYTE_RANGES)
+            return RANGE_IGNORE;
+        
+        size_t dash = header.find('-', first);
+        if (dash == std::string::npos || dash > last)
+            return RANGE_IGNORE;
+        
+        ByteRange range;
+        if (dash == first) {
+            // Suffix range: the last N bytes
+            off_t suffix;
+            if (!parseOffset(header, dash + 1, last + 1, suffix))
+                return RANGE_IGNORE;
+            if (suffix == 0 || size == 0)
+                continue;
+            range.first = suffix >= size ? 0 : size - suffix;
+            range.last = size - 1;
+        } else {
+            if (!parseOffset(header, first, dash, range.first))
+                return RANGE_IGNORE;
+            if (dash == last) {
+                range.last = size - 1;
+            } else {
+                if (!parseOffset(header, dash + 1, last + 1, range.last) || range.last < range.first)
+                    return RANGE_IGNORE;
+                if (range.last >= size)
+                    range.last = size - 1;
+            }
+            if (range.first >= size)
+                continue; // unsatisfiable on its own
+        }
+        ranges.push_back(range);
+    }
+    
+    if (specs == 0)
+        return RANGE_IGNORE;
+    return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_SATISFIABLE;
+}
+
+// 206 / 416 responses. Every range is a file segment, so the bytes go out
+// through sendfile() exactly like a full response.
+// A 206 repeats the validators and Vary a 200 would carry (RFC 9110 15.3.7)
+HttpResponse StaticFileHandler::servePartial(const std::string& path, const std::string& mime_type,
+                                             const std::string& etag, time_t mtime, off_t size,
+                                             RangeResult result, const std::vector<ByteRange>& ranges) const {
+    if (result == RANGE_UNSATISFIABLE) {
+        std::ostringstream content_range;
+        content_range << "bytes */" << size;
+        HttpResponse response(416);
+        response.setHeader("Content-Range", content_range.str());
+        response.setBody("");
+        return response;
+    }
+    
+    SharedFile file = SharedFile::open(path.c_str());
+    if (!file.valid())
+        return HttpResponse::internalServerError(); // Failed to read file
+    
+    HttpResponse response(206);
+    response.setHeader("Accept-Ranges", "bytes");
+    response.setHeader("ETag", etag);
+    response.setHeader("Last-Modified", HttpDate::format(mtime));
+    if ((gzip_static || gzip_on) && compressible(mime_type))
+        response.setHeader("Vary", "Accept-Encoding");
+    if (ranges.size() == 1) {
+        std::ostringstream content_range;
+        content_range << "bytes " << ranges[0].first << "-" << ranges[0].last << "/" << size;
+        response.setHeader("Content-Range", content_range.str());
+        response.setContentType(mime_type);
+        response.setFileBody(file, ranges[0].first, static_cast<size_t>(ranges[0].last - ranges[0].first + 1));
+        return response;
+    }
+    
+    // multipart/byteranges: framing blocks interleaved with file ranges
+    static unsigned long sequence = 0;
+    std::ostringstream boundary_ss;
+    boundary_ss << "webserv_range_" << std::hex << static_cast<unsigned long>(time(NULL)) << "_" << ++sequence;
+    std::string boundary = boundary_ss.str();
+    
+    response.setContentType("multipart/byteranges; boundary=" + boundary);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::ostringstream part;
+        part << (i == 0 ? "" : "\r\n") << "--" << boundary << "\r\n"
+             << "Content-Type: " << mime_type << "\r\n"
+             << "Content-Range: bytes " << ranges[i].first << "-" << ranges[i].last << "/" << size << "\r\n"
+             << "\r\n";
+        response.appendBodyBuffer(SharedBuffer(part.str()));
+        response.appendBodyFile(file, ranges[i].first, static_cast<size_t>(ranges[i].last - ranges[i].first + 1));
+    }
+    response.appendBodyBuffer(SharedBuffer("\r\n--" + boundary + "--\r\n"));
+    return response;
+}
+
+HttpResponse StaticFileHandler::serveCached(const HttpRequest& request, const CachedFile& entry) const {
+    if (isNotModified(request, entry.etag, entry.mtime)) {
+        HttpResponse response(304);
+        response.setPrebuilt(entry.not_modified_block, SharedBuffer());
+        return response;
+    }
+    // Compressed variants are always sent whole (a Range may be ignored)
+    std::vector<ByteRange> ranges;
+    RangeResult range = entry.encoding.empty()
+        ? evaluateRange(request, entry.etag, entry.mtime, entry.size, ranges) : RANGE_IGNORE;
+    if (range != RANGE_IGNORE)
+        return servePartial(entry.path, entry.mime_type, entry.etag, entry.mtime, entry.size, range, ranges);
+    
+    HttpResponse response(200);
+    response.setPrebuilt(entry.header_block, entry.content);
+    return response;
 }
 
-std::string StaticFileHandler::readFile(const std::string& path, bool& success) const {
-    std::ifstream file(path.c_str(), std::ios::binary);
-    if (!file.is_open()) {
-        success = false;
-        return "";
+// True when the last look for this sibling found nothing to serve
+static bool knownMissing(const std::vector<SiblingProbe>* probes, const char* encoding) {
+    for (size_t i = 0; probes && i < probes->size(); ++i) {
+        if ((*probes)[i].encoding == encoding)
+            return !(*probes)[i].usable;
+    }
+    return false;
+}
+
+// Cache hit for the best representation this client takes. A plain copy
+// is not good enough while a compressed one may exist (a sibling file not
+// looked for yet) or is about to be made: the slow path finds or builds
+// it, once, and records which siblings it looked for.
+const CachedFile* StaticFileHandler::lookupCached(const std::string& path, unsigned int accepted,
+                                                  time_t now) const {
+    const std::vector<SiblingProbe>* probes = NULL;
+    if (gzip_static && accepted)
+        probes = cache->lookupSiblings(path, now);
+    if (accepted & CODING_BR) {
+        if (const CachedFile* hit = cache->lookup(StaticFileCache::variantKey(path, "br"), now))
+            return hit;
+        // Only a sibling can be brotli
+        if (gzip_static && !knownMissing(probes, "br"))
+            return NULL;
+    }
+    if (accepted & CODING_GZIP) {
+        const CachedFile* hit = cache->lookup(StaticFileCache::variantKey(path, "gzip"), now);
+        if (hit && !hit->no_gain)
+            return hit;
+        if (gzip_static && !knownMissing(probes, "gzip"))
+            return NULL;
+        const CachedFile* plain = cache->lookup(path, now);
+        bool gzip_pending = !hit && gzip_on && plain && compressible(plain->mime_type) &&
+                            static_cast<size_t>(plain->size) >= gzip_min_length;
+        return gzip_pending ? NULL : plain;
     }
+    return cache->lookup(path, now);
+}
+
+// Validators come from the caller's stat(), so a 304 never opens the file.
+// Small files are read once into the cache; anything else keeps its fd in the
+// response and is sent straight from the page cache by the server
+HttpResponse StaticFileHandler::serveFile(const HttpRequest& request, const std::string& path,
+                                          const struct stat& path_st, time_t now) const {
+    const std::string& mime_type = MimeTypes::lookup(path);
+    unsigned int accepted = acceptedCodings(request);
+    if (!accepted)
+        return serveRepresentation(request, path, path, path_st, mime_type, "", now);
     
-    std::ostringstream oss;
-    oss << file.rdbuf();
-    success = true;
-    return oss.str();
+    HttpResponse response;
+    std::vector<SiblingProbe> probes;
+    if (!serveEncoded(request, path, path_st, mime_type, accepted, now, probes, response)) {
+        // Nothing better than the plain file: it may well be cached already
+        const CachedFile* hit = cache ? cache->lookup(path, now) : NULL;
+        response = hit ? serveCached(request, *hit)
+                       : serveRepresentation(request, path, path, path_st, mime_type, "", now);
+    }
+    // Cached hits skip these stat()s until the file or a sibling changes
+    if (cache && !probes.empty())
+        cache->recordSiblings(path, path_st, probes, now);
+    return response;
+}
+
+// A sibling compressed ahead of time (newest wins over stale), else a gzip
+// copy of a small text file made here and kept in the cache. Every sibling
+// looked for lands in `probes`.
+bool StaticFileHandler::serveEncoded(const HttpRequest& request, const std::string& path,
+                                     const struct stat& path_st, const std::string& mime_type,
+                                     unsigned int accepted, time_t now,
+                                     std::vector<SiblingProbe>& probes, HttpResponse& response) const {
+    static const struct {
+        unsigned int coding;
+        const char* name;
+        const char* suffix;
+    } siblings[] = { { CODING_BR, "br", ".br" }, { CODING_GZIP, "gzip", ".gz" } };
+    
+    for (size_t i = 0; gzip_static && i < sizeof(siblings) / sizeof(siblings[0]); ++i) {
+        if (!(accepted & siblings[i].coding))
+            continue;
+        SiblingProbe probe;
+        probe.encoding = siblings[i].name;
+        probe.path = path + siblings[i].suffix;
+        struct stat st;
+        probe.exists = stat(probe.path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+        probe.usable = probe.exists && st.st_mtime >= path_st.st_mtime;
+        probe.mtime = probe.exists ? st.st_mtime : 0;
+        probe.size = probe.exists ? st.st_size : 0;
+        probe.inode = probe.exists ? st.st_ino : 0;
+        probes.push_back(probe);
+        if (!probe.usable)
+            continue;
+        response = serveRepresentation(request, StaticFileCache::variantKey(path, siblings[i].name),
+                                       probe.path, st, mime_type, siblings[i].name, now);
+        if (response.getStatusCode() != 500)
+            return true;
+    }
+    
+    if (!gzip_on || !(accepted & CODING_GZIP) || !cache || !compressible(mime_type) ||
+        static_cast<size_t>(path_st.st_size) < gzip_min_length || !cache->accepts(path_st.st_size))
+        return false;
+    std::string key = StaticFileCache::variantKey(path, "gzip");
+    if (const CachedFile* known = cache->lookup(key, now)) {
+        if (known->no_gain)
+            return false;
+        response = serveCached(request, *known);
+        return true;
+    }
+    SharedFile file = SharedFile::open(path.c_str());
+    struct stat st;
+    std::string content;
+    std::string compressed;
+    if (!file.valid() || fstat(file.fd(), &st) != 0 || !S_ISREG(st.st_mode) ||
+        !readWhole(file.fd(), static_cast<size_t>(st.st_size), content) ||
+        !gzipBuffer(content, gzip_level, compressed))
+        return false;
+    if (compressed.size() >= content.size()) {
+        cache->insertNoGain(path, st, now);
+        return false;
+    }
+    const CachedFile* entry = cache->insert(key, path, st, compressed, mime_type, "gzip", true, now);
+    if (!entry)
+        return false;
+    response = serveCached(request, *entry);
+    return true;
+}
+
+// `path` holds the bytes to send: the file itself, or a compressed sibling
+// when `encoding` is set
+HttpResponse StaticFileHandler::serveRepresentation(const HttpRequest& request, const std::string& key,
+                                                    const std::string& path, const struct stat& path_st,
+                                                    const std::string& mime_type,
+                                                    const std::string& encoding, time_t now) const {
+    bool vary = !encoding.empty() || ((gzip_static || gzip_on) && compressible(mime_type));
+    std::string etag = StaticFileCache::makeETag(path_st, encoding);
+    if (isNotModified(request, etag, path_st.st_mtime)) {
+        HttpResponse response(304);
+        response.setHeader("ETag", etag);
+        response.setHeader("Last-Modified", HttpDate::format(path_st.st_mtime));
+        if (vary)
+            response.setHeader("Vary", "Accept-Encoding");
+        return response;
+    }
+    
+    std::vector<ByteRange> ranges;
+    RangeResult range = encoding.empty()
+        ? evaluateRange(request, etag, path_st.st_mtime, path_st.st_size, ranges) : RANGE_IGNORE;
+    if (range != RANGE_IGNORE)
+        return servePartial(path, mime_type, etag, path_st.st_mtime, path_st.st_size, range, ranges);
+    
+    SharedFile file = SharedFile::open(path.c_str());
+    struct stat st;
+    if (!file.valid() || fstat(file.fd(), &st) != 0 || !S_ISREG(st.st_mode))
+        return HttpResponse::internalServerError(); // Failed to read file
+    
+    if (cache && cache->accepts(st.st_size)) {
+        std::string content;
+        if (readWhole(file.fd(), static_cast<size_t>(st.st_size), content)) {
+            const CachedFile* entry = cache->insert(key, path, st, content, mime_type, encoding, vary, now);
+            if (entry)
+                return serveCached(request, *entry);
+        }
+    }
+    
+    HttpResponse response(200);
+    response.setContentType(mime_type);
+    response.setHeader("ETag", StaticFileCache::makeETag(st, encoding));
+    response.setHeader("Last-Modified", HttpDate::format(st.st_mtime));
+    if (encoding.empty())
+        response.setHeader("Accept-Ranges", "bytes");
+    else
+        response.setHeader("Content-Encoding", encoding);
+    if (vary)
+        response.setHeader("Vary", "Accept-Encoding");
+    response.setFileBody(file, 0, static_cast<size_t>(st.st_size));
+    return response;
 }
 
 std::string StaticFileHandler::combinePaths(const std::string& base, 
@@ -104,48 +521,208 @@ bool StaticFileHandler::isPathSafe(const std::string& path) const {
     return true;
 }
 
-std::string StaticFileHandler::generateDirectoryListing(const std::string& dir_path, 
-                                                        const std::string& uri) const {
-    std::ostringstream html;
-    html << "<html><head><title>Index of " << uri << "</title>";
-    html << "<style>"
-         << "body { font-family: Arial, sans-serif; margin: 20px; }"
-         << "h1 { color: #333; }"
-         << "table { border-collapse: collapse; width: 100%; max-width: 800px; }"
-         << "th, td { text-align: left; padding: 8px; border-bottom: 1px solid #ddd; }"
-         << "th { background-color: #4CAF50; color: white; }"
-         << "a { color: #0066cc; text-decoration: none; }"
-         << "a:hover { text-decoration: underline; }"
-         << "</style></head><body>";
-    html << "<h1>Index of " << uri << "</h1>";
-    html << "<table><tr><th>Name</th><th>Type</th></tr>";
-    
-    // Add parent directory link
-    if (uri != "/") {
-        html << "<tr><td><a href=\"..\">..</a></td><td>Directory</td></tr>";
-    }
-    
-    DIR* dir = opendir(dir_path.c_str());
-    if (dir) {
-        struct dirent* entry;
-        while ((entry = readdir(dir)) != NULL) {
-            std::string name = entry->d_name;
-            if (name != "." && name != "..") {
-                std::string full_path = combinePaths(dir_path, name);
-                bool is_dir = isDirectory(full_path);
-                std::string link = name;
-                if (is_dir) link += "/";
-                
-                html << "<tr><td><a href=\"" << link << "\">" << name 
-                     << (is_dir ? "/" : "") << "</a></td><td>" 
-                     << (is_dir ? "Directory" : "File") << "</td></tr>";
-            }
+// Entry types come from readdir() itself; only filesystems that leave
+// d_type unknown (and symlinks, to see what they point at) cost a stat
+bool StaticFileHandler::readDirectory(const std::string& path, std::vector<ListingEntry>& entries) const {
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+        return false;
+    int fd = dirfd(dir);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        ListingEntry item;
+        item.name = name;
+        item.directory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            item.directory = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
         }
-        closedir(dir);
+        entries.push_back(item);
     }
-    
-    html << "</table></body></html>";
-    return html.str();
+    closedir(dir);
+    // Pages need a stable order
+    std::sort(entries.begin(), entries.end());
+    return true;
+}
+
+static void appendHtml(std::string& out, const std::string& text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        switch (text[i]) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            case '\'': out += "&#39;"; break;
+            default: out += text[i];
+        }
+    }
+}
+
+static void appendJson(std::string& out, const std::string& text) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += text[i];
+        } else if (c < 0x20) {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        } else {
+            out += text[i];
+        }
+    }
+}
+
+// Anything but unreserved characters and '/' is percent-encoded
+static void appendUri(std::string& out, const std::string& text) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || c == '/') {
+            out += text[i];
+        } else {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+}
+
+static std::string pageLink(const std::string& uri, size_t page, bool json) {
+    std::ostringstream link;
+    link << uri << "?page=" << page;
+    if (json)
+        link << "&format=json";
+    return link.str();
+}
+
+// One page of the sorted entries; links are absolute so the listing works
+// for a directory URI given without its trailing slash
+std::string StaticFileHandler::renderListing(const std::vector<ListingEntry>& entries, const std::string& uri,
+                                             size_t page, size_t pages, bool json) const {
+    std::string base = uri;
+    if (base.empty() || base[base.length() - 1] != '/')
+        base += '/';
+    size_t first = (page - 1) * AUTOINDEX_PAGE_SIZE;
+    size_t last = std::min(entries.size(), first + AUTOINDEX_PAGE_SIZE);
+
+    std::string out;
+    out.reserve(512 + (last - first) * (json ? 64 : 160));
+    if (json) {
+        std::ostringstream head;
+        head << "{\"path\":\"";
+        out += head.str();
+        appendJson(out, base);
+        head.str("");
+        head << "\",\"page\":" << page << ",\"pages\":" << pages << ",\"total\":" << entries.size()
+             << ",\"entries\":[";
+        out += head.str();
+        for (size_t i = first; i < last; ++i) {
+            out += i > first ? ",{\"name\":\"" : "{\"name\":\"";
+            appendJson(out, entries[i].name);
+            out += entries[i].directory ? "\",\"type\":\"directory\"}" : "\",\"type\":\"file\"}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    out += "<html><head><title>Index of ";
+    appendHtml(out, base);
+    out += "</title><style>"
+           "body { font-family: Arial, sans-serif; margin: 20px; }"
+           "h1 { color: #333; }"
+           "table { border-collapse: collapse; width: 100%; max-width: 800px; }"
+           "th, td { text-align: left; padding: 8px; border-bottom: 1px solid #ddd; }"
+           "th { background-color: #4CAF50; color: white; }"
+           "a { color: #0066cc; text-decoration: none; }"
+           "a:hover { text-decoration: underline; }"
+           "</style></head><body><h1>Index of ";
+    appendHtml(out, base);
+    out += "</h1><table><tr><th>Name</th><th>Type</th></tr>";
+
+    // Add parent directory link
+    if (base != "/") {
+        std::string parent = base.substr(0, base.find_last_of('/', base.length() - 2) + 1);
+        out += "<tr><td><a href=\"";
+        appendUri(out, parent);
+        out += "\">..</a></td><td>Directory</td></tr>";
+    }
+    for (size_t i = first; i < last; ++i) {
+        const ListingEntry& entry = entries[i];
+        out += "<tr><td><a href=\"";
+        appendUri(out, base + entry.name + (entry.directory ? "/" : ""));
+        out += "\">";
+        appendHtml(out, entry.name);
+        out += entry.directory ? "/</a></td><td>Directory</td></tr>" : "</a></td><td>File</td></tr>";
+    }
+    out += "</table>";
+
+    if (pages > 1) {
+        std::ostringstream nav;
+        nav << "<p>";
+        if (page > 1)
+            nav << "<a href=\"" << pageLink(base, page - 1, false) << "\">&laquo; Previous</a> ";
+        nav << "Page " << page << " of " << pages << " (" << entries.size() << " entries)";
+        if (page < pages)
+            nav << " <a href=\"" << pageLink(base, page + 1, false) << "\">Next &raquo;</a>";
+        nav << "</p>";
+        out += nav.str();
+    }
+    out += "</body></html>";
+    return out;
+}
+
+// ?format=json for scripts, ?page=N past the first AUTOINDEX_PAGE_SIZE
+// entries. Pages are cached until the directory changes: one stat() per
+// second instead of a readdir() per request.
+HttpResponse StaticFileHandler::serveListing(const HttpRequest& request, const std::string& path,
+                                             const struct stat& st, time_t now) const {
+    bool json = false;
+    size_t page = 1;
+    const std::string& query = request.getQueryString();
+    size_t pos = 0;
+    while (pos < query.length()) {
+        size_t end = query.find('&', pos);
+        if (end == std::string::npos)
+            end = query.length();
+        std::string param = query.substr(pos, end - pos);
+        if (param == "format=json")
+            json = true;
+        else if (param.compare(0, 5, "page=") == 0)
+            page = std::strtoul(param.c_str() + 5, NULL, 10);
+        pos = end + 1;
+    }
+    if (page == 0)
+        return HttpResponse::notFound();
+
+    std::ostringstream variant;
+    variant << (json ? "json-" : "html-") << page;
+    std::string key = StaticFileCache::listingKey(path, variant.str());
+    if (cache) {
+        if (const CachedFile* hit = cache->lookup(key, now))
+            return serveCached(request, *hit);
+    }
+
+    std::vector<ListingEntry> entries;
+    if (!readDirectory(path, entries))
+        return HttpResponse::notFound();
+    size_t pages = entries.empty() ? 1 : (entries.size() + AUTOINDEX_PAGE_SIZE - 1) / AUTOINDEX_PAGE_SIZE;
+    if (page > pages)
+        return HttpResponse::notFound();
+
+    std::string content = renderListing(entries, request.getUri(), page, pages, json);
+    const char* mime_type = json ? "application/json" : "text/html";
+    // A change later in the same second as the mtime would go unnoticed
+    if (cache && st.st_mtime < now) {
+        if (const CachedFile* entry = cache->insertListing(key, path, st, content, mime_type, variant.str(), now))
+            return serveCached(request, *entry);
+    }
+    return HttpResponse::ok(content, mime_type);
 }
 
 HttpResponse StaticFileHandler::handleRequest(const HttpRequest& request) {
@@ -155,7 +732,7 @@ HttpResponse StaticFileHandler::handleRequest(const HttpRequest& request) {
     
     // Security check
     if (!isPathSafe(uri)) {
-        return HttpResponse::badRequest("Invalid path");
+        return HttpResponse::badRequest(); // Invalid path
     }
     
     // Build full file path
@@ -164,67 +741,119 @@ HttpResponse StaticFileHandler::handleRequest(const HttpRequest& request) {
     // Handle DELETE method
     if (method == DELETE) {
         if (!fileExists(file_path)) {
-            return HttpResponse::notFound("The requested resource was not found");
+            return HttpResponse::notFound();
         }
         
         // Prevent deletion of index files
         if (uri == "/" || uri.empty()) {
-            return HttpResponse::methodNotAllowed("Cannot delete index file");
+            return HttpResponse::methodNotAllowed(); // Cannot delete index file
         }
         
         // Check if it's a default file (index.html, etc.)
         size_t last_slash = file_path.find_last_of('/');
         std::string filename = (last_slash != std::string::npos) ? file_path.substr(last_slash + 1) : file_path;
         if (filename == default_file || filename == "index.html" || filename == "index.htm") {
-            return HttpResponse::methodNotAllowed("Cannot delete index files");
+            return HttpResponse::methodNotAllowed(); // Cannot delete index files
         }
         
+        if (cache)
+            cache->invalidate(file_path);
         if (remove(file_path.c_str()) == 0) {
             return HttpResponse::ok("<html><body><h1>200 OK</h1><p>File deleted successfully</p></body></html>", "text/html");
         } else {
             // Return 403 Forbidden instead of 500 for permission errors
-            return HttpResponse::methodNotAllowed("Permission denied: Cannot delete file");
+            return HttpResponse::methodNotAllowed(); // Permission denied: Cannot delete file
         }
     }
     
     // Only handle GET and HEAD requests for static files
     if (method != GET && method != HEAD) {
-        return HttpResponse::methodNotAllowed("Only GET and HEAD are allowed for static files");
+        return HttpResponse::methodNotAllowed(); // Only GET and HEAD are allowed for static files
+    }
+    
+    time_t now = time(NULL);
+    
+    // Hot path: a cache hit costs one map lookup (plus a stat() once a second)
+    if (cache) {
+        unsigned int accepted = acceptedCodings(request);
+        const CachedFile* hit = lookupCached(file_path, accepted, now);
+        if (!hit && !uri.empty() && uri[uri.length() - 1] == '/')
+            hit = lookupCached(combinePaths(file_path, default_file), accepted, now);
+        if (hit)
+            return serveCached(request, *hit);
     }
     
     // Check if file/directory exists
-    if (!fileExists(file_path)) {
-        return HttpResponse::notFound("The requested resource was not found");
+    struct stat st;
+    if (stat(file_path.c_str(), &st) != 0) {
+        return HttpResponse::notFound();
     }
     
     // If it's a directory
-    if (isDirectory(file_path)) {
+    if (S_ISDIR(st.st_mode)) {
         // Try to serve default file
         std::string index_path = combinePaths(file_path, default_file);
-        if (fileExists(index_path) && !isDirectory(index_path)) {
-            bool success;
-            std::string content = readFile(index_path, success);
-            if (success) {
-                HttpResponse response = HttpResponse::ok(content, getMimeType(index_path));
+        struct stat index_st;
+        if (stat(index_path.c_str(), &index_st) == 0 && S_ISREG(index_st.st_mode)) {
+            HttpResponse response = serveFile(request, index_path, index_st, now);
+            if (response.getStatusCode() != 500)
                 return response;
-            }
         }
         
         // If no default file, check if directory listing is enabled
         if (directory_listing_enabled) {
-            std::string listing = generateDirectoryListing(file_path, uri);
-            return HttpResponse::ok(listing, "text/html");
+            return serveListing(request, file_path, st, now);
         } else {
-            return HttpResponse::notFound("Directory listing is disabled");
+            return HttpResponse::notFound(); // Directory listing is disabled
         }
     }
     
-    // It's a file - read and serve it
-    bool success;
-    std::string content = readFile(file_path, success);
-    if (!success) {
-        return HttpResponse::internalServerError("Failed to read file");
+    // It's a file - serve it from memory or stream it from disk
+    return serveFile(request, file_path, st, now);
+}
+
+FileSink* StaticFileHandler::createSink(const HttpRequest& request, int& error) const {
+    const std::string& uri = request.getUri();
+    if (!isPathSafe(uri)) {
+        error = 400; // Invalid path
+        return NULL;
+    }
+    if (uri.empty() || uri[uri.length() - 1] == '/') {
+        error = 409; // A directory, not a file
+        return NULL;
+    }
+    FileSink* sink = new FileSink(combinePaths(root_directory, uri), true);
+    if (!sink->open(request.getContentLength())) {
+        error = sink->errorCode();
+        delete sink;
+        return NULL;
+    }
+    return sink;
+}
+
+HttpResponse StaticFileHandler::handlePut(const HttpRequest& request, const BodySink* streamed) {
+    const FileSink* file = dynamic_cast<const FileSink*>(streamed);
+    FileSink* stored = NULL;
+    if (!file) {
+        // Empty body (nothing to stream), or parsed without a sink
+        int error = 500;
+        stored = createSink(request, error);
+        if (!stored)
+            return HttpResponse::error(error);
+        const std::string& body = request.getBody();
+        if (!stored->write(body.data(), body.size()) || !stored->finish()) {
+            HttpResponse failed = HttpResponse::error(stored->errorCode());
+            delete stored;
+            return failed;
+        }
+        file = stored;
     }
     
-    return HttpResponse::ok(content, getMimeType(file_path));
+    if (cache)
+        cache->invalidate(file->path());
+    bool replaced = file->replaced();
+    delete stored;
+    if (replaced)
+        return HttpResponse::noContent();
+    return HttpResponse::created(request.getUri());
 }
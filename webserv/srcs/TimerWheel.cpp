@@ -0,0 +1,72 @@
+#include "TimerWheel.hpp"
+
+TimerWheel::TimerWheel(time_t now) : _slots(TIMER_WHEEL_SLOTS), _now(now) {
+	for (size_t i = 0; i < _slots.size(); ++i) {
+		_slots[i].prev = &_slots[i];
+		_slots[i].next = &_slots[i];
+	}
+}
+
+// Due (or overdue) timers go in the next slot to be processed
+void TimerWheel::_link(TimerNode* node) {
+	node->slot_time = node->expires > _now ? node->expires : _now + 1;
+	TimerNode* head = &_slots[node->slot_time % _slots.size()];
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+void TimerWheel::_unlink(TimerNode* node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = NULL;
+	node->next = NULL;
+}
+
+void TimerWheel::schedule(TimerNode* node, time_t expires) {
+	node->expires = expires;
+	// Later than the slot it sits in: re-slotted lazily when that comes up
+	if (node->armed() && node->slot_time <= expires)
+		return;
+	if (node->armed())
+		_unlink(node);
+	_link(node);
+}
+
+void TimerWheel::cancel(TimerNode* node) {
+	if (node->armed())
+		_unlink(node);
+}
+
+void TimerWheel::advance(time_t now, std::vector<int>& expired) {
+	// After a long stall a single lap covers every slot
+	time_t size = static_cast<time_t>(_slots.size());
+	if (now - _now > size)
+		_now = now - size;
+
+	while (_now < now) {
+		_now++;
+		TimerNode* head = &_slots[_now % _slots.size()];
+		if (head->next == head)
+			continue;
+
+		// Detach the slot first: nodes pushed back may land in it again
+		TimerNode pending;
+		pending.next = head->next;
+		pending.prev = head->prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		head->next = head;
+		head->prev = head;
+
+		while (pending.next != &pending) {
+			TimerNode* node = pending.next;
+			_unlink(node);
+			if (node->expires <= now)
+				expired.push_back(node->id);
+			else
+				_link(node);
+		}
+	}
+}
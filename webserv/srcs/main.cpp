@@ -1,14 +1,22 @@
 #include "Server.hpp"
+#include "Master.hpp"
+#include "Config.hpp"
 #include <iostream>
 #include <cstdlib>
 #include <csignal>
 
 volatile sig_atomic_t g_shutdown = 0;
+volatile sig_atomic_t g_reload = 0; // SIGHUP: read the configuration file again
+volatile sig_atomic_t g_drain = 0;  // SIGQUIT: stop once the open connections are done
 
 void signal_handler(int signal) {
 	if (signal == SIGINT || signal == SIGTERM) {
 		std::cout << "\nShutting down server..." << std::endl;
 		g_shutdown = 1;
+	} else if (signal == SIGHUP) {
+		g_reload = 1;
+	} else if (signal == SIGQUIT) {
+		g_drain = 1;
 	}
 }
 
@@ -22,9 +30,21 @@ int main(int argc, char** argv) {
 	// Setup signal handlers
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
+	signal(SIGHUP, signal_handler);
+	signal(SIGQUIT, signal_handler);
 	signal(SIGPIPE, SIG_IGN);
 
 	try {
+		// Several workers: this process only supervises them
+		Config config(config_file);
+		if (!config.parse())
+			throw std::runtime_error("Failed to parse configuration file");
+		size_t workers = Master::resolveCount(config.getServerConfig(0).worker_processes);
+		if (workers > 1) {
+			Master master(config_file, workers);
+			return master.run();
+		}
+
 		Server server(config_file);
 		server.run();
 	} catch (const std::exception& e) {
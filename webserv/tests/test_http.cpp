@@ -66,6 +66,132 @@ void testHttpRequestParser() {
     std::cout << std::endl;
 }
 
+void testPipelinedRequests() {
+    std::cout << "=== Testing Pipelined Requests ===" << std::endl;
+    
+    // Two requests arriving in the same read
+    const char* pipelined = 
+        "GET /first HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "\r\n"
+        "GET /second HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "\r\n";
+    
+    HttpRequest req;
+    req.parse(pipelined, strlen(pipelined));
+    std::cout << "First URI: " << req.getUri() << std::endl;
+    
+    std::string rest = req.getPipelinedData();
+    req.reset();
+    req.parse(rest.c_str(), rest.size());
+    std::cout << "Second URI: " << req.getUri() << std::endl;
+    std::cout << "  Complete: " << (req.isComplete() ? "Yes" : "No") << std::endl;
+    std::cout << std::endl;
+}
+
+void testHeaderLookup() {
+    std::cout << "=== Testing Header Lookup ===" << std::endl;
+    
+    const char* raw = 
+        "POST /form HTTP/1.1\r\n"
+        "HOST: localhost\r\n"
+        "X-Custom:   spaced value  \r\n"
+        "Connection: Upgrade, Keep-Alive\r\n"
+        "Content-Length: 5\r\n"
+        "\r\n"
+        "hello";
+    
+    HttpRequest req;
+    req.parse(raw, strlen(raw));
+    std::cout << "Host: " << req.getHeader("host") << std::endl;
+    std::cout << "X-Custom: [" << req.getHeader("x-custom") << "]" << std::endl;
+    std::cout << "keep-alive token: " << (req.headerHasToken("Connection", "keep-alive") ? "Yes" : "No") << std::endl;
+    std::cout << "close token: " << (req.headerHasToken("Connection", "close") ? "Yes" : "No") << std::endl;
+    
+    // Next request kept in place, headers re-parsed from the same buffer
+    req.resetKeepingPipelined();
+    const char* conflicting = 
+        "POST /form HTTP/1.1\r\n"
+        "Content-Length: 5\r\n"
+        "Content-Length: 6\r\n"
+        "\r\n";
+    req.parse(conflicting, strlen(conflicting));
+    std::cout << "Conflicting Content-Length error: " << req.getErrorCode() << std::endl;
+    
+    // Whitespace between the field name and the colon is rejected
+    HttpRequest spaced;
+    const char* space_colon = "GET / HTTP/1.1\r\nHost : localhost\r\n\r\n";
+    spaced.parse(space_colon, strlen(space_colon));
+    std::cout << "Space before colon error: " << spaced.getErrorCode() << std::endl;
+    
+    // A folded line is not a header of its own
+    HttpRequest folded;
+    const char* obs_fold = "POST / HTTP/1.1\r\nHost: localhost\r\n Content-Length: 5\r\n\r\nhello";
+    folded.parse(obs_fold, strlen(obs_fold));
+    std::cout << "obs-fold error: " << folded.getErrorCode() << std::endl;
+    
+    HttpRequest hosts;
+    const char* two_hosts = "GET / HTTP/1.1\r\nHost: a.example\r\nHost: b.example\r\n\r\n";
+    hosts.parse(two_hosts, strlen(two_hosts));
+    std::cout << "Duplicate Host error: " << hosts.getErrorCode() << std::endl;
+    
+    // More fields than the inline table holds spill into the request arena
+    HttpRequest many;
+    std::string big = "GET / HTTP/1.1\r\n";
+    for (int i = 0; i < 40; ++i) {
+        std::ostringstream line;
+        line << "X-Field-" << i << ": " << i << "\r\n";
+        big += line.str();
+    }
+    big += "\r\n";
+    many.parse(big.c_str(), big.size());
+    std::cout << "X-Field-39: " << many.getHeader("x-field-39") << std::endl;
+    std::cout << std::endl;
+}
+
+void testChunkedRequest() {
+    std::cout << "=== Testing Chunked Request Body ===" << std::endl;
+    
+    // Body split across reads, including inside a chunk-size line
+    const char* parts[] = {
+        "POST /upload HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n4\r\nWi",
+        "ki\r\n5;name=v\r\npedia\r\n",
+        "0\r\n\r\n"
+    };
+    
+    HttpRequest req;
+    for (size_t i = 0; i < 3; ++i)
+        req.parse(parts[i], strlen(parts[i]));
+    std::cout << "Complete: " << (req.isComplete() ? "Yes" : "No") << std::endl;
+    std::cout << "Body: " << req.getBody() << " (" << req.getContentLength() << " bytes)" << std::endl;
+    
+    // Limit applies to the decoded size
+    const char* too_big = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n10\r\n";
+    HttpRequest limited;
+    limited.setMaxBodySize(8);
+    limited.parse(too_big, strlen(too_big));
+    std::cout << "Over limit error: " << limited.getErrorCode() << std::endl;
+    
+    // chunked must be the only transfer-coding
+    const char* stacked = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n";
+    HttpRequest coded;
+    coded.parse(stacked, strlen(stacked));
+    std::cout << "gzip, chunked error: " << coded.getErrorCode() << std::endl;
+    
+    // Both framings at once: rejected, not resolved in favour of chunked
+    const char* both = "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n";
+    HttpRequest smuggled;
+    smuggled.parse(both, strlen(both));
+    std::cout << "Transfer-Encoding with Content-Length error: " << smuggled.getErrorCode() << std::endl;
+    
+    // Response side: body framed as chunks
+    HttpResponse resp = HttpResponse::ok("Hello chunked", "text/plain");
+    resp.setChunked();
+    std::cout << resp.build() << std::endl;
+    std::cout << std::endl;
+}
+
 void testHttpResponse() {
     std::cout << "=== Testing HTTP Response Generator ===" << std::endl;
     
@@ -85,6 +211,29 @@ void testHttpResponse() {
     std::cout << resp3.build() << std::endl;
 }
 
+// Status line the server answers a rejected request with
+static bool checkErrorStatus(const char* label, const std::string& raw, const std::string& expected) {
+    HttpRequest req;
+    req.parse(raw.c_str(), raw.size());
+    std::string built = HttpResponse::error(req.getErrorCode()).build();
+    std::string status = built.substr(0, built.find("\r\n"));
+    bool ok = status == expected;
+    std::cout << label << ": " << status << (ok ? "" : " (expected " + expected + ")") << std::endl;
+    return ok;
+}
+
+bool testErrorStatus() {
+    std::cout << "=== Testing Parser Error Status Lines ===" << std::endl;
+    
+    std::string oversized = "GET / HTTP/1.1\r\nHost: localhost\r\nX-Big: " + std::string(70000, 'a') + "\r\n\r\n";
+    bool ok = checkErrorStatus("Oversized headers", oversized,
+                               "HTTP/1.1 431 Request Header Fields Too Large");
+    ok = checkErrorStatus("HTTP/2.0", "GET / HTTP/2.0\r\nHost: localhost\r\n\r\n",
+                          "HTTP/1.1 505 HTTP Version Not Supported") && ok;
+    std::cout << std::endl;
+    return ok;
+}
+
 void testStaticFileHandler() {
     std::cout << "=== Testing Static File Handler ===" << std::endl;
     
@@ -135,6 +284,20 @@ void testUploadHandler() {
     HttpResponse response = handler.handleUpload(req);
     std::cout << "Upload response (status " << response.getStatusCode() << "):" << std::endl;
     std::cout << response.build() << std::endl;
+    
+    // Same body streamed one byte at a time, as the server feeds it from recv()
+    HttpRequest streamed;
+    streamed.setPauseAfterHeaders(true);
+    streamed.parse(request_str.c_str(), request_str.length() - body.length());
+    int error = 0;
+    BodySink* sink = handler.createSink(streamed, error);
+    streamed.setBodySink(sink);
+    streamed.startBody();
+    for (size_t i = 0; i < body.length(); ++i)
+        streamed.parse(body.c_str() + i, 1);
+    response = handler.handleUpload(streamed, sink);
+    std::cout << "Streamed upload status: " << response.getStatusCode() << std::endl;
+    delete sink;
 }
 
 int main() {
@@ -142,11 +305,15 @@ int main() {
     std::cout << "=============================" << std::endl << std::endl;
     
     testHttpRequestParser();
+    testPipelinedRequests();
+    testHeaderLookup();
+    testChunkedRequest();
     testHttpResponse();
+    bool statuses_ok = testErrorStatus();
     
     std::cout << "\nNote: File-based tests (static files and uploads) require" << std::endl;
     std::cout << "the ./www and ./uploads directories to exist." << std::endl;
     std::cout << "Create them and add test files to see full functionality." << std::endl;
     
-    return 0;
+    return statuses_ok ? 0 : 1;
 }